@@ -27,11 +27,15 @@
 #define _CRT_SECURE_NO_DEPRECATE
 
 #include <windows.h>
+#include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <winnt.h>                     // Only if you call ODBG2_Pluginmainloop
                                        
 #include "plugin.h"
+#include "snapcore.h"
+#include "covfile.h"
 
 #define PLUGINNAME     L"DiffSnake"    // Unique plugin name
 #define VERSION        L"1.00.00"      // Plugin version
@@ -44,273 +48,3511 @@ HINSTANCE        hdllinst;             // Instance of plugin DLL
 // begin with a 3-dword t_sorthdr: address, size, type. Data is kept sorted by
 // address
 
-typedef struct t_hitlist {
-  // Obligatory header, its layout _must_ coincide with t_sorthdr!
-  ulong          index;                // address of instruction hit.
-  ulong          size;                 // Size of index, always 1 in our case
-  ulong          type;                 // Type of entry, TY_xxx
-  // Custom data follows header.
-  wchar_t decodedinstruction[TEXTLEN];          // decoded operation
-} t_hitlist;
+#define DIFFSCROLL     16384           // Range of vertical scroll bar
+#define DIFF_HIDDEN    0xFFFFFFFF      // Hit is not shown in any row
+#define MAXRUNTRACE    0x40000000      // Limit of the run trace search
+#define MAXFILTER      32              // Max. number of terms in scan filter
+#define MAXPIECE       (MAXFILTER+1)   // Max. pieces of block after filter
+#define HASHCHUNK      65536           // Memory hashed at once, bytes
+#define CODEPAGE       4096            // Size of hashed code page, bytes
+#define NCFGCACHE      8               // Number of cached control flow graphs
+#define CFG_EXTERN     0xFFFFFFFF      // Edge leads outside of the graph
+#define NAUTOSNAP      256             // Capacity of event snapshot ring
+#define TIMELINEBAR    40              // Length of the longest timeline bar
+#define SIGWORDS       (NAUTOSNAP/32)  // Words in the set of event slots
+#define NSHADE         3               // Number of epoch shades
+
+#define SWAP_NONE      0               // Live hit trace, nothing saved
+#define SWAP_SHOWN     1               // Snapshot shown, live trace saved
+#define SWAP_LIVE      2               // Live trace shown, snapshot kept
+
+#define AUTO_NEWMOD    0x0001          // Snapshot when module is loaded
+#define AUTO_ENDMOD    0x0002          // Snapshot when module is unloaded
+#define AUTO_PAUSE     0x0004          // Snapshot when application pauses
+#define AUTO_RUN       0x0008          // Snapshot when execution continues
+#define AUTO_EXCEPTION 0x0010          // Snapshot on exception
+#define AUTO_TIMER     0x0020          // Snapshot after interval of run time
+#define AUTO_PHASE     0x0040          // Snapshot and clear, never automatic
+
+typedef struct t_threadhits {          // New instructions of single thread
+  ulong          threadid;             // Thread identifier
+  t_snapshot     hits;                 // Hits with the layout of the diff
+} t_threadhits;
+
+typedef struct t_diffview {            // State of Hit Trace Difference window
+  int            selected;             // Selected row or -1 if none
+  int            nvisible;             // Number of rows fitting into window
+  u32            nrow;                 // Number of shown rows
+  u32            *perm;                // Hit shown in each row, or NULL if all
+  u32            *rowof;               // Row of each hit or DIFF_HIDDEN
+  u32            *textid;              // Text id of each hit, or NULL
+  int            nthread;              // Number of threads in thread
+  t_threadhits   *thread;              // Hits by thread, or NULL
+} t_diffview;
+
+typedef struct t_diffrow {             // Draw cache of Hit Trace Difference
+  int            valid;                // Row contains hit
+  int            row;                  // Index of the row
+  u32            addr;                 // Address of the hit
+  int            nthread;              // Number of threads that hit it
+  ulong          threadid;             // First of these threads
+  int            modified;             // Code page changed since baseline
+  u32            epoch;                // First event with hit or 0
+  t_disasm       da;                   // Disassembled command
+} t_diffrow;
+
+typedef struct t_orderrow {            // Row of Run Trace Order
+  ulong          addr;                 // Address of new command
+  ulong          size;                 // Always 1
+  ulong          type;                 // Always 0
+  ulong          index;                // Trace index of first execution
+  ulong          threadid;             // Thread that executed it first
+} t_orderrow;
+
+typedef struct t_countrow {            // Row of Execution Count Delta
+  ulong          addr;                 // Address of command
+  ulong          size;                 // Always 1
+  ulong          type;                 // Always 0
+  ulong          before;               // Executions before the mark
+  ulong          after;                // Executions after the mark
+} t_countrow;
+
+#define FT_MODULE      0               // Term is module name pattern
+#define FT_SYSTEM      1               // Term matches system DLLs
+#define FT_RANGE       2               // Term is range of addresses
+
+typedef struct t_filterterm {          // Term of the scan filter
+  int            kind;                 // One of FT_xxx
+  int            exclude;              // Term excludes code
+  ulong          lo;                   // FT_RANGE: first address
+  ulong          hi;                   // FT_RANGE: last address
+  wchar_t        pattern[SHORTNAME];   // FT_MODULE: name pattern, case set
+} t_filterterm;
+
+typedef struct t_edgerow {             // Row of New Calls and Jumps
+  ulong          addr;                 // Number of row
+  ulong          size;                 // Always 1
+  ulong          type;                 // Always 0
+  ulong          from;                 // Address of jump or call
+  ulong          dest;                 // Address of destination
+  int            jtype;                // Type of jump, one of JT_xxx
+} t_edgerow;
+
+typedef struct t_dynregion {           // Executable memory outside of modules
+  u32            base;                 // Base address of memory block
+  u32            size;                 // Size of memory block
+  u32            hash;                 // Hash of contents, never ADDR_EMPTY
+  ulong          born;                 // Snapshot where region appeared
+} t_dynregion;
+
+typedef struct t_regionlist {          // Regions sorted by address
+  int            n;                    // Number of regions
+  int            max;                  // Number of allocated regions
+  t_dynregion    *region;              // Regions or NULL
+} t_regionlist;
+
+typedef struct t_cfgnode {             // Basic block of new code
+  u32            start;                // Address of the first command
+  u32            end;                  // Address that follows last command
+  u32            ncmd;                 // Number of commands
+} t_cfgnode;
+
+typedef struct t_cfgedge {             // Edge of control flow graph
+  u32            from;                 // Index of source node
+  u32            to;                   // Index of target node or CFG_EXTERN
+  u32            dest;                 // Address of destination
+  int            jtype;                // JT_xxx, or JT_UNDEF if fallthrough
+} t_cfgedge;
+
+typedef struct t_cfg {                 // Control flow graph of new region
+  ulong          base;                 // Base of memory block
+  ulong          size;                 // Size of memory block
+  u32            modkey;               // Hash of module version, 0 if none
+  u32            diffgen;              // Diff the graph was built from
+  int            nnode;                // Number of basic blocks
+  int            nedge;                // Number of edges
+  t_cfgnode      *node;                // Basic blocks sorted by address
+  t_cfgedge      *edge;                // Edges in the order of sources
+} t_cfg;
+
+typedef struct t_autosnap {            // Snapshot taken on debug event
+  ulong          serial;               // Number of event, 0 if slot is free
+  t_snapshot     delta;                // Hits since the previous event
+} t_autosnap;
+
+typedef struct t_eventrow {            // Row of Event Snapshots
+  ulong          addr;                 // Number of event
+  ulong          size;                 // Always 1
+  ulong          type;                 // Always 0
+  int            event;                // Event, one of AUTO_xxx
+  ulong          eip;                  // EIP at the moment of event
+  ulong          runtime;              // Run time of application, ms
+  ulong          nhit;                 // Hits since the previous event
+  wchar_t        text[SHORTNAME];      // Module name or exception code
+} t_eventrow;
 
 static t_table   hitlisttable;              // list of addresses in hit list
+static t_diffview diffview;            // Scroll and selection of hitlisttable
+
+static wchar_t   filtertext[TEXTLEN];  // Scan filter as entered by user
+static t_filterterm filter[MAXFILTER]; // Parsed scan filter
+static int       nfilter;              // Number of terms in filter
+static int       dynscan;              // Scan executable memory outside code
+static t_regionlist liveregion;        // Regions at the last snapshot
+static t_regionlist scanregion;        // Regions of snapshot in progress
+static t_regionlist baseregion;        // Regions at the moment of baseline
+static int       baseregions;          // Baseline was taken with regions
+static ulong     regionserial;         // Number of snapshots with regions
+static int       pagecheck;            // Detect modification of code pages
+static t_snapshot swaptrace;           // Live hit trace while it is not shown
+static t_snapshot painttrace;          // Snapshot shown as hit trace
+static t_addrmap epochmap;             // First event that hit each command
+static int       epochshade;           // Shade Disassembler by epoch
+static t_addrmap eventindex;           // Set of event slots of each command
+static t_strpool sigpool;              // Interned sets of event slots
+static t_addrmap sigstep;              // Old set -> new set during update
+static u32       emptysig;             // Id of the empty set
+static int       indexvalid;           // Event index is complete
+static int       swapstate;            // What is shown, one of SWAP_xxx
+static t_addrmap basepages;            // Hash of code pages at baseline
+static t_addrmap changedpages;         // Code pages changed since baseline
+static uchar     hashbuf[HASHCHUNK];   // Contents of memory being hashed
+
+static t_snapshot basesnap;            // Hit trace at the moment of baseline
+static t_snapshot diffsnap;            // Hits since baseline, ranked
+static t_diffstream diffstream;        // Diff streamed to file instead
+static wchar_t   streampath[MAXPATH];  // File of streamed diff or empty
+static int       streamtext;           // Also stream disassembly as text
+static t_arena   hitarena;             // Scratch rows for Installrows()
+static t_strpool textpool;             // Interned texts of new instructions
+static t_table   ordertable;           // New commands in order of execution
+static t_addrmap tracemap;             // Commands met while walking run trace
+static t_table   counttable;           // Commands with changed exec count
+static t_addrmap markcount;            // Executions before the mark
+static int       markrecords;          // Run trace records at mark or -1
+static int       automask;             // Events that trigger snapshot, AUTO_xxx
+static t_autosnap autoring[NAUTOSNAP]; // Deltas of last events
+static ulong     autoserial;           // Number of the last event, 0 if none
+static ulong     autostart;            // Event where diff starts, 0 if oldest
+static t_snapshot autolast;            // Hits at the moment of the last event
+static t_status  autostatus;           // Status at the last PN_STATUS
+static t_table   eventtable;           // List of event snapshots
+static t_table   edgetable;            // Jumps and calls to new code
+static u32       diffgen;              // Incremented each time diff changes
+static t_cfg     cfgcache[NCFGCACHE];  // Recently built graphs
+static int       cfgnext;              // Cache entry to be replaced next
+static ulong     automaxhit;           // Largest nhit of events in the ring
+static ulong     autointerval;         // Timer interval, s, or 0 if off
+static ulong     runtime;              // Run time of application, ms
+static ulong     runtick;              // Tick count at the last main loop
+static ulong     nexttimer;            // Run time of the next timer event
+
+// Sorting function used to order rows in hitarena by address. Rows of any
+// kind begin with t_sorthdr.
+static int Sorthdrsortfunc(const void *p1,const void *p2) {
+  ulong a1=((const t_sorthdr *)p1)->addr;
+  ulong a2=((const t_sorthdr *)p2)->addr;
+  return (a1<a2?-1:(a1>a2?1:0));
+};
+
+// Sorting function for qsort() that orders addresses.
+static int Addrsortfunc(const void *p1,const void *p2) {
+  u32 a1=*(const u32 *)p1,a2=*(const u32 *)p2;
+  return (a1<a2?-1:(a1>a2?1:0));
+};
+
+// Passes all rows accumulated in the arena to the sorted data in a single
+// call. Memory blocks are scanned in ascending order, so rows usually arrive
+// already sorted and the check below is all it costs; sorting happens only if
+// this order is violated. Returns number of installed rows or -1 on error.
+static int Installrows(t_sorted *sd,t_arena *pa,ulong itemsize) {
+  ulong i,n,prev;
+  uchar *rows;
+  n=Arenacount(pa,itemsize);
+  if (n==0)
+    return 0;
+  rows=(uchar *)Arenaptr(pa,0);
+  prev=((t_sorthdr *)rows)->addr;
+  for (i=1; i<n; i++) {
+    if (((t_sorthdr *)(rows+i*itemsize))->addr<=prev) break;
+    prev=((t_sorthdr *)(rows+i*itemsize))->addr; };
+  if (i<n)
+    qsort(rows,n,itemsize,Sorthdrsortfunc);
+  if (Replacesorteddatarange(sd,rows,n,0,0xFFFFFFFF)!=0)
+    return -1;
+  return n;
+};
+
+// Parses hexadecimal number of n characters. Returns 0 on success and -1 if
+// string is not a number.
+static int Parsehex(const wchar_t *s,int n,ulong *u) {
+  int i;
+  wchar_t c;
+  if (n<=0 || n>8)
+    return -1;
+  for (*u=0,i=0; i<n; i++) {
+    c=s[i];
+    if (c>=L'0' && c<=L'9') *u=*u*16+(c-L'0');
+    else if (c>=L'A' && c<=L'F') *u=*u*16+(c-L'A'+10);
+    else if (c>=L'a' && c<=L'f') *u=*u*16+(c-L'a'+10);
+    else return -1; };
+  return 0;
+};
+
+// Parses scan filter into terms. Terms are separated by spaces, commas or
+// semicolons. Term is module name pattern with wildcards * and ?, keyword
+// "system" for system DLLs (Issystem()) or address range lo-hi in hex, and
+// term preceded by - excludes code. On error, reports the bad term, leaves
+// filter unchanged and returns -1.
+static int Parsefilter(const wchar_t *text) {
+  int i,n,len,dash,nterm;
+  t_filterterm term[MAXFILTER],*pt;
+  wchar_t s[SHORTNAME];
+  nterm=0;
+  for (i=0; text[i]!=L'\0'; ) {
+    if (text[i]==L' ' || text[i]==L',' || text[i]==L';' || text[i]==L'\t') {
+      i++; continue; };
+    for (len=0; text[i+len]!=L'\0' && text[i+len]!=L' ' && text[i+len]!=L',' &&
+      text[i+len]!=L';' && text[i+len]!=L'\t'; len++) ;
+    if (nterm>=MAXFILTER) {
+      Flash(L"Too many filter terms");
+      return -1; };
+    pt=term+nterm;
+    pt->exclude=(text[i]==L'-');
+    n=(text[i]==L'-' || text[i]==L'+'?1:0);
+    if (len-n>=SHORTNAME || len-n<=0) {
+      Flash(L"Invalid filter term");
+      return -1; };
+    StrcopyW(s,len-n+1,text+i+n);
+    for (dash=0; s[dash]!=L'\0' && s[dash]!=L'-'; dash++) ;
+    if (s[dash]==L'-' && Parsehex(s,dash,&pt->lo)==0 &&
+      Parsehex(s+dash+1,len-n-dash-1,&pt->hi)==0) {
+      pt->kind=FT_RANGE;
+      if (pt->hi<pt->lo) {
+        Flash(L"Invalid range %s",s);
+        return -1; }; }
+    else {
+      StrcopycaseW(pt->pattern,SHORTNAME,s);
+      StrcopycaseW(s,SHORTNAME,L"system");
+      pt->kind=(StrcmpW(pt->pattern,s)==0?FT_SYSTEM:FT_MODULE);
+    };
+    nterm++;
+    i+=len; };
+  memcpy(filter,term,nterm*sizeof(t_filterterm));
+  nfilter=nterm;
+  return 0;
+};
+
+// Matches string against pattern with wildcards * and ?.
+static int Wildmatch(const wchar_t *pat,const wchar_t *s) {
+  const wchar_t *star,*rest;
+  star=rest=NULL;
+  while (*s!=L'\0') {
+    if (*pat==L'*') {
+      star=pat++; rest=s; }
+    else if (*pat==L'?' || *pat==*s) {
+      pat++; s++; }
+    else if (star!=NULL) {
+      pat=star+1; s=++rest; }
+    else
+      return 0;
+  };
+  while (*pat==L'*') pat++;
+  return (*pat==L'\0');
+};
+
+// Checks whether module or system term matches code at given address. Module
+// name is compared both as short name and as file name with extension.
+static int Filtermatch(const t_filterterm *pt,t_module *pmod,ulong addr) {
+  int i;
+  wchar_t s[SHORTNAME];
+  if (pt->kind==FT_SYSTEM)
+    return (Issystem(addr)!=0);
+  if (pmod==NULL)
+    return 0;
+  StrcopycaseW(s,SHORTNAME,pmod->modname);
+  if (Wildmatch(pt->pattern,s))
+    return 1;
+  for (i=StrlenW(pmod->path,MAXPATH); i>0 && pmod->path[i-1]!=L'\\'; i--) ;
+  StrcopycaseW(s,SHORTNAME,pmod->path+i);
+  return Wildmatch(pt->pattern,s);
+};
+
+// Applies scan filter to memory block. Returns number of pieces of the block
+// that must be scanned, first and last addresses of pieces are returned in
+// piece, which must have space for MAXPIECE pairs. Include ranges are merged
+// first, so pieces never overlap, and each exclude range adds at most one
+// piece. Filter is applied before decoding of the block is looked at, so
+// excluded code costs nothing in any snapshot.
+static int Filterblock(ulong base,ulong size,ulong *piece) {
+  int i,j,k,n,ninclude,whole;
+  ulong lo,hi;
+  t_module *pmod;
+  if (nfilter==0) {
+    piece[0]=base; piece[1]=base+size-1;
+    return 1; };
+  pmod=Findmodule(base);
+  ninclude=0;
+  whole=0;
+  for (i=0; i<nfilter; i++) {
+    if (filter[i].exclude==0) ninclude++;
+    if (filter[i].kind==FT_RANGE || Filtermatch(filter+i,pmod,base)==0)
+      continue;
+    if (filter[i].exclude)
+      return 0;                        // Module is excluded
+    whole=1; };
+  // Start with the whole block or with its intersections with include
+  // ranges, then cut out exclude ranges.
+  n=0;
+  if (ninclude==0 || whole) {
+    piece[0]=base; piece[1]=base+size-1; n=1; }
+  else {
+    for (i=0; i<nfilter; i++) {
+      if (filter[i].kind!=FT_RANGE || filter[i].exclude) continue;
+      lo=(filter[i].lo>base?filter[i].lo:base);
+      hi=(filter[i].hi<base+size-1?filter[i].hi:base+size-1);
+      if (lo<=hi) {
+        piece[n*2]=lo; piece[n*2+1]=hi; n++; };
+    };
+    // Sort intersections by start and merge those that overlap or touch.
+    for (k=1; k<n; k++) {
+      lo=piece[k*2]; hi=piece[k*2+1];
+      for (j=k; j>0 && piece[j*2-2]>lo; j--) {
+        piece[j*2]=piece[j*2-2]; piece[j*2+1]=piece[j*2-1]; };
+      piece[j*2]=lo; piece[j*2+1]=hi;
+    };
+    for (k=0,j=0; j<n; j++) {
+      if (k>0 && (piece[j*2]<=piece[k*2-1] || piece[j*2]==piece[k*2-1]+1)) {
+        if (piece[j*2+1]>piece[k*2-1]) piece[k*2-1]=piece[j*2+1]; }
+      else {
+        piece[k*2]=piece[j*2]; piece[k*2+1]=piece[j*2+1]; k++;
+      };
+    };
+    n=k;
+  };
+  for (i=0; i<nfilter; i++) {
+    if (filter[i].kind!=FT_RANGE || filter[i].exclude==0) continue;
+    for (j=n-1; j>=0; j--) {
+      lo=piece[j*2]; hi=piece[j*2+1];
+      if (filter[i].hi<lo || filter[i].lo>hi) continue;
+      // Remove piece and add back parts that stick out of the range.
+      piece[j*2]=piece[(n-1)*2]; piece[j*2+1]=piece[(n-1)*2+1]; n--;
+      if (lo<filter[i].lo) {
+        piece[n*2]=lo; piece[n*2+1]=filter[i].lo-1; n++; };
+      if (hi>filter[i].hi) {
+        piece[n*2]=filter[i].hi+1; piece[n*2+1]=hi; n++; };
+    };
+  };
+  assert(n<=MAXPIECE);
+  return n;
+};
+
+// Checks whether memory block that is not code contains executable memory
+// allocated or mapped by the application. JIT compilers, unpackers and
+// shellcode place their code there, and OllyDbg doesn't mark such blocks as
+// code, so they are selected by access rights.
+static int Isdynamiccode(const t_memory *pmem) {
+  if ((pmem->access & (PAGE_EXECUTE|PAGE_EXECUTE_READ|
+    PAGE_EXECUTE_READWRITE|PAGE_EXECUTE_WRITECOPY))==0)
+    return 0;                          // Not executable
+  return (Findmodule(pmem->base)==NULL);
+};
+
+// Calculates hash of the contents of memory. Unreadable memory is skipped.
+static u32 Hashregion(ulong base,ulong size) {
+  ulong offset,n;
+  u32 h;
+  h=0;
+  for (offset=0; offset<size; offset+=HASHCHUNK) {
+    n=(size-offset<HASHCHUNK?size-offset:HASHCHUNK);
+    n=Readmemory(hashbuf,base+offset,n,MM_SILENT|MM_PARTIAL);
+    h=Hashbytes(hashbuf,n,h); };
+  return (h==ADDR_EMPTY?0:h);          // ADDR_EMPTY is reserved by maps
+};
+
+// Adds region to the end of the list. Returns 0 on success and -1 on error.
+static int Addregion(t_regionlist *pl,u32 base,u32 size,u32 hash,ulong born) {
+  t_dynregion *pr;
+  if (pl->n>=pl->max) {
+    pr=(t_dynregion *)realloc(pl->region,(pl->max*2+64)*sizeof(t_dynregion));
+    if (pr==NULL)
+      return -1;
+    pl->region=pr;
+    pl->max=pl->max*2+64; };
+  pr=pl->region+pl->n++;
+  pr->base=base;
+  pr->size=size;
+  pr->hash=hash;
+  pr->born=born;
+  return 0;
+};
+
+// Frees list of regions.
+static void Freeregions(t_regionlist *pl) {
+  if (pl->region!=NULL) free(pl->region);
+  memset(pl,0,sizeof(t_regionlist));
+};
+
+// Compares regions found by the snapshot with regions of the previous one,
+// reports changes and makes new regions live. Both lists are sorted by
+// address, so they are compared in a single merge walk.
+static void Updateregions(void) {
+  int i,j;
+  t_dynregion *po,*pn;
+  t_regionlist tmp;
+  i=j=0;
+  while (i<liveregion.n || j<scanregion.n) {
+    po=(i<liveregion.n?liveregion.region+i:NULL);
+    pn=(j<scanregion.n?scanregion.region+j:NULL);
+    if (pn==NULL || (po!=NULL && po->base<pn->base)) {
+      Addtolist(po->base,DRAW_NORMAL,L"DiffSnake: Region %08X (%u bytes) disappeared, lived from snapshot %lu",
+        po->base,po->size,po->born);
+      i++; }
+    else if (po==NULL || pn->base<po->base) {
+      pn->born=regionserial;
+      Addtolist(pn->base,DRAW_NORMAL,L"DiffSnake: Region %08X (%u bytes) appeared",
+        pn->base,pn->size);
+      j++; }
+    else {
+      if (pn->size==po->size && pn->hash==po->hash)
+        pn->born=po->born;
+      else {
+        pn->born=regionserial;
+        Addtolist(pn->base,DRAW_NORMAL,L"DiffSnake: Region %08X (%u bytes) reused for new code",
+          pn->base,pn->size); };
+      i++; j++;
+    };
+  };
+  tmp=liveregion;
+  liveregion=scanregion;
+  scanregion=tmp;
+  scanregion.n=0;
+};
+
+// Selects parts of memory block that are scanned into snapshots: block must
+// contain code and pass scan filter. Returns number of pieces, their first and
+// last addresses in piece (see Filterblock()), decoding information of the
+// block in decode and, in dynamic, whether block is executable memory outside
+// of modules. Pieces are clipped to the decoding information and sorted.
+static int Scanpieces(const t_memory *pmem,ulong *piece,uchar **decode,
+  int *dynamic) {
+  int j,k,npiece;
+  ulong n,lo,hi,declength;
+  if ((pmem->type & MEM_GAP)!=0)
+    return 0;                          // Unallocated memory
+  // Check whether it contains executable code.
+  *dynamic=0;
+  if ((pmem->type & (MEM_CODE|MEM_SFX))==0) {
+    if (dynscan==0 || Isdynamiccode(pmem)==0)
+      return 0;                        // Not a code
+    *dynamic=1; };
+  npiece=Filterblock(pmem->base,pmem->size,piece);
+  if (npiece==0)
+    return 0;                          // Excluded by scan filter
+  *decode=Finddecode(pmem->base,&declength);
+  if (*decode==NULL)
+    return 0;                          // Not analysed, can't be traced
+  n=(declength<pmem->size?declength:pmem->size);
+  for (k=npiece-1; k>=0; k--) {
+    if (piece[k*2]-pmem->base>=n) {
+      piece[k*2]=piece[(npiece-1)*2]; piece[k*2+1]=piece[(npiece-1)*2+1];
+      npiece--; }
+    else if (piece[k*2+1]-pmem->base>=n)
+      piece[k*2+1]=pmem->base+n-1;
+  };
+  // Snapshots expect blocks in ascending order. Pieces are few, so simple
+  // insertion sort is fine.
+  for (k=1; k<npiece; k++) {
+    lo=piece[k*2]; hi=piece[k*2+1];
+    for (j=k; j>0 && piece[j*2-2]>lo; j--) {
+      piece[j*2]=piece[j*2-2]; piece[j*2+1]=piece[j*2-1]; };
+    piece[j*2]=lo; piece[j*2+1]=hi;
+  };
+  return npiece;
+};
+
+// Collects addresses marked by the hit trace in all code blocks. Decoding
+// information of each block is requested once and then scanned as an array.
+// If regions is set, tracks executable regions outside of modules. Returns 0
+// on success and -1 if memory is low.
+static int Readtrace(t_snapshot *ps,int regions) {
+  int i,k,npiece,dynamic;
+  ulong j,offset,piece[2*MAXPIECE];
+  uchar *decode;
+  t_memory *pmem;
+  t_hitblock *pb;
+  Snapfree(ps);
+  scanregion.n=0;
+  for (i=0; i<memory.sorted.n; i++) {
+    pmem=(t_memory *)Getsortedbyindex(&memory.sorted,i);    // Get next memory block.
+    npiece=Scanpieces(pmem,piece,&decode,&dynamic);
+    if (npiece==0)
+      continue;
+    if (dynamic && regions && Addregion(&scanregion,pmem->base,pmem->size,
+      Hashregion(pmem->base,pmem->size),0)!=0) {
+      Snapfree(ps);
+      return -1; };
+    for (k=0; k<npiece; k++) {
+      offset=piece[k*2]-pmem->base;
+      pb=Snapaddblock(ps,piece[k*2],piece[k*2+1]-piece[k*2]+1);
+      if (pb==NULL) {
+        Snapfree(ps);
+        return -1; };
+      for (j=0; j<pb->size; j++) {
+        if (decode[offset+j] & DEC_TRACED) Setbit(pb,j); };
+    };
+  };
+  if (dynscan && regions) {
+    regionserial++;
+    Updateregions(); };
+  return Snapbuildrank(ps);
+};
+
+// Takes snapshot of the hit trace.
+static int Takesnapshot(t_snapshot *ps) {
+  return Readtrace(ps,1);
+};
+
+// Removes hit trace marks from the part first..last of decoding array. Marks
+// are cleared four bytes at once. Returns number of cleared marks.
+static ulong Clearpiece(uchar *decode,ulong first,ulong last) {
+  ulong j,count;
+  u32 *pw;
+  count=0;
+  // Unaligned head and tail byte by byte, middle as 32-bit words.
+  for (j=first; j<=last && ((ulong)(decode+j) & 3)!=0; j++) {
+    if (decode[j] & DEC_TRACED) {
+      decode[j]&=~DEC_TRACED; count++; };
+  };
+  for ( ; j+3<=last; j+=4) {
+    pw=(u32 *)(decode+j);
+    if ((*pw & 0x80808080)==0)
+      continue;
+    count+=Popcount(*pw & 0x80808080);
+    *pw&=0x7F7F7F7F; };
+  for ( ; j<=last; j++) {
+    if (decode[j] & DEC_TRACED) {
+      decode[j]&=~DEC_TRACED; count++; };
+  };
+  return count;
+};
+
+// Removes hit trace marks from all code that is scanned into snapshots.
+// Returns number of cleared marks.
+static ulong Clearhittrace(void) {
+  int i,k,npiece,dynamic;
+  ulong count,piece[2*MAXPIECE];
+  uchar *decode;
+  t_memory *pmem;
+  count=0;
+  for (i=0; i<memory.sorted.n; i++) {
+    pmem=(t_memory *)Getsortedbyindex(&memory.sorted,i);
+    npiece=Scanpieces(pmem,piece,&decode,&dynamic);
+    for (k=0; k<npiece; k++)
+      count+=Clearpiece(decode,piece[k*2]-pmem->base,piece[k*2+1]-pmem->base);
+  };
+  return count;
+};
+
+// Replaces hit trace marks of all scanned code with hits of the snapshot.
+// Each piece is cleared as a whole, then marks are set only where snapshot
+// has hits, so the cost is the size of the code divided by 4 plus the number
+// of hits. Hits outside of the scanned code are ignored.
+static void Writetrace(const t_snapshot *ps) {
+  int i,k,npiece,dynamic;
+  u32 addr;
+  ulong piece[2*MAXPIECE];
+  uchar *decode;
+  t_memory *pmem;
+  t_snapiter it;
+  for (i=0; i<memory.sorted.n; i++) {
+    pmem=(t_memory *)Getsortedbyindex(&memory.sorted,i);
+    npiece=Scanpieces(pmem,piece,&decode,&dynamic);
+    for (k=0; k<npiece; k++) {
+      Clearpiece(decode,piece[k*2]-pmem->base,piece[k*2+1]-pmem->base);
+      Snapiterinit(&it,ps,piece[k*2],piece[k*2+1]);
+      while (Snapiternext(&it,&addr))
+        decode[addr-pmem->base]|=DEC_TRACED;
+    };
+  };
+};
+
+// Gets live hit trace while snapshot is shown. Application may run meanwhile,
+// and OllyDbg marks new hits on top of the painted ones, so marks that were
+// not painted are added to the saved live trace. Returns 0 on success and -1
+// on error.
+static int Getlivetrace(t_snapshot *live) {
+  int result;
+  const t_snapshot *src[2];
+  t_snapshot cur,fresh;
+  Snapinit(&cur);
+  Snapinit(&fresh);
+  if (Readtrace(&cur,0)!=0 || Snapandnot(&fresh,&cur,&painttrace)!=0)
+    result=-1;
+  else {
+    src[0]=&swaptrace; src[1]=&fresh;
+    result=Snapunion(live,src,2); };
+  Snapfree(&cur);
+  Snapfree(&fresh);
+  return result;
+};
+
+// Shows hits of the snapshot as hit trace. Live hit trace is saved to
+// swaptrace, and snapshot is kept in painttrace. Returns 0 on success and -1
+// on error.
+static int Painttrace(const t_snapshot *ps) {
+  t_snapshot live;
+  Snapinit(&live);
+  if (swapstate==SWAP_SHOWN ? Getlivetrace(&live)!=0 : Readtrace(&live,0)!=0) {
+    Snapfree(&live);
+    return -1; };
+  Snapfree(&swaptrace);
+  swaptrace=live;
+  if (Snapunion(&painttrace,&ps,1)!=0) {
+    // Live marks are still shown, unless another snapshot was shown before.
+    if (swapstate==SWAP_SHOWN) Writetrace(&swaptrace);
+    Snapfree(&swaptrace);
+    Snapfree(&painttrace);
+    swapstate=SWAP_NONE;
+    Redrawcpudisasm();
+    return -1; };
+  swapstate=SWAP_SHOWN;
+  Writetrace(&painttrace);
+  Redrawcpudisasm();
+  return 0;
+};
+
+// Exchanges shown snapshot with live hit trace. Live trace is read again when
+// it is saved, so hits made while either side is shown are not lost. Returns
+// 0 on success and -1 on error.
+static int Swaptrace(void) {
+  t_snapshot live;
+  Snapinit(&live);
+  if (swapstate==SWAP_SHOWN) {
+    if (Getlivetrace(&live)!=0) {
+      Snapfree(&live);
+      return -1; };
+    Writetrace(&live);
+    Snapfree(&live);
+    Snapfree(&swaptrace);
+    swapstate=SWAP_LIVE; }
+  else {
+    if (Readtrace(&swaptrace,0)!=0) {
+      Snapfree(&swaptrace);
+      return -1; };
+    Writetrace(&painttrace);
+    swapstate=SWAP_SHOWN; };
+  Redrawcpudisasm();
+  return 0;
+};
+
+// Calculates hash of every code page that contains hits of the snapshot, so
+// that hits on pages modified since baseline can be marked in the diff. After
+// the page is hashed, walk restarts on the next page, so the number of reads
+// equals the number of executed pages, whatever the size of modules. Returns
+// 0 on success and -1 on error.
+static int Hashpages(const t_snapshot *ps,t_addrmap *pm) {
+  u32 addr,page,*phash;
+  ulong n;
+  t_snapiter it;
+  Mapreset(pm);
+  Snapiterinit(&it,ps,0,0xFFFFFFFF);
+  while (Snapiternext(&it,&addr)) {
+    page=addr & ~(CODEPAGE-1);
+    n=Readmemory(hashbuf,page,CODEPAGE,MM_SILENT|MM_PARTIAL);
+    phash=Mapinsert(pm,page,NULL);
+    if (phash==NULL)
+      return -1;
+    *phash=Hashbytes(hashbuf,n,0);
+    if (page+CODEPAGE==0)
+      break;                           // Last page of address space
+    Snapiterinit(&it,ps,page+CODEPAGE,0xFFFFFFFF);
+  };
+  return 0;
+};
+
+// Hashes again pages hashed at baseline and collects pages whose contents
+// have changed. Returns number of changed pages or -1 on error.
+static int Findchangedpages(void) {
+  int n;
+  u32 i,*pflag;
+  ulong length;
+  Mapreset(&changedpages);
+  n=0;
+  for (i=0; i<basepages.nslot; i++) {
+    if (basepages.key[i]==ADDR_EMPTY)
+      continue;
+    length=Readmemory(hashbuf,basepages.key[i],CODEPAGE,MM_SILENT|MM_PARTIAL);
+    if (Hashbytes(hashbuf,length,0)==basepages.value[i])
+      continue;
+    pflag=Mapinsert(&changedpages,basepages.key[i],NULL);
+    if (pflag==NULL)
+      return -1;
+    *pflag=1;
+    n++; };
+  return n;
+};
+
+// Corrects diff in executable regions that differ from the baseline region at
+// the same address. Hits of such region are compared with hits of baseline
+// region that had the same contents, wherever it was, and if there was no
+// such region, all hits are new. Returns number of corrected regions or -1 on
+// error.
+static int Rekeyregions(t_snapshot *diff,const t_snapshot *cur) {
+  int i,j,n;
+  u32 addr,*pidx;
+  t_dynregion *pr,*pbase;
+  t_hitblock *pb;
+  t_snapiter it;
+  // Baseline regions by contents.
+  Mapreset(&tracemap);
+  for (j=0; j<baseregion.n; j++) {
+    pidx=Mapinsert(&tracemap,baseregion.region[j].hash,NULL);
+    if (pidx==NULL) {
+      Mapreset(&tracemap);
+      return -1; };
+    *pidx=j; };
+  n=j=0;
+  for (i=0; i<liveregion.n; i++) {
+    pr=liveregion.region+i;
+    while (j<baseregion.n && baseregion.region[j].base<pr->base) j++;
+    if (j<baseregion.n && baseregion.region[j].base==pr->base &&
+      baseregion.region[j].size==pr->size && baseregion.region[j].hash==pr->hash)
+      continue;                        // Same code at the same place
+    pidx=Mapfind(&tracemap,pr->hash);
+    pbase=(pidx==NULL?NULL:baseregion.region+*pidx);
+    if (pbase!=NULL && pbase->size!=pr->size)
+      pbase=NULL;
+    Snapiterinit(&it,cur,pr->base,pr->base+pr->size-1);
+    while (Snapiternext(&it,&addr)) {
+      pb=Snapfindblock(diff,addr);
+      if (pb==NULL)
+        continue;
+      if (pbase!=NULL && Snaptest(&basesnap,addr-pr->base+pbase->base))
+        pb->bits[(addr-pb->base)>>5]&=~(1u<<((addr-pb->base)&31));
+      else
+        Setbit(pb,addr-pb->base);
+    };
+    n++;
+  };
+  Mapreset(&tracemap);
+  if (n>0 && Snapbuildrank(diff)!=0)
+    return -1;
+  return n;
+};
+
+// Assigns epoch to hits of the event delta that have none. Epoch of the
+// command is the first event that contained it. Delta holds only hits new
+// since the previous event, so the cost is proportional to the number of new
+// hits. Returns 0 on success and -1 on error.
+static int Addepochs(const t_snapshot *delta,ulong serial) {
+  int isnew;
+  u32 addr,*pepoch;
+  t_snapiter it;
+  Snapiterinit(&it,delta,0,0xFFFFFFFF);
+  while (Snapiternext(&it,&addr)) {
+    pepoch=Mapinsert(&epochmap,addr,&isnew);
+    if (pepoch==NULL)
+      return -1;
+    if (isnew) *pepoch=serial; };
+  return 0;
+};
+
+// Returns epoch of the command or 0 if it was not hit by any event.
+static u32 Getepoch(u32 addr) {
+  u32 *pepoch;
+  pepoch=Mapfind(&epochmap,addr);
+  return (pepoch==NULL?0:*pepoch);
+};
+
+// Discards event index. Index keeps for each command the set of ring slots
+// whose snapshots contain it. Sets are bitsets of NAUTOSNAP bits interned in
+// sigpool, so commands hit by the same events share single copy.
+static void Indexreset(void) {
+  u32 set[SIGWORDS];
+  Mapreset(&eventindex);
+  Poolreset(&sigpool);
+  memset(set,0,sizeof(set));
+  emptysig=Poolintern(&sigpool,(const u16 *)set,SIGWORDS*2);
+  indexvalid=(emptysig!=POOL_NULL);
+};
+
+// Returns id of the set in pool that is old set with ring slot removed and,
+// if add is set, added again. Result is cached in sigstep by old id.
+static u32 Indexnextset(t_strpool *pool,u32 sig,int slot,int add) {
+  int isnew;
+  u32 len,*pnext,set[SIGWORDS];
+  pnext=Mapinsert(&sigstep,sig*2+(add?1:0),&isnew);
+  if (pnext==NULL)
+    return POOL_NULL;
+  if (isnew) {
+    memcpy(set,Poolstring(&sigpool,sig,&len),sizeof(set));
+    set[slot/32]&=~(1u<<(slot%32));
+    if (add) set[slot/32]|=1u<<(slot%32);
+    *pnext=Poolintern(pool,(const u16 *)set,SIGWORDS*2); };
+  return *pnext;
+};
+
+// Gives ring slot to the snapshot ps, or takes it away if ps is NULL. Hit
+// trace is cumulative, so snapshot of the event contains all commands hit
+// since the last phase end, not only its delta. Index and sets are built
+// anew, so that commands and sets that are no longer in any event in the
+// ring are dropped, and each distinct set is calculated once. Cost is linear
+// in the number of indexed commands. Returns 0 on success and -1 on error.
+static int Indexupdate(int slot,const t_snapshot *ps) {
+  int ok;
+  u32 i,addr,sig,*psig,set[SIGWORDS];
+  t_strpool pool;
+  t_addrmap index;
+  t_snapiter it;
+  Poolinit(&pool);
+  Mapinit(&index);
+  Mapreset(&sigstep);
+  memset(set,0,sizeof(set));
+  sig=Poolintern(&pool,(const u16 *)set,SIGWORDS*2);
+  ok=(sig!=POOL_NULL);                 // Empty set gets id 0
+  // Commands already in the index.
+  for (i=0; i<eventindex.nslot && ok; i++) {
+    addr=eventindex.key[i];
+    if (addr==ADDR_EMPTY) continue;
+    sig=Indexnextset(&pool,eventindex.value[i],slot,ps!=NULL && Snaptest(ps,addr));
+    if (sig==POOL_NULL) ok=0;
+    else if (sig!=0) {                 // Set 0 is empty
+      psig=Mapinsert(&index,addr,NULL);
+      if (psig==NULL) ok=0; else *psig=sig; };
+  };
+  // Commands hit for the first time since they dropped out of the index.
+  if (ps!=NULL && ok) {
+    Snapiterinit(&it,ps,0,0xFFFFFFFF);
+    while (ok && Snapiternext(&it,&addr)) {
+      if (Mapfind(&eventindex,addr)!=NULL) continue;
+      sig=Indexnextset(&pool,emptysig,slot,1);
+      psig=(sig==POOL_NULL?NULL:Mapinsert(&index,addr,NULL));
+      if (psig==NULL) ok=0; else *psig=sig; };
+  };
+  Mapreset(&sigstep);
+  if (ok==0) {
+    Poolfree(&pool);
+    Mapfree(&index);
+    return -1; };
+  Poolfree(&sigpool);
+  Mapfree(&eventindex);
+  sigpool=pool;
+  eventindex=index;
+  emptysig=0;
+  return 0;
+};
+
+// Updates event index when ring slot receives snapshot ps or, if ps is NULL,
+// loses it. On error, index is discarded till the events are cleared.
+static void Indexevent(int slot,const t_snapshot *ps) {
+  if (indexvalid==0)
+    return;
+  if (Indexupdate(slot,ps)!=0) {
+    Mapreset(&eventindex);
+    Poolreset(&sigpool);
+    indexvalid=0;
+    Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, event index is discarded"); };
+};
+
+// Returns set of event slots that hit the command, or NULL if none.
+static const u32 *Eventsof(u32 addr) {
+  u32 len,*psig;
+  psig=Mapfind(&eventindex,addr);
+  if (indexvalid==0 || psig==NULL || *psig==emptysig)
+    return NULL;
+  return (const u32 *)Poolstring(&sigpool,*psig,&len);
+};
+
+// Disassembles command at the given address.
+static void Decodehit(u32 addr,t_disasm *da) {
+  ulong length,declength;
+  uchar cmd[MAXCMDSIZE],*decode;
+  // Length of 80x86 commands is limited to MAXCMDSIZE bytes.
+  length=Readmemory(cmd,addr,MAXCMDSIZE,MM_SILENT|MM_PARTIAL);
+  decode=Finddecode(addr,&declength);
+  if (decode!=NULL && declength<length)
+    decode=NULL;
+  if (length==0 ||
+    Disasm(cmd,length,addr,decode,da,DA_TEXT|DA_OPCOMM|DA_MEMORY,NULL,NULL)==0)
+    StrcopyW(da->result,TEXTLEN,L"???");
+};
+
+// Discards sorting, filtering, texts, threads and streamed diff of Hit Trace
+// Difference, so that it again shows all hits of diffsnap in the order of
+// addresses. File of streamed diff is closed but remains on disk.
+static void Diffviewreset(void) {
+  int i;
+  diffgen++;
+  Streamfree(&diffstream);
+  if (diffview.perm!=NULL) free(diffview.perm);
+  if (diffview.rowof!=NULL) free(diffview.rowof);
+  if (diffview.textid!=NULL) free(diffview.textid);
+  for (i=0; i<diffview.nthread; i++)
+    Snapfree(&diffview.thread[i].hits);
+  if (diffview.thread!=NULL) free(diffview.thread);
+  diffview.perm=NULL;
+  diffview.rowof=NULL;
+  diffview.textid=NULL;
+  diffview.nthread=0;
+  diffview.thread=NULL;
+  diffview.nrow=diffsnap.nhit;
+  Poolreset(&textpool);
+};
+
+// Number of hits in the diff, either in memory or streamed to file.
+static u32 Diffhits(void) {
+  return (diffstream.f!=NULL?diffstream.nhit:diffsnap.nhit);
+};
+
+// Returns index of the first hit of the diff at or after addr.
+static u32 Diffrank(u32 addr) {
+  if (diffstream.f!=NULL)
+    return Streamfind(&diffstream,addr);
+  return Snaprank(&diffsnap,addr);
+};
+
+// Gets address of the hit with given index. Streamed diff is paged in from
+// the file by groups. Returns 0 on success and -1 on error.
+static int Diffselect(u32 hit,u32 *addr) {
+  if (diffstream.f!=NULL)
+    return Streamget(&diffstream,hit,addr);
+  return Snapselect(&diffsnap,hit,addr);
+};
+
+// Checks whether command at addr is in the diff.
+static int Difftest(u32 addr) {
+  u32 hit;
+  if (diffstream.f==NULL)
+    return Snaptest(&diffsnap,addr);
+  return (Diffselect(Diffrank(addr),&hit)==0 && hit==addr);
+};
+
+// Gets address of the command shown in given row of Hit Trace Difference.
+// Returns 0 on success and -1 if row is out of range.
+static int Diffrowaddr(int row,u32 *addr) {
+  if (row<0 || (u32)row>=diffview.nrow)
+    return -1;
+  if (diffview.perm!=NULL)
+    row=diffview.perm[row];
+  return Diffselect(row,addr);
+};
 
-t_hitlist baselist;
+// Writes new commands of the current hit trace to streampath as they are
+// found, and, if streamtext is set, their disassembly to the text file with
+// additional extension .txt. Hit trace is walked like in Readtrace(), but no
+// snapshot is built, so memory does not depend on the size of the diff. On
+// success, returns 0 and leaves diffstream open for reading. Returns -1 if
+// file can't be written.
+static int Streamtrace(void) {
+  int i,k,npiece,dynamic,err;
+  ulong j,offset,piece[2*MAXPIECE];
+  uchar *decode;
+  wchar_t textpath[MAXPATH+4];
+  char text[TEXTLEN*3];
+  t_memory *pmem;
+  t_disasm da;
+  FILE *f,*ft;
+  f=_wfopen(streampath,L"w+b");
+  if (f==NULL || Streamcreate(&diffstream,f)!=0)
+    return -1;
+  ft=NULL;
+  if (streamtext) {
+    Swprintf(textpath,L"%s.txt",streampath);
+    ft=_wfopen(textpath,L"wb");
+    if (ft==NULL) {
+      Streamfree(&diffstream);
+      return -1;
+    };
+  };
+  scanregion.n=0;
+  err=0;
+  for (i=0; i<memory.sorted.n && err==0; i++) {
+    pmem=(t_memory *)Getsortedbyindex(&memory.sorted,i);
+    npiece=Scanpieces(pmem,piece,&decode,&dynamic);
+    if (npiece==0)
+      continue;
+    Progress((int)((u64)i*1000/memory.sorted.n),L"Streaming diff: ");
+    if (dynamic && Addregion(&scanregion,pmem->base,pmem->size,
+      Hashregion(pmem->base,pmem->size),0)!=0)
+      err=1;
+    for (k=0; k<npiece && err==0; k++) {
+      offset=piece[k*2]-pmem->base;
+      for (j=0; j<=piece[k*2+1]-piece[k*2] && err==0; j++) {
+        if ((decode[offset+j] & DEC_TRACED)==0 ||
+          Snaptest(&basesnap,piece[k*2]+j))
+          continue;
+        if (Streamput(&diffstream,piece[k*2]+j)!=0)
+          err=1;
+        else if (ft!=NULL) {
+          Decodehit(piece[k*2]+j,&da);
+          if (WideCharToMultiByte(CP_UTF8,0,da.result,-1,
+            text,sizeof(text),NULL,NULL)==0)
+            text[0]='\0';
+          if (fprintf(ft,"%08X  %s\r\n",(u32)(piece[k*2]+j),text)<0) err=1;
+        };
+      };
+    };
+  };
+  Progress(0,L"");
+  if (dynscan) {
+    regionserial++;
+    Updateregions(); };
+  if (err==0 && Streamfinish(&diffstream)!=0)
+    err=1;
+  if (ft!=NULL && fclose(ft)!=0)
+    err=1;
+  if (err!=0) {
+    Streamfree(&diffstream);
+    return -1; };
+  return 0;
+};
+
+// Returns row of Hit Trace Difference that shows hit with given index, or -1
+// if hit is filtered out.
+static int Diffrowofhit(u32 hit) {
+  if (diffview.perm==NULL)
+    return (hit<diffview.nrow?(int)hit:-1);
+  if (hit>=diffsnap.nhit || diffview.rowof[hit]==DIFF_HIDDEN)
+    return -1;
+  return (int)diffview.rowof[hit];
+};
+
+// Installs sorted or filtered order of n rows, or all hits in the order of
+// addresses if perm is NULL, and builds inverse permutation, so that row of
+// any hit is found at once. Perm is owned by the diff view afterwards. Returns
+// 0 on success and -1 if memory is low, in which case order is not changed.
+static int Diffsetperm(u32 *perm,u32 n) {
+  u32 i,*rowof;
+  rowof=NULL;
+  if (perm!=NULL) {
+    rowof=(u32 *)malloc((diffsnap.nhit>0?diffsnap.nhit:1)*sizeof(u32));
+    if (rowof==NULL) {
+      free(perm);
+      return -1; };
+    memset(rowof,0xFF,diffsnap.nhit*sizeof(u32));
+    for (i=0; i<n; i++)
+      rowof[perm[i]]=i; };
+  if (diffview.perm!=NULL) free(diffview.perm);
+  if (diffview.rowof!=NULL) free(diffview.rowof);
+  diffview.perm=perm;
+  diffview.rowof=rowof;
+  diffview.nrow=(perm==NULL?diffsnap.nhit:n);
+  return 0;
+};
+
+// Disassembles all new instructions and interns their texts. Bitmap is walked
+// directly, word by word, so that hits come in the order of their indices.
+// Each hit keeps 32-bit id of its text, identical commands share single copy,
+// and sorting and filtering compare ids. Returns 0 on success and -1 on error.
+static int Diffinterntexts(void) {
+  int i;
+  u32 j,w,bits,hit,len,id;
+  t_hitblock *pb;
+  t_disasm da;
+  if (diffview.textid!=NULL)
+    return 0;                          // Already done
+  if (diffsnap.nhit==0)
+    return -1;
+  diffview.textid=(u32 *)malloc(diffsnap.nhit*sizeof(u32));
+  if (diffview.textid==NULL)
+    return -1;
+  hit=0;
+  for (i=0; i<diffsnap.nblock; i++) {
+    pb=diffsnap.block+i;
+    for (w=0; w<Nwords(pb->size); w++) {
+      for (bits=pb->bits[w]; bits!=0; bits&=bits-1) {
+        for (j=0; ((bits>>j) & 1)==0; j++) ;
+        Decodehit(pb->base+w*32+j,&da);
+        len=StrlenW(da.result,TEXTLEN);
+        id=Poolintern(&textpool,(const u16 *)da.result,len);
+        if (id==POOL_NULL) {
+          Progress(0,L"");
+          Diffviewreset();
+          return -1; };
+        diffview.textid[hit++]=id;
+        if ((hit & 0x3FF)==0)
+          Progress((int)((u64)hit*1000/diffsnap.nhit),L"Decoding new instructions: ");
+      };
+    };
+  };
+  Progress(0,L"");
+  return 0;
+};
+
+// Returns number of records in the run trace. Records are addressed by their
+// distance from the newest one and the total is not reported, so it is found
+// by exponential and then binary search over successful reads: some 60 calls
+// to Getruntrace() regardless of the size of the trace.
+static int Countruntrace(void) {
+  int lo,hi,mid;
+  t_reg reg;
+  if (Getruntrace(0,&reg,NULL)<0)
+    return 0;                          // Run trace is empty or inactive
+  lo=0; hi=1;
+  while (hi<MAXRUNTRACE && Getruntrace(hi,&reg,NULL)>=0) {
+    lo=hi; hi*=2; };
+  // Record lo is present, record hi is not.
+  while (hi-lo>1) {
+    mid=lo+(hi-lo)/2;
+    if (Getruntrace(mid,&reg,NULL)>=0) lo=mid;
+    else hi=mid; };
+  return lo+1;
+};
+
+// Returns hits of given thread, adding empty bitmap with the layout of the
+// diff if thread is new, or NULL if memory is low.
+static t_snapshot *Diffthreadhits(ulong threadid) {
+  int i;
+  const t_snapshot *pdiff;
+  t_threadhits *pth;
+  for (i=0; i<diffview.nthread; i++) {
+    if (diffview.thread[i].threadid==threadid)
+      return &diffview.thread[i].hits; };
+  pth=(t_threadhits *)realloc(diffview.thread,(diffview.nthread+1)*sizeof(t_threadhits));
+  if (pth==NULL)
+    return NULL;
+  diffview.thread=pth;
+  pth+=diffview.nthread;
+  pth->threadid=threadid;
+  Snapinit(&pth->hits);
+  pdiff=&diffsnap;
+  if (Snaplayout(&pth->hits,&pdiff,1)!=0) {
+    Snapfree(&pth->hits);
+    return NULL; };
+  diffview.nthread++;
+  return &pth->hits;
+};
+
+// Splits new instructions by threads in a single pass over the run trace,
+// from the oldest record to the newest. Each thread gets its own bitmap with
+// the layout of the diff. Last used thread is remembered, as consecutive
+// records usually belong to the same thread. Returns 0 on success and -1 on
+// error.
+static int Diffattributethreads(void) {
+  int i,nrec,nback;
+  ulong threadid;
+  t_reg reg;
+  t_snapshot *ps;
+  t_hitblock *pb;
+  for (i=0; i<diffview.nthread; i++)
+    Snapfree(&diffview.thread[i].hits);
+  diffview.nthread=0;
+  nrec=Countruntrace();
+  threadid=0;
+  ps=NULL;
+  for (nback=nrec-1; nback>=0; nback--) {
+    if (((nrec-1-nback) & 0xFFFF)==0)
+      Progress((int)((u64)(nrec-1-nback)*1000/nrec),L"Attributing to threads: ");
+    if (Getruntrace(nback,&reg,NULL)<0)
+      continue;                        // Record is not available
+    if (Snaptest(&diffsnap,reg.ip)==0)
+      continue;                        // Not a new instruction
+    if (ps==NULL || reg.threadid!=threadid) {
+      threadid=reg.threadid;
+      ps=Diffthreadhits(threadid);
+      if (ps==NULL) break; };
+    pb=Snapfindblock(ps,reg.ip);
+    Setbit(pb,reg.ip-pb->base); };
+  Progress(0,L"");
+  return (nback>=0?-1:0);
+};
+
+// Finds threads that executed command at given address. Returns number of
+// such threads and identifier of the first.
+static int Diffthreadsof(u32 addr,ulong *threadid) {
+  int i,n;
+  for (i=n=0; i<diffview.nthread; i++) {
+    if (Snaptest(&diffview.thread[i].hits,addr)==0) continue;
+    if (n==0) *threadid=diffview.thread[i].threadid;
+    n++; };
+  return n;
+};
+
+// Updates vertical scroll bar of Hit Trace Difference and redraws window.
+static void Diffviewupdate(t_table *pt) {
+  int pos;
+  if (pt->hw==NULL)
+    return;
+  if (diffview.nrow<2)
+    pos=0;
+  else
+    pos=(int)((u64)pt->offset*DIFFSCROLL/(diffview.nrow-1));
+  SetScrollRange(pt->hw,SB_VERT,0,DIFFSCROLL,FALSE);
+  SetScrollPos(pt->hw,SB_VERT,pos,TRUE);
+  InvalidateRect(pt->hw,NULL,FALSE);
+};
+
+// Scrolls Hit Trace Difference so that given row becomes the first visible.
+static void Diffviewscroll(t_table *pt,int offset) {
+  int maxoffset;
+  maxoffset=(int)diffview.nrow-diffview.nvisible;
+  if (offset>maxoffset) offset=maxoffset;
+  if (offset<0) offset=0;
+  pt->offset=offset;
+  Diffviewupdate(pt);
+};
+
+// Selects row in Hit Trace Difference and scrolls it into view. If center is
+// set, selected row is placed in the middle of the window.
+static void Diffviewselect(t_table *pt,int row,int center) {
+  if (diffview.nrow==0) {
+    diffview.selected=-1;
+    Diffviewupdate(pt);
+    return; };
+  if (row>=(int)diffview.nrow) row=diffview.nrow-1;
+  if (row<0) row=0;
+  diffview.selected=row;
+  if (center)
+    Diffviewscroll(pt,row-diffview.nvisible/2);
+  else if (row<pt->offset)
+    Diffviewscroll(pt,row);
+  else if (row>=pt->offset+diffview.nvisible)
+    Diffviewscroll(pt,row-diffview.nvisible+1);
+  else
+    Diffviewupdate(pt);
+};
+
+// Follows selected row of Hit Trace Difference in CPU Disassembler pane.
+// Actual address is added to the history, so that user can easily return back
+// to it.
+static void Diffviewfollow(t_table *pt) {
+  u32 addr;
+  // Row is converted to address by the rank directory.
+  if (Diffrowaddr(diffview.selected,&addr)==0)
+    Setcpu(0,addr,0,0,0,CPU_ASMHIST|CPU_ASMCENTER|CPU_ASMFOCUS);
+};
+
+// Custom table function of hitlist window. Table is user-drawn, so besides
+// doubleclicks (custom message WM_USER_DBLCLK) it must process scrolling and
+// selection messages. This function is also called on WM_DESTROY, WM_CLOSE
+// (by returning -1, you can prevent window from closing), WM_SIZE (custom
+// tables only), WM_CHAR (only if TABLE_WANTCHAR is set) and different custom
+// messages WM_USER_xxx (depending on table type). See documentation for
+// details.
+long HitlistSelfunc(t_table *pt,HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
+  switch (msg) {
+    case WM_USER_VSCR:                 // Update vertical scroll
+      Diffviewupdate(pt);
+      return 1;
+    case WM_USER_VINC:                 // Scroll contents by lp lines
+      Diffviewscroll(pt,pt->offset+(int)lp);
+      return 1;
+    case WM_USER_VPOS:                 // Scroll to thumb position lp
+      Diffviewscroll(pt,(int)((u64)lp*diffview.nrow/DIFFSCROLL));
+      return 1;
+    case WM_USER_SETS:                 // Start selection on line wp
+    case WM_USER_CNTS:                 // Continue selection on line wp
+      Diffviewselect(pt,pt->offset+(int)wp,0);
+      return 1;
+    case WM_USER_MOVS:                 // Keyboard moves selection by lp rows
+      if (lp==MOVETOP)
+        Diffviewselect(pt,0,0);
+      else if (lp==MOVEBOTTOM)
+        Diffviewselect(pt,diffview.nrow-1,0);
+      else
+        Diffviewselect(pt,diffview.selected+(int)lp,0);
+      return 1;
+    case WM_USER_DBLCLK:               // Doubleclick
+      Diffviewfollow(pt);
+      return 1;
+    default: break;
+  };
+  return 0;
+};
+
+// Drawing function of Hit Trace Difference. Table is custom and has no sorted
+// data: row i shows i-th hit of the diff, and its address is obtained when
+// the row is drawn, so scrolling to any row costs the same. Table offset is
+// the first displayed row, selection is kept in diffview.
+int Hitlistdraw(wchar_t *s,uchar *mask,int *select, t_table *pt,t_drawheader *ph,int column,void *cache) {
+  int n=0;
+  u32 i,hit,len;
+  const u16 *text;
+  t_diffrow *row;
+  // For custom tables, t_drawheader describes the line being drawn. It can't
+  // be NULL, except in DF_CACHESIZE, DF_FILLCACHE and DF_FREECACHE.
+  row=(t_diffrow *)cache;
+
+  switch (column) {
+    case DF_CACHESIZE:                 // Request for draw cache size
+      // Row is not stored anywhere, so both address and disassembly must be
+      // calculated when row is drawn. To accelerate processing, I do it once
+      // per line and cache data between the calls. Here I inform the drawing
+      // routine how large the cache must be.
+      return sizeof(t_diffrow);
+    case DF_FILLCACHE:                 // Request to fill draw cache
+      // We don't need to initialize cache when drawing begins. Note that cache
+      // is initially zeroed.
+      break;
+    case DF_FREECACHE:                 // Request to free cached resources
+      // We don't need to free cached resources when drawing ends.
+      break;
+    case DF_NEWROW:                    // Request to start new row in window
+      // New row starts. Find address of the hit that corresponds to this row
+      // and get the command, from the pool if texts are already interned.
+      if (ph->n>0) diffview.nvisible=ph->n;
+      row->row=pt->offset+ph->line;
+      row->valid=(Diffrowaddr(row->row,&row->addr)==0);
+      if (row->valid==0)
+        break;
+      row->nthread=Diffthreadsof(row->addr,&row->threadid);
+      row->modified=(Mapfind(&changedpages,row->addr & ~(CODEPAGE-1))!=NULL);
+      row->epoch=Getepoch(row->addr);
+      if (diffview.textid!=NULL) {
+        hit=(diffview.perm==NULL?(u32)row->row:diffview.perm[row->row]);
+        text=Poolstring(&textpool,diffview.textid[hit],&len);
+        if (text!=NULL) {
+          if (len>=TEXTLEN) len=TEXTLEN-1;
+          for (i=0; i<len; i++) row->da.result[i]=(wchar_t)text[i];
+          row->da.result[len]=L'\0';
+          break;
+        };
+      };
+      Decodehit(row->addr,&row->da);
+      break;
+    case 0:                            // Address
+      if (row->valid==0) break;
+      n=Hexprint8W(s,row->addr);
+      memset(mask,(row->modified?DRAW_HILITE:DRAW_GRAY),n);
+      *select|=DRAW_MASK;
+      break;
+    case 1:                            // Disassembly
+      if (row->valid==0) break;
+      n=StrcopyW(s,TEXTLEN,row->da.result);
+      memset(mask,DRAW_GRAY,n);
+      *select|=DRAW_MASK;
+      break;
+    case 2:                            // Thread
+      if (row->valid==0 || row->nthread==0) break;
+      if (row->nthread==1)
+        n=Hexprint8W(s,row->threadid);
+      else
+        n=Swprintf(s,L"%i threads",row->nthread);
+      memset(mask,DRAW_GRAY,n);
+      *select|=DRAW_MASK;
+      break;
+    case 3:                            // Code
+      if (row->valid==0 || row->modified==0) break;
+      n=StrcopyW(s,TEXTLEN,L"Modified");
+      memset(mask,DRAW_HILITE,n);
+      *select|=DRAW_MASK;
+      break;
+    case 4:                            // Epoch
+      if (row->valid==0 || row->epoch==0) break;
+      n=Swprintf(s,L"%u",row->epoch);
+      memset(mask,DRAW_GRAY,n);
+      *select|=DRAW_MASK;
+      break;
+    default: break;
+  };
+  // Selection is drawn by the table only if it manages data by itself.
+  if (column>=0 && row->valid && row->row==diffview.selected) {
+    memset(mask,DRAW_GRAY|DRAW_SELECT,n);
+    *select|=DRAW_MASK|DRAW_EXTSEL; };
+  return n;
+};
+
+// Walks run trace from the oldest record to the newest and adds row for the
+// first execution of every command that is not in the baseline. Records are
+// streamed one by one and only distinct new addresses are remembered, so
+// memory depends on the amount of new code and not on the length of the
+// trace. Returns number of rows or -1 on error.
+static int Runtraceorder(void) {
+  int nrec,nback,isnew,n;
+  ulong index,offset;
+  u32 *first;
+  t_reg reg;
+  t_orderrow *row;
+  Arenareset(&hitarena);
+  Mapreset(&tracemap);
+  nrec=Countruntrace();
+  for (nback=nrec-1,index=0; nback>=0; nback--,index++) {
+    if ((index & 0xFFFF)==0)
+      Progress((int)((u64)index*1000/nrec),L"Reading run trace: ");
+    if (Getruntrace(nback,&reg,NULL)<0)
+      continue;                        // Record is not available
+    if (Snaptest(&basesnap,reg.ip))
+      continue;                        // Known since baseline
+    first=Mapinsert(&tracemap,reg.ip,&isnew);
+    if (first==NULL)
+      break;
+    if (isnew==0)
+      continue;                        // Executed before
+    *first=index;
+    offset=Arenaalloc(&hitarena,sizeof(t_orderrow));
+    if (offset==ARENA_NULL)
+      break;
+    row=(t_orderrow *)Arenaptr(&hitarena,offset);
+    row->addr=reg.ip;
+    row->size=1;
+    row->type=0;
+    row->index=index;
+    row->threadid=reg.threadid; };
+  Progress(0,L"");
+  if (nback>=0)
+    n=-1;                              // Low memory
+  else {
+    n=Installrows(&ordertable.sorted,&hitarena,sizeof(t_orderrow));
+    Sortsorteddata(&ordertable.sorted,ordertable.sorted.sort); };
+  Arenareset(&hitarena);
+  Mapreset(&tracemap);
+  return n;
+};
+
+// Adds to the map number of executions of each command in the run trace
+// records nback=first..last, walked from older to newer. Returns 0 on success
+// and -1 if memory is low.
+static int Countexecutions(t_addrmap *pm,int first,int last) {
+  int nback;
+  u32 *count;
+  t_reg reg;
+  for (nback=first; nback>=last; nback--) {
+    if (((first-nback) & 0xFFFF)==0)
+      Progress((int)((u64)(first-nback)*1000/(first-last+1)),L"Counting executions: ");
+    if (Getruntrace(nback,&reg,NULL)<0)
+      continue;                        // Record is not available
+    count=Mapinsert(pm,reg.ip,NULL);
+    if (count==NULL)
+      break;
+    (*count)++; };
+  Progress(0,L"");
+  return (nback>=last?-1:0);
+};
+
+// Adds row to hitarena. Returns 0 on success and -1 if memory is low.
+static int Addcountrow(u32 addr,u32 before,u32 after) {
+  ulong offset;
+  t_countrow *row;
+  offset=Arenaalloc(&hitarena,sizeof(t_countrow));
+  if (offset==ARENA_NULL)
+    return -1;
+  row=(t_countrow *)Arenaptr(&hitarena,offset);
+  row->addr=addr;
+  row->size=1;
+  row->type=0;
+  row->before=before;
+  row->after=after;
+  return 0;
+};
+
+// Counts executions in run trace records added since the mark and fills
+// Execution Count Delta with commands whose count differs from the count
+// before the mark. If trace has shrunk, it was cleared after the mark and is
+// counted as a whole. Records are not numbered, so new records are told from
+// old only by their count: when run trace buffer overflows, records discarded
+// at its tail are not noticed. Returns number of rows or -1 on error.
+static int Countdelta(void) {
+  int nrec,nnew,n;
+  u32 i,*before,*after;
+  Arenareset(&hitarena);
+  Mapreset(&tracemap);
+  nrec=Countruntrace();
+  nnew=(nrec>=markrecords?nrec-markrecords:nrec);
+  n=Countexecutions(&tracemap,nnew-1,0);
+  // Map slots are walked directly, first commands executed after the mark,
+  // then those that were executed only before it.
+  for (i=0; n==0 && i<tracemap.nslot; i++) {
+    if (tracemap.key[i]==ADDR_EMPTY) continue;
+    before=Mapfind(&markcount,tracemap.key[i]);
+    if (before!=NULL && *before==tracemap.value[i]) continue;
+    n=Addcountrow(tracemap.key[i],(before==NULL?0:*before),tracemap.value[i]); };
+  for (i=0; n==0 && i<markcount.nslot; i++) {
+    if (markcount.key[i]==ADDR_EMPTY) continue;
+    if (Mapfind(&tracemap,markcount.key[i])!=NULL) continue;
+    n=Addcountrow(markcount.key[i],markcount.value[i],0); };
+  if (n==0) {
+    n=Installrows(&counttable.sorted,&hitarena,sizeof(t_countrow));
+    Sortsorteddata(&counttable.sorted,counttable.sorted.sort); };
+  Arenareset(&hitarena);
+  Mapreset(&tracemap);
+  return n;
+};
+
+// Sorting function of Execution Count Delta: by delta (largest growth first),
+// by address or by count before or after the mark.
+static int Countsortfunc(const t_sorthdr *sh1,const t_sorthdr *sh2,const int sort) {
+  const t_countrow *r1,*r2;
+  long d1,d2;
+  r1=(const t_countrow *)sh1;
+  r2=(const t_countrow *)sh2;
+  if (sort==1)
+    return (r1->addr<r2->addr?-1:(r1->addr>r2->addr?1:0));
+  else if (sort==2 && r1->before!=r2->before)
+    return (r1->before>r2->before?-1:1);
+  else if (sort==3 && r1->after!=r2->after)
+    return (r1->after>r2->after?-1:1);
+  d1=(long)r1->after-(long)r1->before;
+  d2=(long)r2->after-(long)r2->before;
+  if (d1!=d2)
+    return (d1>d2?-1:1);
+  return (r1->addr<r2->addr?-1:(r1->addr>r2->addr?1:0));
+};
+
+// Sorting function of Run Trace Order: by trace index, by address or by thread
+// and then by trace index.
+static int Ordersortfunc(const t_sorthdr *sh1,const t_sorthdr *sh2,const int sort) {
+  const t_orderrow *r1,*r2;
+  ulong k1,k2;
+  r1=(const t_orderrow *)sh1;
+  r2=(const t_orderrow *)sh2;
+  if (sort==1) {
+    k1=r1->addr; k2=r2->addr; }
+  else if (sort==2 && r1->threadid!=r2->threadid) {
+    k1=r1->threadid; k2=r2->threadid; }
+  else {
+    k1=r1->index; k2=r2->index; };
+  return (k1<k2?-1:(k1>k2?1:0));
+};
+
+// Table function of Run Trace Order and Execution Count Delta, follows
+// doubleclicked row in the CPU Disassembler. Rows begin with t_sorthdr.
+long Rowselfunc(t_table *pt,HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
+  t_sorthdr *row;
+  switch (msg) {
+    case WM_USER_DBLCLK:               // Doubleclick
+      row=(t_sorthdr *)Getsortedbyselection(&pt->sorted,pt->sorted.selected);
+      if (row!=NULL)
+        Setcpu(0,row->addr,0,0,0,CPU_ASMHIST|CPU_ASMCENTER|CPU_ASMFOCUS);
+      return 1;
+    default: break;
+  };
+  return 0;
+};
+
+int Orderdraw(wchar_t *s,uchar *mask,int *select, t_table *pt,t_drawheader *ph,int column,void *cache) {
+  int n=0;
+  t_orderrow *row;
+  t_disasm *da;
+  // For sorted tables, t_drawheader is the pointer to the data element. It
+  // can't be NULL, except in DF_CACHESIZE, DF_FILLCACHE and DF_FREECACHE.
+  row=(t_orderrow *)ph;
+  da=(t_disasm *)cache;
+  switch (column) {
+    case DF_CACHESIZE:                 // Request for draw cache size
+      return sizeof(t_disasm);
+    case DF_FILLCACHE:                 // Request to fill draw cache
+    case DF_FREECACHE:                 // Request to free cached resources
+      break;
+    case DF_NEWROW:                    // Request to start new row in window
+      Decodehit(row->addr,da);
+      break;
+    case 0:                            // Trace index
+      n=Swprintf(s,L"%lu",row->index);
+      break;
+    case 1:                            // Address
+      n=Hexprint8W(s,row->addr);
+      memset(mask,DRAW_GRAY,n);
+      *select|=DRAW_MASK;
+      break;
+    case 2:                            // Thread
+      n=Hexprint8W(s,row->threadid);
+      break;
+    case 3:                            // Disassembly
+      n=StrcopyW(s,TEXTLEN,da->result);
+      break;
+    default: break;
+  };
+  return n;
+};
+
+int Countdraw(wchar_t *s,uchar *mask,int *select, t_table *pt,t_drawheader *ph,int column,void *cache) {
+  int n=0;
+  long delta;
+  t_countrow *row;
+  t_disasm *da;
+  // For sorted tables, t_drawheader is the pointer to the data element. It
+  // can't be NULL, except in DF_CACHESIZE, DF_FILLCACHE and DF_FREECACHE.
+  row=(t_countrow *)ph;
+  da=(t_disasm *)cache;
+  switch (column) {
+    case DF_CACHESIZE:                 // Request for draw cache size
+      return sizeof(t_disasm);
+    case DF_FILLCACHE:                 // Request to fill draw cache
+    case DF_FREECACHE:                 // Request to free cached resources
+      break;
+    case DF_NEWROW:                    // Request to start new row in window
+      Decodehit(row->addr,da);
+      break;
+    case 0:                            // Delta
+      delta=(long)row->after-(long)row->before;
+      n=Swprintf(s,L"%+li",delta);
+      if (delta<0) {
+        memset(mask,DRAW_GRAY,n);
+        *select|=DRAW_MASK; };
+      break;
+    case 1:                            // Address
+      n=Hexprint8W(s,row->addr);
+      memset(mask,DRAW_GRAY,n);
+      *select|=DRAW_MASK;
+      break;
+    case 2:                            // Before the mark
+      n=Swprintf(s,L"%lu",row->before);
+      break;
+    case 3:                            // After the mark
+      n=Swprintf(s,L"%lu",row->after);
+      break;
+    case 4:                            // Disassembly
+      n=StrcopyW(s,TEXTLEN,da->result);
+      break;
+    default: break;
+  };
+  return n;
+};
+
+// Recalculates the largest number of new hits, used to scale the timeline.
+static void Autoupdatemax(void) {
+  int i;
+  automaxhit=0;
+  for (i=0; i<NAUTOSNAP; i++) {
+    if (autoring[i].serial!=0 && autoring[i].delta.nhit>automaxhit)
+      automaxhit=autoring[i].delta.nhit; };
+};
+
+// Takes snapshot on debug event and adds its delta to the ring, replacing the
+// oldest one if ring is full. Delta keeps only hits new since the previous
+// event, compacted, so its memory depends on the number of new hits. Text
+// describes event and may be NULL. Returns 0 on success and -1 on error.
+static int Autosnapshot(int event,const wchar_t *text) {
+  t_snapshot cur,delta;
+  t_autosnap *pa;
+  t_eventrow row;
+  Snapinit(&cur);
+  Snapinit(&delta);
+  if (Takesnapshot(&cur)!=0 || Snapandnot(&delta,&cur,&autolast)!=0) {
+    Snapfree(&cur);
+    Snapfree(&delta);
+    Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, event snapshot is lost");
+    return -1; };
+  pa=autoring+(autoserial+1)%NAUTOSNAP;
+  if (pa->serial!=0) {
+    Deletesorteddata(&eventtable.sorted,pa->serial,0);
+    if (autostart==pa->serial) autostart=0;
+    pa->serial=0;
+    Snapfree(&pa->delta);
+    Autoupdatemax(); };
+  if (Snapcompact(&pa->delta,&delta)!=0) {
+    Indexevent(pa-autoring,NULL);
+    Snapfree(&cur);
+    Snapfree(&delta);
+    Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, event snapshot is lost");
+    return -1; };
+  Snapfree(&delta);
+  // Snapshot of the event is the whole hit trace, index gets it before it
+  // becomes reference for the next event.
+  Indexevent(pa-autoring,&cur);
+  Snapfree(&autolast);
+  autolast=cur;
+  pa->serial=++autoserial;
+  if (Addepochs(&pa->delta,pa->serial)!=0)
+    Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, epochs are incomplete");
+  row.addr=pa->serial;
+  row.size=1;
+  row.type=0;
+  row.event=event;
+  row.eip=run.eip;
+  row.runtime=runtime;
+  row.nhit=pa->delta.nhit;
+  if (row.nhit>automaxhit) automaxhit=row.nhit;
+  StrcopyW(row.text,SHORTNAME,(text==NULL?L"":text));
+  Addsorteddata(&eventtable.sorted,&row);
+  if (eventtable.hw!=NULL)
+    InvalidateRect(eventtable.hw,NULL,FALSE);
+  return 0;
+};
+
+// Discards all event snapshots.
+static void Autoreset(void) {
+  int i;
+  for (i=0; i<NAUTOSNAP; i++) {
+    Snapfree(&autoring[i].delta);
+    autoring[i].serial=0; };
+  Snapfree(&autolast);
+  Mapreset(&epochmap);
+  Indexreset();
+  autoserial=0;
+  autostart=0;
+  automaxhit=0;
+  runtime=0;
+  nexttimer=autointerval*1000;
+  autostatus=STAT_IDLE;
+  Deletesorteddatarange(&eventtable.sorted,0,0xFFFFFFFF);
+};
+
+// Calculates diffsnap as the union of deltas of events that follow event
+// first and precede or coincide with event last. If first is 0, starts from
+// the oldest event in the ring. Returns 0 on success and -1 on error.
+static int Autodiff(ulong first,ulong last) {
+  int i,n;
+  const t_snapshot *src[NAUTOSNAP];
+  for (i=n=0; i<NAUTOSNAP; i++) {
+    if (autoring[i].serial>first && autoring[i].serial<=last)
+      src[n++]=&autoring[i].delta; };
+  return Snapunion(&diffsnap,src,n);
+};
+
+// Finds jumps and calls from hit commands to new commands in all modules and
+// fills New Calls and Jumps. Jump table of each module is sorted by
+// destination (jmpindex), so it is joined with the diff in a single merge
+// walk that starts at the lowest destination. Cost is linear in the number of
+// jumps plus new hits between the lowest and the highest destination. Returns
+// number of rows or -1 on error.
+static int Newedges(void) {
+  int i,k,ok,n;
+  u32 hit;
+  ulong offset;
+  t_module *pmod;
+  t_jmpdata *pjd;
+  t_jmp *pj;
+  t_snapiter it;
+  t_edgerow *row;
+  Arenareset(&hitarena);
+  n=0;
+  for (i=0; i<module.sorted.n; i++) {
+    pmod=(t_module *)Getsortedbyindex(&module.sorted,i);
+    pjd=&pmod->jumps;
+    if (pjd->njmp==0 || pjd->jmpdata==NULL || pjd->jmpindex==NULL)
+      continue;
+    if (pjd->nsorted<pjd->njmp)
+      Sortjumpdata(pjd);               // Index covers only sorted part
+    if (pjd->nsorted==0)
+      continue;
+    // Destinations may lie in other modules or in dynamic code, so jumps of
+    // the module are matched against the whole diff. Both destinations and
+    // new hits grow, smaller of them advances. Several jumps may go to the
+    // same destination.
+    Snapiterinit(&it,&diffsnap,pjd->jmpdata[pjd->jmpindex[0]].dest,0xFFFFFFFF);
+    ok=Snapiternext(&it,&hit);
+    for (k=0; ok && k<pjd->nsorted; ) {
+      pj=pjd->jmpdata+pjd->jmpindex[k];
+      if (pj->dest<hit)
+        k++;
+      else if (pj->dest>hit)
+        ok=Snapiternext(&it,&hit);
+      else {
+        if (Snaptest(&basesnap,pj->from) || Snaptest(&diffsnap,pj->from)) {
+          offset=Arenaalloc(&hitarena,sizeof(t_edgerow));
+          if (offset==ARENA_NULL) {
+            Arenareset(&hitarena);
+            return -1; };
+          row=(t_edgerow *)Arenaptr(&hitarena,offset);
+          row->addr=n++;
+          row->size=1;
+          row->type=0;
+          row->from=pj->from;
+          row->dest=pj->dest;
+          row->jtype=pj->type & JT_TYPE; };
+        k++;
+      };
+    };
+  };
+  n=Installrows(&edgetable.sorted,&hitarena,sizeof(t_edgerow));
+  Sortsorteddata(&edgetable.sorted,edgetable.sorted.sort);
+  Arenareset(&hitarena);
+  return n;
+};
+
+// Sorting function of New Calls and Jumps: by source, by destination or by
+// type and then by source.
+static int Edgesortfunc(const t_sorthdr *sh1,const t_sorthdr *sh2,const int sort) {
+  const t_edgerow *r1,*r2;
+  ulong k1,k2;
+  r1=(const t_edgerow *)sh1;
+  r2=(const t_edgerow *)sh2;
+  if (sort==1 && r1->dest!=r2->dest) {
+    k1=r1->dest; k2=r2->dest; }
+  else if (sort==2 && r1->jtype!=r2->jtype) {
+    k1=r1->jtype; k2=r2->jtype; }
+  else if (r1->from!=r2->from) {
+    k1=r1->from; k2=r2->from; }
+  else {
+    k1=r1->dest; k2=r2->dest; };
+  return (k1<k2?-1:(k1>k2?1:0));
+};
+
+// Returns name of the jump type.
+static wchar_t *Jumpname(int jtype) {
+  switch (jtype) {
+    case JT_JUMP: case JT_NETJUMP: return L"Jump";
+    case JT_COND: case JT_NETCOND: return L"Conditional";
+    case JT_SWITCH: case JT_NETSW: return L"Switch";
+    case JT_RET: return L"Return";
+    case JT_CALL: return L"Call";
+    case JT_SWCALL: return L"Switch call";
+    default: return L"?";
+  };
+};
+
+// Returns Graphviz attributes of the edge. Both graph exports draw calls
+// dashed and all other edges solid.
+static char *Edgestyle(int jtype) {
+  return (jtype==JT_CALL || jtype==JT_SWCALL?",style=dashed":"");
+};
+
+int Edgedraw(wchar_t *s,uchar *mask,int *select, t_table *pt,t_drawheader *ph,int column,void *cache) {
+  int n=0;
+  t_edgerow *row;
+  // For sorted tables, t_drawheader is the pointer to the data element. It
+  // can't be NULL, except in DF_CACHESIZE, DF_FILLCACHE and DF_FREECACHE.
+  row=(t_edgerow *)ph;
+  switch (column) {
+    case DF_CACHESIZE:                 // Request for draw cache size
+      return 0;
+    case DF_FILLCACHE:                 // Request to fill draw cache
+    case DF_FREECACHE:                 // Request to free cached resources
+    case DF_NEWROW:                    // Request to start new row in window
+      break;
+    case 0:                            // Source
+      n=Hexprint8W(s,row->from);
+      memset(mask,DRAW_GRAY,n);
+      *select|=DRAW_MASK;
+      break;
+    case 1:                            // Destination
+      n=Hexprint8W(s,row->dest);
+      break;
+    case 2:                            // Type
+      n=StrcopyW(s,TEXTLEN,Jumpname(row->jtype));
+      break;
+    case 3:                            // Caller
+      n=Decodeaddress(row->from,0,DM_WIDEFORM|DM_MODNAME|DM_RELOFFS,s,TEXTLEN,NULL);
+      break;
+    case 4:                            // Callee
+      n=Decodeaddress(row->dest,0,DM_WIDEFORM|DM_MODNAME,s,TEXTLEN,NULL);
+      break;
+    default: break;
+  };
+  return n;
+};
+
+// Writes string to graph file as UTF-8 in double quotes, with escapes.
+static void Dotstring(FILE *f,const wchar_t *s) {
+  int i,n;
+  char c[8];
+  fputc('"',f);
+  for (i=0; s[i]!=L'\0'; i++) {
+    if (s[i]==L'\n') {                 // Line break in label
+      fputs("\\n",f);
+      continue; };
+    if (s[i]==L'"' || s[i]==L'\\') fputc('\\',f);
+    n=WideCharToMultiByte(CP_UTF8,0,s+i,1,c,sizeof(c),NULL,NULL);
+    if (n>0) fwrite(c,1,n,f); };
+  fputc('"',f);
+};
+
+// Writes node of the graph for command at given address, once. Node is named
+// by address and labelled with address and symbol. Nodes already written are
+// remembered in tracemap.
+static void Dotnode(FILE *f,ulong addr) {
+  int isnew;
+  wchar_t s[TEXTLEN],name[TEXTLEN];
+  if (Mapinsert(&tracemap,addr,&isnew)!=NULL && isnew==0)
+    return;
+  Hexprint8W(s,addr);
+  if (Decodeaddress(addr,0,DM_WIDEFORM|DM_MODNAME|DM_SYMBOL,name,TEXTLEN,NULL)>0) {
+    StrcopyW(s+8,TEXTLEN-8,L"\n");
+    StrcopyW(s+9,TEXTLEN-9,name); };
+  fprintf(f,"  n%08lX [label=",addr);
+  Dotstring(f,s);
+  fprintf(f,"];\n");
+};
+
+// Writes rows of New Calls and Jumps as Graphviz graph. Returns number of
+// edges or -1 on error.
+static int Writeedgesdot(FILE *f) {
+  int i;
+  t_edgerow *row;
+  Mapreset(&tracemap);
+  fprintf(f,"digraph diffsnake {\n  node [shape=box,fontname=\"Courier\"];\n");
+  for (i=0; i<edgetable.sorted.n; i++) {
+    row=(t_edgerow *)Getsortedbyindex(&edgetable.sorted,i);
+    Dotnode(f,row->from);
+    Dotnode(f,row->dest);
+    fprintf(f,"  n%08lX -> n%08lX [label=",row->from,row->dest);
+    Dotstring(f,Jumpname(row->jtype));
+    fprintf(f,"%s];\n",Edgestyle(row->jtype));
+  };
+  fprintf(f,"}\n");
+  Mapreset(&tracemap);
+  return (ferror(f)?-1:edgetable.sorted.n);
+};
+
+// Calculates key of module version: hash of its path, version and size.
+// Rebuilt or relocated module gets new key.
+static u32 Modulekey(const t_module *pmod) {
+  int i;
+  u32 h;
+  h=2166136261u;
+  for (i=0; pmod->path[i]!=L'\0'; i++) h=(h^pmod->path[i])*16777619u;
+  for (i=0; pmod->version[i]!=L'\0'; i++) h=(h^pmod->version[i])*16777619u;
+  h=(h^pmod->base)*16777619u;
+  h=(h^pmod->size)*16777619u;
+  return (h==0?1:h);
+};
+
+// Frees graph.
+static void Freecfg(t_cfg *pc) {
+  if (pc->node!=NULL) free(pc->node);
+  if (pc->edge!=NULL) free(pc->edge);
+  memset(pc,0,sizeof(t_cfg));
+};
+
+// Adds node or edge to growing array. Returns pointer to new item or NULL if
+// memory is low.
+static void *Addcfgitem(void **data,int *n,int *max,int itemsize) {
+  void *p;
+  if (*n>=*max) {
+    p=realloc(*data,(*max*2+256)*itemsize);
+    if (p==NULL) return NULL;
+    *data=p;
+    *max=*max*2+256; };
+  return (uchar *)(*data)+(*n)++*itemsize;
+};
+
+// Checks whether execution can fall from the command of length len at addr to
+// the next one. It can't after unconditional jump or return. Returns are not
+// in the jump table, so opcode of the command is read, skipping REP prefixes
+// (F3 C3 is a common form of RETN).
+static int Fallsthrough(u32 addr,u32 len,int jtype) {
+  u32 i,n;
+  uchar op[4];
+  if (jtype==JT_JUMP || jtype==JT_SWITCH || jtype==JT_RET ||
+    jtype==JT_NETJUMP || jtype==JT_NETSW)
+    return 0;
+  n=(len<4?len:4);
+  if (Readmemory(op,addr,n,MM_SILENT)!=n)
+    return 1;
+  for (i=0; i<n-1 && (op[i]==0xF3 || op[i]==0xF2); i++) ;
+  return (op[i]!=0xC3 && op[i]!=0xC2 && op[i]!=0xCB && op[i]!=0xCA);
+};
+
+// Builds control flow graph of new hits in memory block. Each new command is
+// visited once, jump table of the module is walked in parallel, and targets
+// of edges are resolved through the map of block starts. Basic block starts
+// where hits are not contiguous, at jump and call destinations and at the
+// start of procedure, and ends after a jump or return. Returns 0 on success
+// and -1 on error.
+static int Buildcfg(t_cfg *pc,const t_memory *pmem) {
+  int k,njmp,closed,falls,jtype,error,maxnode,maxedge;
+  u32 addr,off,len,end,*pidx;
+  ulong n,declength;
+  uchar *decode,t;
+  t_module *pmod;
+  t_jmp *jmp;
+  t_snapiter it;
+  t_cfgnode *pn;
+  t_cfgedge *pe;
+  Freecfg(pc);
+  pc->base=pmem->base;
+  pc->size=pmem->size;
+  pmod=Findmodule(pmem->base);
+  pc->modkey=(pmod==NULL?0:Modulekey(pmod));
+  pc->diffgen=diffgen;
+  decode=Finddecode(pmem->base,&declength);
+  if (decode==NULL)
+    return 0;                          // Not analysed, can't be traced
+  n=(declength<pmem->size?declength:pmem->size);
+  jmp=NULL; njmp=k=0;
+  if (pmod!=NULL && pmod->jumps.jmpdata!=NULL) {
+    if (pmod->jumps.nsorted<pmod->jumps.njmp)
+      Sortjumpdata(&pmod->jumps);
+    jmp=pmod->jumps.jmpdata;
+    njmp=pmod->jumps.nsorted; };
+  maxnode=maxedge=0;
+  closed=1; falls=0; error=0;
+  end=0;
+  pn=NULL;
+  Snapiterinit(&it,&diffsnap,pmem->base,pmem->base+n-1);
+  while (Snapiternext(&it,&addr)) {
+    off=addr-pmem->base;
+    t=(uchar)(decode[off] & DEC_TYPEMASK);
+    for (len=1; off+len<n && (decode[off+len] & DEC_TYPEMASK)==DEC_NEXTCODE; len++) ;
+    if (closed || addr!=end || t==DEC_JMPDEST || t==DEC_CALLDEST ||
+      t==DEC_JMPNET || t==DEC_CALLNET ||
+      (decode[off] & DEC_PROCMASK)==DEC_PROC) {
+      // Start new basic block. If it immediately follows the previous one and
+      // execution can fall through, connect them.
+      if (pc->nnode>0 && addr==end && falls) {
+        pe=(t_cfgedge *)Addcfgitem((void **)&pc->edge,&pc->nedge,&maxedge,sizeof(t_cfgedge));
+        if (pe==NULL) { error=1; break; };
+        pe->from=pc->nnode-1; pe->dest=addr; pe->jtype=JT_UNDEF; };
+      pn=(t_cfgnode *)Addcfgitem((void **)&pc->node,&pc->nnode,&maxnode,sizeof(t_cfgnode));
+      if (pn==NULL) { error=1; break; };
+      pn->start=addr;
+      pn->ncmd=0; };
+    pn->end=addr+len;
+    pn->ncmd++;
+    // Jumps and calls from this command. Jump closes basic block, call not.
+    closed=0; jtype=JT_UNDEF;
+    while (k<njmp && jmp[k].from<addr) k++;
+    for (; k<njmp && jmp[k].from==addr; k++) {
+      pe=(t_cfgedge *)Addcfgitem((void **)&pc->edge,&pc->nedge,&maxedge,sizeof(t_cfgedge));
+      if (pe==NULL) { error=1; break; };
+      pe->from=pc->nnode-1;
+      pe->dest=jmp[k].dest;
+      pe->jtype=jmp[k].type & JT_TYPE;
+      if (Iscall(jmp+k)==0) {
+        closed=1; jtype=pe->jtype; };
+    };
+    if (error) break;
+    // Any command that doesn't fall through, like return, closes block too.
+    falls=Fallsthrough(addr,len,jtype);
+    closed=(closed || falls==0);
+    end=addr+len;
+  };
+  if (error) {
+    Freecfg(pc);
+    return -1; };
+  // Resolve targets of edges by the starts of basic blocks.
+  Mapreset(&tracemap);
+  for (k=0; k<pc->nnode; k++) {
+    pidx=Mapinsert(&tracemap,pc->node[k].start,NULL);
+    if (pidx==NULL) {
+      Mapreset(&tracemap);
+      Freecfg(pc);
+      return -1; };
+    *pidx=k; };
+  for (k=0; k<pc->nedge; k++) {
+    pidx=Mapfind(&tracemap,pc->edge[k].dest);
+    pc->edge[k].to=(pidx==NULL?CFG_EXTERN:*pidx); };
+  Mapreset(&tracemap);
+  return 0;
+};
+
+// Returns control flow graph of new code in memory block that contains given
+// address, from cache if possible, or NULL on error. Graphs are cached by
+// memory block, module version and diff.
+static t_cfg *Getcfg(ulong addr) {
+  int i;
+  u32 modkey;
+  t_memory *pmem;
+  t_module *pmod;
+  pmem=Findmemory(addr);
+  if (pmem==NULL)
+    return NULL;
+  pmod=Findmodule(pmem->base);
+  modkey=(pmod==NULL?0:Modulekey(pmod));
+  for (i=0; i<NCFGCACHE; i++) {
+    if (cfgcache[i].base==pmem->base && cfgcache[i].size==pmem->size &&
+      cfgcache[i].modkey==modkey && cfgcache[i].diffgen==diffgen)
+      return cfgcache+i; };
+  i=cfgnext;
+  cfgnext=(cfgnext+1)%NCFGCACHE;
+  if (Buildcfg(cfgcache+i,pmem)!=0)
+    return NULL;
+  return cfgcache+i;
+};
+
+// Returns name of the edge type in graph files.
+static wchar_t *Edgename(int jtype) {
+  return (jtype==JT_UNDEF?L"Fallthrough":Jumpname(jtype));
+};
+
+// Writes control flow graph as Graphviz graph. Basic blocks are named by
+// their start address, so edges to code outside of the graph lead to nodes
+// written by Dotnode(). Returns 0 on success and -1 on error.
+static int Writecfgdot(FILE *f,const t_cfg *pc) {
+  int i;
+  wchar_t s[TEXTLEN],name[TEXTLEN];
+  const t_cfgnode *pn;
+  const t_cfgedge *pe;
+  Mapreset(&tracemap);
+  fprintf(f,"digraph diffsnake {\n  node [shape=box,fontname=\"Courier\"];\n");
+  for (i=0; i<pc->nnode; i++) {
+    pn=pc->node+i;
+    Mapinsert(&tracemap,pn->start,NULL);
+    Swprintf(s,L"%08X..%08X\n%u commands",pn->start,pn->end-1,pn->ncmd);
+    if (Decodeaddress(pn->start,0,DM_WIDEFORM|DM_MODNAME|DM_SYMBOL,name,TEXTLEN,NULL)>0) {
+      StrcopyW(s+StrlenW(s,TEXTLEN),TEXTLEN-StrlenW(s,TEXTLEN),L"\n");
+      StrcopyW(s+StrlenW(s,TEXTLEN),TEXTLEN-StrlenW(s,TEXTLEN),name); };
+    fprintf(f,"  n%08X [label=",pn->start);
+    Dotstring(f,s);
+    fprintf(f,",style=filled,fillcolor=\"#ffe0e0\"];\n");
+  };
+  for (i=0; i<pc->nedge; i++) {
+    pe=pc->edge+i;
+    if (pe->to==CFG_EXTERN) Dotnode(f,pe->dest);
+    fprintf(f,"  n%08X -> n%08X [label=",pc->node[pe->from].start,pe->dest);
+    Dotstring(f,Edgename(pe->jtype));
+    fprintf(f,"%s];\n",Edgestyle(pe->jtype));
+  };
+  fprintf(f,"}\n");
+  Mapreset(&tracemap);
+  return (ferror(f)?-1:0);
+};
+
+// Writes string as JSON string in UTF-8.
+static void Jsonstring(FILE *f,const wchar_t *s) {
+  int i,n;
+  char c[8];
+  fputc('"',f);
+  for (i=0; s[i]!=L'\0'; i++) {
+    if (s[i]==L'"' || s[i]==L'\\')
+      fputc('\\',f);
+    else if (s[i]<0x20) {
+      fprintf(f,"\\u%04X",(int)s[i]);
+      continue; };
+    n=WideCharToMultiByte(CP_UTF8,0,s+i,1,c,sizeof(c),NULL,NULL);
+    if (n>0) fwrite(c,1,n,f); };
+  fputc('"',f);
+};
+
+// Writes control flow graph as JSON object with arrays of nodes and edges.
+// Edges refer to nodes by index, null means destination outside of graph.
+// Returns 0 on success and -1 on error.
+static int Writecfgjson(FILE *f,const t_cfg *pc) {
+  int i;
+  wchar_t name[TEXTLEN];
+  const t_cfgnode *pn;
+  const t_cfgedge *pe;
+  fprintf(f,"{\n  \"base\": \"0x%08lX\",\n  \"size\": %lu,\n  \"nodes\": [",
+    pc->base,pc->size);
+  for (i=0; i<pc->nnode; i++) {
+    pn=pc->node+i;
+    if (Decodeaddress(pn->start,0,DM_WIDEFORM|DM_MODNAME|DM_SYMBOL,name,TEXTLEN,NULL)<=0)
+      name[0]=L'\0';
+    fprintf(f,"%s\n    { \"start\": \"0x%08X\", \"end\": \"0x%08X\", \"commands\": %u, \"name\": ",
+      (i==0?"":","),pn->start,pn->end,pn->ncmd);
+    Jsonstring(f,name);
+    fprintf(f," }");
+  };
+  fprintf(f,"\n  ],\n  \"edges\": [");
+  for (i=0; i<pc->nedge; i++) {
+    pe=pc->edge+i;
+    fprintf(f,"%s\n    { \"from\": %u, \"to\": ",(i==0?"":","),pe->from);
+    if (pe->to==CFG_EXTERN) fprintf(f,"null");
+    else fprintf(f,"%u",pe->to);
+    fprintf(f,", \"dest\": \"0x%08X\", \"type\": ",pe->dest);
+    Jsonstring(f,Edgename(pe->jtype));
+    fprintf(f," }");
+  };
+  fprintf(f,"\n  ]\n}\n");
+  return (ferror(f)?-1:0);
+};
+
+int Eventdraw(wchar_t *s,uchar *mask,int *select, t_table *pt,t_drawheader *ph,int column,void *cache) {
+  int n=0;
+  ulong k;
+  t_eventrow *row;
+  // For sorted tables, t_drawheader is the pointer to the data element. It
+  // can't be NULL, except in DF_CACHESIZE, DF_FILLCACHE and DF_FREECACHE.
+  row=(t_eventrow *)ph;
+  switch (column) {
+    case DF_CACHESIZE:                 // Request for draw cache size
+      return 0;
+    case DF_FILLCACHE:                 // Request to fill draw cache
+    case DF_FREECACHE:                 // Request to free cached resources
+    case DF_NEWROW:                    // Request to start new row in window
+      break;
+    case 0:                            // Number of event
+      n=Swprintf(s,L"%lu",row->addr);
+      if (row->addr==autostart) {
+        // Start of diff is highlighted.
+        memset(mask,DRAW_HILITE,n);
+        *select|=DRAW_MASK; };
+      break;
+    case 1:                            // Event
+      switch (row->event) {
+        case AUTO_NEWMOD: n=StrcopyW(s,TEXTLEN,L"Module loaded"); break;
+        case AUTO_ENDMOD: n=StrcopyW(s,TEXTLEN,L"Module unloaded"); break;
+        case AUTO_PAUSE: n=StrcopyW(s,TEXTLEN,L"Paused"); break;
+        case AUTO_RUN: n=StrcopyW(s,TEXTLEN,L"Run"); break;
+        case AUTO_EXCEPTION: n=StrcopyW(s,TEXTLEN,L"Exception"); break;
+        case AUTO_TIMER: n=StrcopyW(s,TEXTLEN,L"Timer"); break;
+        case AUTO_PHASE: n=StrcopyW(s,TEXTLEN,L"Phase end"); break;
+        default: n=StrcopyW(s,TEXTLEN,L"Manual"); break; };
+      break;
+    case 2:                            // Run time
+      n=Swprintf(s,L"%lu.%03lu",row->runtime/1000,row->runtime%1000);
+      break;
+    case 3:                            // EIP
+      n=Hexprint8W(s,row->eip);
+      memset(mask,DRAW_GRAY,n);
+      *select|=DRAW_MASK;
+      break;
+    case 4:                            // New hits
+      n=Swprintf(s,L"%lu",row->nhit);
+      break;
+    case 5:                            // Timeline
+      if (row->nhit==0 || automaxhit==0) break;
+      k=(ulong)((u64)row->nhit*TIMELINEBAR/automaxhit);
+      if (k==0) k=1;
+      for (n=0; n<(int)k; n++) s[n]=L'#';
+      s[n]=L'\0';
+      break;
+    case 6:                            // Details
+      n=StrcopyW(s,TEXTLEN,row->text);
+      break;
+    default: break;
+  };
+  return n;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////// PLUGIN MENUS EMBEDDED INTO OLLYDBG WINDOWS //////////////////
+
+// Menu processing functions are called twice. First time (mode=MENU_VERIFY)
+// OllyDbg asks to verify whether corresponding menu item applies or not. If
+// necessary, menu function may change menu text (parameter name, up to TEXTLEN
+// UNICODE characters). It must return one of the following codes:
+//
+//   MENU_ABSENT:     menu item does not apply and should not be present in
+//                    the menu;
+//   MENU_NORMAL:     menu item appears in the menu;
+//   MENU_CHECKED:    menu item appears in the menu and has attached checkmark;
+//   MENU_CHKPARENT:  menu item appears in the menu and has attached checkmark.
+//                    Additionally, attaches checkmark to the parent item in
+//                    menu on the previous level. This feature does not work in
+//                    the main menu;
+//   MENU_SHORTCUT:   menu item does not appear in the menu but is active and
+//                    participates in the search for keyboard shortcut;
+//   MENU_GRAYED:     item is present in the menu but disabled. This style is
+//                    not compatible with OllyDbg's look-and-feel, use it only
+//                    if absolutely necessary due to the menu logic.
+//
+// When menu item is selected (mouseclick or keyboard shortcut), menu function
+// is called for the second time (mode=MENU_EXECUTE, name is undefined). At
+// this moment, all threads of the debugged application are suspended. Function
+// must make all necessary actions and return one of the following codes:
+//
+//   MENU_REDRAW:     this action has global impact, all OllyDbg windows must
+//                    be updated. OllyDbg broadcasts WM_USER_CHGALL;
+//   MENU_NOREDRAW:   no redrawing is necessary.
+//
+// If processing is lengthy and application should continue execution, use
+// Resumeallthreads() at entry to the MENU_EXECUTE block and Suspendallthreads()
+// on exit. Note that MENU_ABSENT and MENU_NOREDRAW are interchangeable.
+//
+// Parameter index allows to use single menu function with several similar menu
+// items.
+//
+// Note that OllyDbg uses menu structuress to process keyboard shortcuts. It is
+// done automatically, without the need to pay additional attention.
+
+
+// Menu function of main menu, displays About dialog.
+static int Mabout(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int n;
+  wchar_t s[TEXTLEN];
+  if (mode==MENU_VERIFY)
+    return MENU_NORMAL;                // Always available
+  else if (mode==MENU_EXECUTE) {
+    // Debuggee should continue execution while message box is displayed.
+    Resumeallthreads();
+    // In this case, Swprintf() would be as good as a sequence of StrcopyW(),
+    // but secure copy makes buffer overflow impossible.
+    n=StrcopyW(s,TEXTLEN,L"DiffSnake plugin v");
+    n+=StrcopyW(s+n,TEXTLEN-n,VERSION);
+    // COPYRIGHT POLICY: This bookmark plugin is an open-source freeware. It's
+    // just a sample. The copyright below is also just a sample and applies to
+    // the unmodified sample code only. Replace or remove copyright message if
+    // you make ANY changes to this code!
+    n+=StrcopyW(s+n,TEXTLEN-n,L"\nCopyright none. This software is free as a bird");
+    // The conditionals below are here to verify that this plugin can be
+    // compiled with all supported compilers. They are not necessary in the
+    // final code.
+    #if defined(__BORLANDC__)
+      n+=StrcopyW(s+n,TEXTLEN-n,L"\n\nCompiled with Borland (R) ");
+    #elif defined(_MSC_VER)
+      n+=StrcopyW(s+n,TEXTLEN-n,L"\n\nCompiled with Microsoft (R) ");
+    #elif defined(__MINGW32__)
+      n+=StrcopyW(s+n,TEXTLEN-n,L"\n\nCompiled with MinGW32 ");
+    #else
+      n+=StrcopyW(s+n,TEXTLEN-n,L"\n\nCompiled with ");
+    #endif
+    #ifdef __cplusplus
+      StrcopyW(s+n,TEXTLEN-n,L"C++ compiler");
+    #else
+      StrcopyW(s+n,TEXTLEN-n,L"C compiler");
+    #endif
+    MessageBox(hwollymain,s,
+      L"DiffSnake plugin",MB_OK|MB_ICONINFORMATION);
+    // Suspendallthreads() and Resumeallthreads() must be paired, even if they
+    // are called in inverse order!
+    Suspendallthreads();
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+
+// Opens Hit Trace Difference or brings it to the top.
+static void Showdiffwindow(void) {
+  if (hitlisttable.hw==NULL){
+    // Create table window. Third parameter (ncolumn) is the number of
+    // visible columns in the newly created window (ignored if appearance is
+    // restored from the initialization file). If it's lower than the total
+    // number of columns, remaining columns are initially invisible. Fourth
+    // parameter is the name of icon - as OllyDbg resource.
+    Createtablewindow(&hitlisttable,0,hitlisttable.bar.nbar,NULL, L"ICO_PLUGIN",PLUGINNAME);
+  }
+  else
+    Activatetablewindow(&hitlisttable);
+  Diffviewupdate(&hitlisttable);
+};
+
+static int MMarkTrace(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int i;
+  t_dynregion *pr;
+  if (mode==MENU_VERIFY)
+    return MENU_NORMAL;                // Always available
+  else if (mode==MENU_EXECUTE) {
+    // Old diff refers to the old baseline, discard it.
+    Snapfree(&diffsnap);
+    Diffviewreset();
+    diffview.selected=-1;
+    hitlisttable.offset=0;
+    Diffviewupdate(&hitlisttable);
+    baseregion.n=0;
+    baseregions=0;
+    Mapreset(&basepages);
+    Mapreset(&changedpages);
+    if (Takesnapshot(&basesnap)!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, baseline is empty");
+    else if (pagecheck && Hashpages(&basesnap,&basepages)!=0) {
+      Mapreset(&basepages);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, modified code is not detected"); };
+    if (basesnap.nblock!=0 && dynscan) {
+      baseregions=1;
+      for (i=0; i<liveregion.n; i++) {
+        pr=liveregion.region+i;
+        if (Addregion(&baseregion,pr->base,pr->size,pr->hash,pr->born)!=0) {
+          baseregions=0;
+          Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, regions are compared by address");
+          break;
+        };
+      };
+    };
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+static int MCompareTrace(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int n;
+  if (mode==MENU_VERIFY)
+    return MENU_NORMAL;                // Always available
+  else if (mode==MENU_EXECUTE) {
+    t_snapshot cursnap;
+    if (streampath[0]!=L'\0') {
+      // Streamed diff is written to file and paged in by the table. Regions
+      // are compared by address, as there is no snapshot to rekey.
+      Snapfree(&diffsnap);
+      Diffviewreset();
+      if (Streamtrace()!=0)
+        Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to write %s",streampath);
+      else
+        Addtolist(0,DRAW_NORMAL,L"DiffSnake: %u new commands streamed to %s",
+        diffstream.nhit,streampath);
+      diffview.nrow=Diffhits(); }
+    else {
+      // Diff is the set of addresses hit now but not at baseline. Bitmaps are
+      // compared word by word, no rows are created. Executable regions
+      // outside modules are then matched by contents.
+      Snapinit(&cursnap);
+      n=0;
+      if (Takesnapshot(&cursnap)!=0 || Snapandnot(&diffsnap,&cursnap,&basesnap)!=0 ||
+        (dynscan && baseregions && (n=Rekeyregions(&diffsnap,&cursnap))<0)) {
+        Snapfree(&diffsnap);
+        Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to calculate diff"); }
+      else if (n>0)
+        Addtolist(0,DRAW_NORMAL,L"DiffSnake: %i executable regions compared by contents",n);
+      Snapfree(&cursnap);
+      Diffviewreset();
+    };
+    // Code that was modified since baseline is marked in the diff.
+    n=Findchangedpages();
+    if (n<0) {
+      Mapreset(&changedpages);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, modified code is not detected"); }
+    else if (n>0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: %i code pages modified since baseline",n);
+    diffview.selected=(Diffhits()>0?0:-1);
+    hitlisttable.offset=0;
+    Showdiffwindow();
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Disassembler pane, selects the row of Hit Trace Difference
+// that corresponds to the selected command. Rank directory gives the row
+// directly. If command is not in the diff, selects first new instruction
+// that follows it.
+static int MFindindiff(t_table *pt,wchar_t *name,ulong index,int mode) {
+  u32 addr,rank,hit;
+  int row;
+  if (mode==MENU_VERIFY)
+    return (Diffhits()==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    addr=Getcpudisasmselection();
+    rank=Diffrank(addr);
+    if (rank>=Diffhits()) {
+      Flash(L"No new instructions at or after this address");
+      return MENU_NOREDRAW; };
+    row=Diffrowofhit(rank);
+    if (row<0) {
+      Flash(L"Command is hidden by the filter");
+      return MENU_NOREDRAW; };
+    Diffselect(rank,&hit);
+    if (hit!=addr)
+      Flash(L"Command is not in the diff, selecting next new instruction");
+    Showdiffwindow();
+    Diffviewselect(&hitlisttable,row,1);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Disassembler pane, lists events whose snapshots contain
+// the selected command. Consecutive events are merged into ranges.
+static int MWhichevents(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int i,j,n,k;
+  ulong serial[NAUTOSNAP],t;
+  u32 addr;
+  const u32 *set;
+  wchar_t s[TEXTLEN];
+  if (mode==MENU_VERIFY)
+    return (autoserial==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    addr=Getcpudisasmselection();
+    set=Eventsof(addr);
+    if (set==NULL) {
+      Flash(indexvalid?L"Command is not in any event snapshot":L"Event index is unavailable");
+      return MENU_NOREDRAW; };
+    for (i=n=0; i<NAUTOSNAP; i++) {
+      if ((set[i/32]>>(i%32)) & 1) serial[n++]=autoring[i].serial; };
+    for (i=1; i<n; i++) {
+      t=serial[i];
+      for (j=i; j>0 && serial[j-1]>t; j--) serial[j]=serial[j-1];
+      serial[j]=t; };
+    k=0;
+    for (i=0; i<n && k<TEXTLEN-32; i=j) {
+      for (j=i+1; j<n && serial[j]==serial[j-1]+1; j++) ;
+      if (j-i==1)
+        k+=Swprintf(s+k,L"%s%lu",(i==0?L"":L", "),serial[i]);
+      else
+        k+=Swprintf(s+k,L"%s%lu-%lu",(i==0?L"":L", "),serial[i],serial[j-1]);
+    };
+    Addtolist(addr,DRAW_NORMAL,L"DiffSnake: %08X is in %i event snapshots: %s",addr,n,s);
+    Flash(L"%i events: %s",n,s);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Disassembler pane, shows in Hit Trace Difference commands
+// that are contained in exactly the same event snapshots as the selected one.
+static int MSameevents(t_table *pt,wchar_t *name,ulong index,int mode) {
+  u32 i,j,k,n,addr,*psig,sig,*list;
+  t_hitblock *pb;
+  if (mode==MENU_VERIFY)
+    return (autoserial==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    addr=Getcpudisasmselection();
+    psig=Mapfind(&eventindex,addr);
+    if (indexvalid==0 || psig==NULL || *psig==emptysig) {
+      Flash(L"Command is not in any event snapshot");
+      return MENU_NOREDRAW; };
+    sig=*psig;
+    // Commands may lie outside of all deltas in the ring, so diff is built
+    // from the sorted list of commands. Close commands share the block.
+    Snapfree(&diffsnap);
+    list=(u32 *)malloc(eventindex.nkey*sizeof(u32)+4);
+    for (i=n=0; list!=NULL && i<eventindex.nslot; i++) {
+      if (eventindex.key[i]!=ADDR_EMPTY && eventindex.value[i]==sig)
+        list[n++]=eventindex.key[i]; };
+    if (list!=NULL) qsort(list,n,sizeof(u32),Addrsortfunc);
+    for (i=0; list!=NULL && i<n; i=j) {
+      for (j=i+1; j<n && list[j]-list[j-1]<=CODEPAGE; j++) ;
+      pb=Snapaddblock(&diffsnap,list[i],list[j-1]-list[i]+1);
+      if (pb==NULL) break;
+      for (k=i; k<j; k++) Setbit(pb,list[k]-list[i]); };
+    if (list==NULL || i<n || Snapbuildrank(&diffsnap)!=0) {
+      Snapfree(&diffsnap);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to calculate diff"); };
+    if (list!=NULL) free(list);
+    Diffviewreset();
+    diffview.selected=(diffsnap.nhit>0?0:-1);
+    hitlisttable.offset=0;
+    Showdiffwindow();
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Hit Trace Difference window, follows selected row in the
+// CPU Disassembler.
+static int MFollowdiff(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY)
+    return (diffview.selected<0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    Diffviewfollow(pt);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Hit Trace Difference window, jumps to the N-th new
+// instruction. Rows are numbered from 1 in the dialog.
+static int MGotorow(t_table *pt,wchar_t *name,ulong index,int mode) {
+  ulong row;
+  if (mode==MENU_VERIFY)
+    return (diffview.nrow==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    row=diffview.selected+1;
+    if (Getinteger(pt->hw,L"Go to row of the diff",&row,0,-1,-1,pt->font,
+      DIA_DWORD|DIA_DEFUNSIG)!=0)
+      return MENU_NOREDRAW;            // Cancelled
+    if (row==0 || row>diffview.nrow) {
+      Flash(L"Diff has only %u rows",diffview.nrow);
+      return MENU_NOREDRAW; };
+    Diffviewselect(pt,row-1,1);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Hit Trace Difference window, selects the row of given
+// address or, if address is not in the diff, first row that follows it.
+static int MGotoaddr(t_table *pt,wchar_t *name,ulong index,int mode) {
+  ulong addr;
+  u32 rank,seladdr;
+  int row;
+  if (mode==MENU_VERIFY)
+    return (diffview.nrow==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    // Suggest address of the selected row.
+    if (Diffrowaddr(diffview.selected,&seladdr)!=0)
+      seladdr=0;
+    addr=seladdr;
+    if (Getgotoexpression(pt->hw,L"Go to address in the diff",&addr,
+      Getcputhreadid(),0,-1,-1,pt->font,0)!=0)
+      return MENU_NOREDRAW;            // Cancelled
+    rank=Diffrank(addr);
+    if (rank>=Diffhits()) rank=Diffhits()-1;
+    row=Diffrowofhit(rank);
+    if (row<0) {
+      Flash(L"Address is hidden by the filter");
+      return MENU_NOREDRAW; };
+    Diffviewselect(pt,row,1);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Hit Trace Difference window, sorts rows by the text of
+// instruction. Texts are interned, so sorting is a counting sort of hits by
+// the alphabetical position of their text ids. It is stable, therefore rows
+// with the same command remain sorted by address. Filter, if any, is removed.
+static int MSortbytext(t_table *pt,wchar_t *name,ulong index,int mode) {
+  u32 i,n,*order,*count,*perm;
+  if (mode==MENU_VERIFY)
+    return (diffsnap.nhit==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    if (Diffinterntexts()!=0) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to sort diff");
+      return MENU_NOREDRAW; };
+    n=textpool.nstr;
+    order=Poolsortorder(&textpool);
+    count=(u32 *)calloc(n+1,sizeof(u32));
+    perm=(u32 *)malloc(diffsnap.nhit*sizeof(u32));
+    if (order==NULL || count==NULL || perm==NULL) {
+      if (order!=NULL) free(order);
+      if (count!=NULL) free(count);
+      if (perm!=NULL) free(perm);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to sort diff");
+      return MENU_NOREDRAW; };
+    for (i=0; i<diffsnap.nhit; i++)
+      count[order[diffview.textid[i]]+1]++;
+    for (i=0; i<n; i++)
+      count[i+1]+=count[i];
+    for (i=0; i<diffsnap.nhit; i++)
+      perm[count[order[diffview.textid[i]]]++]=i;
+    free(order);
+    free(count);
+    if (Diffsetperm(perm,diffsnap.nhit)!=0) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to sort diff");
+      return MENU_NOREDRAW; };
+    Diffviewselect(pt,0,0);
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Hit Trace Difference window, shows only rows with the same
+// instruction as the selected one. Comparison is done on text ids.
+static int MFilterbytext(t_table *pt,wchar_t *name,ulong index,int mode) {
+  u32 i,n,hit,id,*perm;
+  if (mode==MENU_VERIFY)
+    return (diffview.selected<0 || diffstream.f!=NULL?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    if (Diffinterntexts()!=0) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to filter diff");
+      return MENU_NOREDRAW; };
+    hit=(diffview.perm==NULL?(u32)diffview.selected:diffview.perm[diffview.selected]);
+    id=diffview.textid[hit];
+    for (i=n=0; i<diffsnap.nhit; i++) {
+      if (diffview.textid[i]==id) n++; };
+    perm=(u32 *)malloc(n*sizeof(u32));
+    if (perm==NULL) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to filter diff");
+      return MENU_NOREDRAW; };
+    for (i=n=0; i<diffsnap.nhit; i++) {
+      if (diffview.textid[i]==id) perm[n++]=i; };
+    if (Diffsetperm(perm,n)!=0) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to filter diff");
+      return MENU_NOREDRAW; };
+    Diffviewselect(pt,Diffrowofhit(hit),1);
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Hit Trace Difference window, attributes new instructions
+// to threads that executed them according to the run trace.
+static int MAttributethreads(t_table *pt,wchar_t *name,ulong index,int mode) {
+  t_reg reg;
+  if (mode==MENU_VERIFY)
+    return (diffsnap.nhit==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    if (Getruntrace(0,&reg,NULL)<0) {
+      Flash(L"Run trace is empty");
+      return MENU_NOREDRAW; };
+    if (Diffattributethreads()!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to attribute threads");
+    else if (diffview.nthread==0)
+      Flash(L"Run trace contains no new instructions");
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Hit Trace Difference window, shows only rows executed by
+// the thread of the selected row (the first one if there are several).
+static int MFilterbythread(t_table *pt,wchar_t *name,ulong index,int mode) {
+  u32 addr,hit,selhit,n,*perm;
+  ulong threadid;
+  t_snapiter it;
+  const t_snapshot *ps;
+  if (mode==MENU_VERIFY) {
+    if (diffview.nthread==0 || Diffrowaddr(diffview.selected,&addr)!=0 ||
+      Diffthreadsof(addr,&threadid)==0)
+      return MENU_ABSENT;
+    return MENU_NORMAL; }
+  else if (mode==MENU_EXECUTE) {
+    if (Diffrowaddr(diffview.selected,&addr)!=0 || Diffthreadsof(addr,&threadid)==0)
+      return MENU_NOREDRAW;
+    ps=Diffthreadhits(threadid);
+    perm=(u32 *)malloc(diffsnap.nhit*sizeof(u32));
+    if (ps==NULL || perm==NULL) {
+      if (perm!=NULL) free(perm);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to filter diff");
+      return MENU_NOREDRAW; };
+    selhit=(diffview.perm==NULL?(u32)diffview.selected:diffview.perm[diffview.selected]);
+    // Hits come in the order of addresses, so index of hit is simply counted.
+    Snapiterinit(&it,&diffsnap,0,0xFFFFFFFF);
+    for (hit=n=0; Snapiternext(&it,&addr); hit++) {
+      if (Snaptest(ps,addr)) perm[n++]=hit; };
+    if (Diffsetperm(perm,n)!=0) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to filter diff");
+      return MENU_NOREDRAW; };
+    Diffviewselect(pt,Diffrowofhit(selhit),1);
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Hit Trace Difference window, returns to all rows sorted by
+// address. Interned texts are kept for the next sort or filter.
+static int MShowall(t_table *pt,wchar_t *name,ulong index,int mode) {
+  u32 hit;
+  if (mode==MENU_VERIFY)
+    return (diffview.perm==NULL?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    hit=0;
+    if (diffview.selected>=0)
+      hit=diffview.perm[diffview.selected];
+    Diffsetperm(NULL,0);
+    Diffviewselect(pt,(int)hit,1);
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Lists loaded modules for coverage files. Modules in the OllyDbg table are
+// sorted by address, as required by covfile. Returns allocated array that
+// must be freed by caller, or NULL if memory is low. On success, sets number of
+// modules and index of the main module (-1 if unknown).
+static t_covmodule *Getcovmodules(int *nmod,int *mainmod) {
+  int i,n;
+  t_module *pmod,*pmain;
+  t_covmodule *mod;
+  mod=(t_covmodule *)malloc((module.sorted.n>0?module.sorted.n:1)*sizeof(t_covmodule));
+  if (mod==NULL)
+    return NULL;
+  pmain=Findmainmodule();
+  *mainmod=-1;
+  for (i=n=0; i<module.sorted.n; i++) {
+    pmod=(t_module *)Getsortedbyindex(&module.sorted,i);
+    if (pmod==NULL) continue;
+    if (pmod==pmain) *mainmod=n;
+    mod[n].base=pmod->base;
+    mod[n].size=pmod->size;
+    mod[n].entry=pmod->entry;
+    mod[n].prefbase=pmod->fixupbase;
+    if (WideCharToMultiByte(CP_UTF8,0,pmod->path,-1,
+      mod[n].path,COVPATH,NULL,NULL)==0)
+      mod[n].path[0]='\0';
+    n++;
+  };
+  *nmod=n;
+  return mod;
+};
+
+// Returns length of command at given address. Analysed code is split into
+// commands by decoding data, the rest is disassembled. Used to split basic
+// blocks of imported coverage into commands.
+static u32 Cmdlength(u32 addr) {
+  ulong declength,length;
+  u32 n;
+  uchar cmd[MAXCMDSIZE],*decode;
+  t_disasm da;
+  decode=Finddecode(addr,&declength);
+  if (decode!=NULL && declength>0 && (decode[0] & DEC_TYPEMASK)>=DEC_COMMAND) {
+    for (n=1; n<declength && (decode[n] & DEC_TYPEMASK)==DEC_NEXTCODE; n++) ;
+    return n; };
+  length=Readmemory(cmd,addr,MAXCMDSIZE,MM_SILENT|MM_PARTIAL);
+  if (length==0)
+    return 0;
+  return Disasm(cmd,length,addr,NULL,&da,0,NULL,NULL);
+};
+
+// Menu function of main menu, exports baseline (index 0) or diff (index 1) as
+// drcov log that can be loaded into Lighthouse and other coverage viewers.
+// Module table is taken from OllyDbg, offsets are relative to module bases.
+static int MExportdrcov(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int n,nmod,mainmod;
+  wchar_t path[MAXPATH];
+  t_snapshot *ps;
+  t_covmodule *mod;
+  FILE *f;
+  ps=(index==0?&basesnap:&diffsnap);
+  if (mode==MENU_VERIFY)
+    return (ps->nhit==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    path[0]=L'\0';
+    if (Browsefilename(L"Export coverage to drcov log",path,NULL,NULL,
+      L".log",hwollymain,BRO_FILE|BRO_SAVE)==0)
+      return MENU_NOREDRAW;            // Cancelled
+    mod=Getcovmodules(&nmod,&mainmod);
+    if (mod==NULL) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to export");
+      return MENU_NOREDRAW; };
+    f=_wfopen(path,L"wb");
+    if (f==NULL) {
+      free(mod);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to create %s",path);
+      return MENU_NOREDRAW; };
+    n=Covwritedrcov(f,ps,mod,nmod);
+    if (fclose(f)!=0) n=-1;
+    free(mod);
+    if (n<0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Error writing %s",path);
+    else
+      Addtolist(0,DRAW_NORMAL,L"DiffSnake: %i blocks in %i modules written to %s",
+      n,nmod,path);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, saves baseline (index 0) or diff (index 1) in
+// the native format that can be loaded back as baseline or processed offline
+// by diffsnake-cli.
+static int MSavesnapshot(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int result,nmod,mainmod;
+  wchar_t path[MAXPATH];
+  t_snapshot *ps;
+  t_covmodule *mod;
+  FILE *f;
+  ps=(index==0?&basesnap:&diffsnap);
+  if (mode==MENU_VERIFY)
+    return (ps->nhit==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    path[0]=L'\0';
+    if (Browsefilename(L"Save snapshot",path,NULL,NULL,
+      L".dsnap",hwollymain,BRO_FILE|BRO_SAVE)==0)
+      return MENU_NOREDRAW;            // Cancelled
+    mod=Getcovmodules(&nmod,&mainmod);
+    if (mod==NULL) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to save");
+      return MENU_NOREDRAW; };
+    f=_wfopen(path,L"wb");
+    if (f==NULL) {
+      free(mod);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to create %s",path);
+      return MENU_NOREDRAW; };
+    result=Covwritenative(f,ps,mod,nmod);
+    if (fclose(f)!=0) result=-1;
+    free(mod);
+    if (result!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Error writing %s",path);
+    else
+      Addtolist(0,DRAW_NORMAL,L"DiffSnake: %u commands saved to %s",ps->nhit,path);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, loads baseline from coverage file gathered by
+// other tool: drcov log or list of addresses, or from saved snapshot.
+// Coverage is relocated to the current module bases. Old diff refers to the
+// old baseline and is discarded.
+static int MImportbaseline(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int nmod,mainmod,result;
+  wchar_t path[MAXPATH];
+  t_covmodule *mod;
+  t_covstat st;
+  FILE *f;
+  if (mode==MENU_VERIFY)
+    return (module.sorted.n==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    path[0]=L'\0';
+    if (Browsefilename(L"Import baseline from coverage file",path,NULL,NULL,
+      NULL,hwollymain,BRO_FILE)==0)
+      return MENU_NOREDRAW;            // Cancelled
+    f=_wfopen(path,L"rb");
+    if (f==NULL) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to open %s",path);
+      return MENU_NOREDRAW; };
+    mod=Getcovmodules(&nmod,&mainmod);
+    if (mod==NULL) {
+      fclose(f);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to import");
+      return MENU_NOREDRAW; };
+    Snapfree(&diffsnap);
+    Diffviewreset();
+    diffview.selected=-1;
+    hitlisttable.offset=0;
+    Diffviewupdate(&hitlisttable);
+    baseregions=0;                     // Files keep no contents
+    Mapreset(&basepages);
+    Mapreset(&changedpages);
+    result=Covread(f,&basesnap,mod,nmod,mainmod,Cmdlength,&st);
+    fclose(f);
+    free(mod);
+    if (result!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to import %s, baseline is empty",path);
+    else {
+      Addtolist(0,DRAW_NORMAL,L"DiffSnake: %u records imported from %s, %u commands in baseline",
+        st.nrecord,path,basesnap.nhit);
+      if (st.nlost!=0 || st.nbad!=0)
+        Addtolist(0,DRAW_HILITE,L"DiffSnake: %u records outside of loaded modules, %u lines not recognized",
+        st.nlost,st.nbad);
+    };
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, lists new commands from the run trace in the
+// order of their first execution.
+static int MRuntraceorder(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int n;
+  t_reg reg;
+  if (mode==MENU_VERIFY)
+    return MENU_NORMAL;                // Always available
+  else if (mode==MENU_EXECUTE) {
+    if (Getruntrace(0,&reg,NULL)<0) {
+      Flash(L"Run trace is empty");
+      return MENU_NOREDRAW; };
+    n=Runtraceorder();
+    if (n<0) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to order run trace");
+      return MENU_NOREDRAW; };
+    if (ordertable.hw==NULL)
+      Createtablewindow(&ordertable,0,ordertable.bar.nbar,NULL,L"ICO_PLUGIN",PLUGINNAME);
+    else
+      Activatetablewindow(&ordertable);
+    if (n==0)
+      Flash(L"Run trace contains no new commands");
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, counts executions of all commands that are
+// currently in the run trace and marks the end of the first interval.
+static int MMarkruntrace(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY)
+    return MENU_NORMAL;                // Always available
+  else if (mode==MENU_EXECUTE) {
+    Mapreset(&markcount);
+    markrecords=Countruntrace();
+    if (markrecords==0)
+      Flash(L"Run trace is empty");
+    else if (Countexecutions(&markcount,markrecords-1,0)!=0) {
+      Mapreset(&markcount);
+      markrecords=-1;
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to count executions"); }
+    else
+      Addtolist(0,DRAW_NORMAL,L"DiffSnake: Run trace marked at %i records, %i distinct commands",
+        markrecords,(int)markcount.nkey);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, compares execution counts before and after the
+// mark.
+static int MCountdelta(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int n;
+  if (mode==MENU_VERIFY)
+    return (markrecords<0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    n=Countdelta();
+    if (n<0) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to count executions");
+      return MENU_NOREDRAW; };
+    if (counttable.hw==NULL)
+      Createtablewindow(&counttable,0,counttable.bar.nbar,NULL,L"ICO_PLUGIN",PLUGINNAME);
+    else
+      Activatetablewindow(&counttable);
+    if (n==0)
+      Flash(L"Execution counts did not change");
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, turns snapshots on the event given by index
+// on or off. Selection is saved to the initialization file.
+static int MAutoevent(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY)
+    return ((automask & index)!=0?MENU_CHECKED:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    automask^=index;
+    Writetoini(NULL,PLUGINNAME,L"Snapshot events",L"%i",automask);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, asks for interval of timed snapshots in seconds
+// of run time. Zero turns timer off.
+static int MAutointerval(t_table *pt,wchar_t *name,ulong index,int mode) {
+  ulong interval;
+  if (mode==MENU_VERIFY)
+    return (autointerval!=0?MENU_CHECKED:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    interval=autointerval;
+    if (Getinteger(hwollymain,L"Snapshot every N seconds of run time (0: off)",
+      &interval,0,-1,-1,0,DIA_DWORD|DIA_DEFUNSIG)!=0)
+      return MENU_NOREDRAW;            // Cancelled
+    autointerval=interval;
+    nexttimer=runtime+autointerval*1000;
+    Writetoini(NULL,PLUGINNAME,L"Snapshot interval",L"%i",(int)autointerval);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
 
+// Menu function of main menu, edits scan filter. Filter applies to snapshots
+// taken after the change, including baseline; diff is meaningful only if
+// both were taken with the same filter.
+static int MScanfilter(t_table *pt,wchar_t *name,ulong index,int mode) {
+  wchar_t s[TEXTLEN];
+  if (mode==MENU_VERIFY)
+    return (nfilter!=0?MENU_CHECKED:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    StrcopyW(s,TEXTLEN,filtertext);
+    if (Getstring(hwollymain,L"Scan filter (e.g. -system -ntdll 401000-4FFFFF)",
+      s,TEXTLEN,0,0,-1,-1,0,0)<0)
+      return MENU_NOREDRAW;            // Cancelled
+    if (Parsefilter(s)!=0)
+      return MENU_NOREDRAW;
+    StrcopyW(filtertext,TEXTLEN,s);
+    Writetoini(NULL,PLUGINNAME,L"Scan filter",L"%s",filtertext);
+    if (nfilter!=0 && basesnap.nblock!=0)
+      Flash(L"Filter applies to new snapshots, take baseline again");
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
 
-// Custom table function of hitlist window. Here it is used only to process
-// doubleclicks (custom message WM_USER_DBLCLK). This function is also called
-// on WM_DESTROY, WM_CLOSE (by returning -1, you can prevent window from
-// closing), WM_SIZE (custom tables only), WM_CHAR (only if TABLE_WANTCHAR is
-// set) and different custom messages WM_USER_xxx (depending on table type).
-// See documentation for details.
-long HitlistSelfunc(t_table *pt,HWND hw,UINT msg,WPARAM wp,LPARAM lp) {
-  t_hitlist * item;
-  switch (msg) {
-    case WM_USER_DBLCLK:               // Doubleclick
-      // Get selection.
-      item=(t_hitlist *)Getsortedbyselection(&(pt->sorted),pt->sorted.selected);
-      // Follow address in CPU Disassembler pane. Actual address is added to
-      // the history, so that user can easily return back to it.
-      if (item!=NULL) Setcpu(0,item->index,0,0,0, CPU_ASMHIST|CPU_ASMCENTER|CPU_ASMFOCUS);
-      return 1;
-    default: break;
+// Menu function of main menu, switches scanning of executable memory outside
+// of modules.
+static int MDynscan(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY)
+    return (dynscan?MENU_CHECKED:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    dynscan=!dynscan;
+    liveregion.n=0;                    // Lifetimes restart
+    Writetoini(NULL,PLUGINNAME,L"Executable memory",L"%i",dynscan);
+    if (basesnap.nblock!=0)
+      Flash(L"Setting applies to new snapshots, take baseline again");
+    return MENU_NOREDRAW;
   };
-  return 0;
+  return MENU_ABSENT;
 };
 
-int Hitlistdraw(wchar_t *s,uchar *mask,int *select, t_table *pt,t_drawheader *ph,int column,void *cache) {
-  int n=0;
-  t_hitlist * listitem;
-  // For simple tables, t_drawheader is the pointer to the data element. It
-  // can't be NULL, except in DF_CACHESIZE, DF_FILLCACHE and DF_FREECACHE.
-  listitem=(t_hitlist *)ph;
+// Menu function of main menu, switches hashing of executed code pages.
+static int MPagecheck(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY)
+    return (pagecheck?MENU_CHECKED:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    pagecheck=!pagecheck;
+    Writetoini(NULL,PLUGINNAME,L"Page hashes",L"%i",pagecheck);
+    if (pagecheck && basesnap.nblock!=0)
+      Flash(L"Pages are hashed with baseline, take baseline again");
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
 
-  switch (column) {
-    case DF_CACHESIZE:                 // Request for draw cache size
-      // Columns 3 and 4 (disassembly and comment) both require calls to
-      // Disasm(). To accelerate processing, I call disassembler once per line
-      // and cache data between the calls. Here I inform the drawing routine
-      // how large the cache must be.
-      return 0;//sizeof(t_disasm);
-    case DF_FILLCACHE:                 // Request to fill draw cache
-      // We don't need to initialize cache when drawing begins. Note that cache
-      // is initially zeroed.
-      break;
-    case DF_FREECACHE:                 // Request to free cached resources
-      // We don't need to free cached resources when drawing ends.
-      break;
-    case DF_NEWROW:                    // Request to start new row in window
-      // New row starts. Let us disassemble the command at the pointed address.
-      // I assume that bookmarks can't be set on data. First of all, we need to
-      // read the contents of memory. Length of 80x86 commands is limited to
-      // MAXCMDSIZE bytes.
-    case 0:                            // 0-based index
-	  n=Hexprint8W(s,listitem->index);//StrcopyW(s,TEXTLEN,L"%x",listitem->index);
-	  memset(mask,DRAW_GRAY,n);
-	  *select|=DRAW_MASK;
-      break;
-    case 1:   
-      n=StrcopyW(s,TEXTLEN,listitem->decodedinstruction);
-	  memset(mask,DRAW_GRAY,n);
-	  *select|=DRAW_MASK;
-      break;
-    default: break;
+// Menu function of main menu, switches streaming of the diff to file. When it
+// is on, Show Diff writes new commands to the file instead of memory.
+static int MStreamdiff(t_table *pt,wchar_t *name,ulong index,int mode) {
+  wchar_t path[MAXPATH];
+  if (mode==MENU_VERIFY)
+    return (streampath[0]!=L'\0'?MENU_CHECKED:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    if (streampath[0]!=L'\0') {
+      streampath[0]=L'\0';
+      return MENU_NOREDRAW; };
+    path[0]=L'\0';
+    if (Browsefilename(L"Stream diff to file",path,NULL,NULL,
+      L".dsdf",hwollymain,BRO_FILE|BRO_SAVE)==0)
+      return MENU_NOREDRAW;            // Cancelled
+    StrcopyW(streampath,MAXPATH,path);
+    return MENU_NOREDRAW;
   };
-  return n;
+  return MENU_ABSENT;
 };
 
-////////////////////////////////////////////////////////////////////////////////
-////////////////// PLUGIN MENUS EMBEDDED INTO OLLYDBG WINDOWS //////////////////
+// Menu function of main menu, switches writing of disassembly of streamed
+// diff to the text file.
+static int MStreamtext(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY)
+    return (streamtext?MENU_CHECKED:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    streamtext=!streamtext;
+    Writetoini(NULL,PLUGINNAME,L"Stream text",L"%i",streamtext);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
 
-// Menu processing functions are called twice. First time (mode=MENU_VERIFY)
-// OllyDbg asks to verify whether corresponding menu item applies or not. If
-// necessary, menu function may change menu text (parameter name, up to TEXTLEN
-// UNICODE characters). It must return one of the following codes:
-//
-//   MENU_ABSENT:     menu item does not apply and should not be present in
-//                    the menu;
-//   MENU_NORMAL:     menu item appears in the menu;
-//   MENU_CHECKED:    menu item appears in the menu and has attached checkmark;
-//   MENU_CHKPARENT:  menu item appears in the menu and has attached checkmark.
-//                    Additionally, attaches checkmark to the parent item in
-//                    menu on the previous level. This feature does not work in
-//                    the main menu;
-//   MENU_SHORTCUT:   menu item does not appear in the menu but is active and
-//                    participates in the search for keyboard shortcut;
-//   MENU_GRAYED:     item is present in the menu but disabled. This style is
-//                    not compatible with OllyDbg's look-and-feel, use it only
-//                    if absolutely necessary due to the menu logic.
-//
-// When menu item is selected (mouseclick or keyboard shortcut), menu function
-// is called for the second time (mode=MENU_EXECUTE, name is undefined). At
-// this moment, all threads of the debugged application are suspended. Function
-// must make all necessary actions and return one of the following codes:
-//
-//   MENU_REDRAW:     this action has global impact, all OllyDbg windows must
-//                    be updated. OllyDbg broadcasts WM_USER_CHGALL;
-//   MENU_NOREDRAW:   no redrawing is necessary.
-//
-// If processing is lengthy and application should continue execution, use
-// Resumeallthreads() at entry to the MENU_EXECUTE block and Suspendallthreads()
-// on exit. Note that MENU_ABSENT and MENU_NOREDRAW are interchangeable.
-//
-// Parameter index allows to use single menu function with several similar menu
-// items.
-//
-// Note that OllyDbg uses menu structuress to process keyboard shortcuts. It is
-// done automatically, without the need to pay additional attention.
+// Menu function of main menu, lists jumps and calls that lead from executed
+// to new code.
+static int MNewedges(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int n;
+  if (mode==MENU_VERIFY)
+    return (diffsnap.nhit==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    n=Newedges();
+    if (n<0) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to list jumps");
+      return MENU_NOREDRAW; };
+    if (edgetable.hw==NULL)
+      Createtablewindow(&edgetable,0,edgetable.bar.nbar,NULL,L"ICO_PLUGIN",PLUGINNAME);
+    else
+      Activatetablewindow(&edgetable);
+    if (n==0)
+      Flash(L"No known jumps or calls lead to new code");
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
 
+// Menu function of New Calls and Jumps window, follows source (index 0) or
+// destination (index 1) of selected jump in the CPU Disassembler.
+static int MFollowedge(t_table *pt,wchar_t *name,ulong index,int mode) {
+  t_edgerow *row;
+  row=(t_edgerow *)Getsortedbyselection(&pt->sorted,pt->sorted.selected);
+  if (mode==MENU_VERIFY)
+    return (row==NULL?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    Setcpu(0,(index==0?row->from:row->dest),0,0,0,
+      CPU_ASMHIST|CPU_ASMCENTER|CPU_ASMFOCUS);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
 
-// Menu function of main menu, displays About dialog.
-static int Mabout(t_table *pt,wchar_t *name,ulong index,int mode) {
+// Menu function of New Calls and Jumps window, exports all rows as Graphviz
+// graph.
+static int MExportedges(t_table *pt,wchar_t *name,ulong index,int mode) {
   int n;
-  wchar_t s[TEXTLEN];
+  wchar_t path[MAXPATH];
+  FILE *f;
   if (mode==MENU_VERIFY)
-    return MENU_NORMAL;                // Always available
+    return (edgetable.sorted.n==0?MENU_ABSENT:MENU_NORMAL);
   else if (mode==MENU_EXECUTE) {
-    // Debuggee should continue execution while message box is displayed.
-    Resumeallthreads();
-    // In this case, Swprintf() would be as good as a sequence of StrcopyW(),
-    // but secure copy makes buffer overflow impossible.
-    n=StrcopyW(s,TEXTLEN,L"DiffSnake plugin v");
-    n+=StrcopyW(s+n,TEXTLEN-n,VERSION);
-    // COPYRIGHT POLICY: This bookmark plugin is an open-source freeware. It's
-    // just a sample. The copyright below is also just a sample and applies to
-    // the unmodified sample code only. Replace or remove copyright message if
-    // you make ANY changes to this code!
-    n+=StrcopyW(s+n,TEXTLEN-n,L"\nCopyright none. This software is free as a bird");
-    // The conditionals below are here to verify that this plugin can be
-    // compiled with all supported compilers. They are not necessary in the
-    // final code.
-    #if defined(__BORLANDC__)
-      n+=StrcopyW(s+n,TEXTLEN-n,L"\n\nCompiled with Borland (R) ");
-    #elif defined(_MSC_VER)
-      n+=StrcopyW(s+n,TEXTLEN-n,L"\n\nCompiled with Microsoft (R) ");
-    #elif defined(__MINGW32__)
-      n+=StrcopyW(s+n,TEXTLEN-n,L"\n\nCompiled with MinGW32 ");
-    #else
-      n+=StrcopyW(s+n,TEXTLEN-n,L"\n\nCompiled with ");
-    #endif
-    #ifdef __cplusplus
-      StrcopyW(s+n,TEXTLEN-n,L"C++ compiler");
-    #else
-      StrcopyW(s+n,TEXTLEN-n,L"C compiler");
-    #endif
-    MessageBox(hwollymain,s,
-      L"DiffSnake plugin",MB_OK|MB_ICONINFORMATION);
-    // Suspendallthreads() and Resumeallthreads() must be paired, even if they
-    // are called in inverse order!
-    Suspendallthreads();
+    path[0]=L'\0';
+    if (Browsefilename(L"Export graph to Graphviz file",path,NULL,NULL,
+      L".dot",hwollymain,BRO_FILE|BRO_SAVE)==0)
+      return MENU_NOREDRAW;            // Cancelled
+    f=_wfopen(path,L"wb");
+    if (f==NULL) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to create %s",path);
+      return MENU_NOREDRAW; };
+    n=Writeedgesdot(f);
+    if (fclose(f)!=0) n=-1;
+    if (n<0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Error writing %s",path);
+    else
+      Addtolist(0,DRAW_NORMAL,L"DiffSnake: %i edges written to %s",n,path);
     return MENU_NOREDRAW;
   };
   return MENU_ABSENT;
 };
 
+// Menu function of Hit Trace Difference window, exports control flow graph of
+// new code in the memory block of the selected row. File with extension
+// .json gets JSON, any other Graphviz.
+static int MExportcfg(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int n,result;
+  u32 addr;
+  wchar_t path[MAXPATH];
+  t_cfg *pc;
+  FILE *f;
+  if (mode==MENU_VERIFY) {
+    if (diffstream.f!=NULL) return MENU_ABSENT;
+    return (Diffrowaddr(diffview.selected,&addr)!=0?MENU_ABSENT:MENU_NORMAL); }
+  else if (mode==MENU_EXECUTE) {
+    if (Diffrowaddr(diffview.selected,&addr)!=0)
+      return MENU_NOREDRAW;
+    pc=Getcfg(addr);
+    if (pc==NULL) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to build graph");
+      return MENU_NOREDRAW; };
+    Addtolist(pc->base,DRAW_NORMAL,L"DiffSnake: %i basic blocks and %i edges in new code of block %08X",
+      pc->nnode,pc->nedge,pc->base);
+    path[0]=L'\0';
+    if (Browsefilename(L"Export control flow graph (.dot or .json)",path,NULL,NULL,
+      L".dot",hwollymain,BRO_FILE|BRO_SAVE)==0)
+      return MENU_NOREDRAW;            // Cancelled
+    f=_wfopen(path,L"wb");
+    if (f==NULL) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to create %s",path);
+      return MENU_NOREDRAW; };
+    n=StrlenW(path,MAXPATH);
+    if (n>=5 && _wcsicmp(path+n-5,L".json")==0)
+      result=Writecfgjson(f,pc);
+    else
+      result=Writecfgdot(f,pc);
+    if (fclose(f)!=0) result=-1;
+    if (result!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Error writing %s",path);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
 
-// Menu function of Disassembler pane that deletes existing bookmark.
-static int MMarkTrace(t_table *pt,wchar_t *name,ulong index,int mode) {
-  wchar_t buffer[100];
-  uchar * codeline;
-  ulong codelinesize;
-
+// Menu function of main menu, ends the phase: records snapshot as event and
+// clears hit trace. If snapshot can't be recorded, marks are kept. OllyDbg
+// removes hit trace breakpoint on the first hit, so cleared code is traced
+// again only after hit trace is restarted.
+static int MEndphase(t_table *pt,wchar_t *name,ulong index,int mode) {
+  ulong count;
+  wchar_t s[SHORTNAME];
   if (mode==MENU_VERIFY)
     return MENU_NORMAL;                // Always available
   else if (mode==MENU_EXECUTE) {
-    ulong i,j,length, declength;
-    uchar cmd[MAXCMDSIZE],*decode;
-	t_disasm da;
-    t_reg *reg;
-	t_memory *pmem;
-    t_hitlist hitlistitem;
-	Deletesorteddatarange(&(hitlisttable.sorted),0,0xFFFFFFFF);
-	Deletesorteddatarange(&baselist,0,0xFFFFFFFF);
-	for ( i=0; i<memory.sorted.n; i++) {
-      pmem=(t_memory *)Getsortedbyindex(&memory.sorted,i);    // Get next memory block.
-	  if ((pmem->type & MEM_GAP)!=0)
-        continue;                        // Unallocated memory
-      // Check whether it contains executable code.
-      if ((pmem->type & (MEM_CODE|MEM_SFX))==0)
-        continue;                        // Not a code   	  
-	  // iterate through code
-      for ( j=pmem->base; j<=pmem->base +pmem->size; j++) {
-	    codeline = Finddecode(j,&codelinesize);
-		if (codeline)
-			if (((*codeline)&DEC_TRACED)==DEC_TRACED){
-				hitlistitem.index=j;
-                hitlistitem.size=1;
-                hitlistitem.type=0;
-                Addsorteddata(&baselist,&hitlistitem);
-			}
-		}
-	  }
-	return MENU_REDRAW;
-	}
+    Swprintf(s,L"Phase %lu",autoserial+1);
+    if (Autosnapshot(AUTO_PHASE,s)!=0)
+      return MENU_NOREDRAW;
+    count=Clearhittrace();
+    // Next phase starts from empty hit trace.
+    Snapfree(&autolast);
+    Addtolist(0,DRAW_NORMAL,L"DiffSnake: %s recorded, %lu hit trace marks cleared",s,count);
+    Flash(L"Restart hit trace to trace cleared code again");
+    Redrawcpudisasm();
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, shows baseline (index 0) or diff (index 1) as
+// hit trace.
+static int MPainttrace(t_table *pt,wchar_t *name,ulong index,int mode) {
+  t_snapshot *ps;
+  ps=(index==0?&basesnap:&diffsnap);
+  if (mode==MENU_VERIFY)
+    return (ps->nblock==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    if (Painttrace(ps)!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to save hit trace");
+    return MENU_REDRAW;
+  };
   return MENU_ABSENT;
 };
 
-static int MCompareTrace(t_table *pt,wchar_t *name,ulong index,int mode) {
-  wchar_t buffer[100];
-  uchar * codeline;
-  ulong codelinesize;
+// Menu function of main menu, shows snapshot file as hit trace, for example
+// result of set operations made by diffsnake-cli.
+static int MPaintfile(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int nmod,mainmod,result;
+  wchar_t path[MAXPATH];
+  t_covmodule *mod;
+  t_covstat st;
+  t_snapshot snap;
+  FILE *f;
+  if (mode==MENU_VERIFY)
+    return (module.sorted.n==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    path[0]=L'\0';
+    if (Browsefilename(L"Show coverage file as hit trace",path,NULL,NULL,
+      NULL,hwollymain,BRO_FILE)==0)
+      return MENU_NOREDRAW;            // Cancelled
+    f=_wfopen(path,L"rb");
+    if (f==NULL) {
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to open %s",path);
+      return MENU_NOREDRAW; };
+    mod=Getcovmodules(&nmod,&mainmod);
+    if (mod==NULL) {
+      fclose(f);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to import");
+      return MENU_NOREDRAW; };
+    Snapinit(&snap);
+    result=Covread(f,&snap,mod,nmod,mainmod,Cmdlength,&st);
+    fclose(f);
+    free(mod);
+    if (result!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Unable to import %s",path);
+    else if (Painttrace(&snap)!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to save hit trace");
+    else
+      Addtolist(0,DRAW_NORMAL,L"DiffSnake: %u commands from %s shown as hit trace",
+        snap.nhit,path);
+    Snapfree(&snap);
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, swaps shown snapshot and live hit trace.
+static int MSwaptrace(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY) {
+    if (swapstate==SWAP_NONE) return MENU_ABSENT;
+    return (swapstate==SWAP_SHOWN?MENU_CHECKED:MENU_NORMAL); }
+  else if (mode==MENU_EXECUTE) {
+    if (Swaptrace()!=0)
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to swap hit trace");
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, brings back live hit trace and forgets shown
+// snapshot. Hits made while snapshot was shown are kept.
+static int MRestoretrace(t_table *pt,wchar_t *name,ulong index,int mode) {
+  t_snapshot live;
+  if (mode==MENU_VERIFY)
+    return (swapstate==SWAP_NONE?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    if (swapstate==SWAP_SHOWN) {
+      Snapinit(&live);
+      if (Getlivetrace(&live)!=0) {
+        Snapfree(&live);
+        Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to restore hit trace");
+        return MENU_NOREDRAW; };
+      Writetrace(&live);
+      Snapfree(&live);
+      Redrawcpudisasm(); };
+    Snapfree(&swaptrace);
+    Snapfree(&painttrace);
+    swapstate=SWAP_NONE;
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
 
+// Menu function of main menu, switches shading of Disassembler by epoch.
+static int MEpochshade(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY)
+    return (epochshade?MENU_CHECKED:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    epochshade=!epochshade;
+    Writetoini(NULL,PLUGINNAME,L"Epoch shading",L"%i",epochshade);
+    Redrawcpudisasm();
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of main menu, opens Event Snapshots.
+static int MShowevents(t_table *pt,wchar_t *name,ulong index,int mode) {
   if (mode==MENU_VERIFY)
     return MENU_NORMAL;                // Always available
   else if (mode==MENU_EXECUTE) {
-    ulong i,j,length, declength;
-    uchar cmd[MAXCMDSIZE],*decode;
-	t_disasm da;
-    t_reg *reg;
-	void * result;
-	t_memory *pmem;
-    t_hitlist hitlistitem;
-    Deletesorteddatarange(&(hitlisttable.sorted),0,0xFFFFFFFF);
-	for ( i=0; i<memory.sorted.n; i++) {
-      pmem=(t_memory *)Getsortedbyindex(&memory.sorted,i);    // Get next memory block.
-	  if ((pmem->type & MEM_GAP)!=0)
-        continue;                        // Unallocated memory
-      // Check whether it contains executable code.
-      if ((pmem->type & (MEM_CODE|MEM_SFX))==0)
-        continue;                        // Not a code   	  
-	  // iterate through code
-      for ( j=pmem->base; j<=pmem->base +pmem->size; j++) {
-	    codeline = Finddecode(j,&codelinesize);
-		if (codeline)
-			if (((*codeline)&DEC_TRACED)==DEC_TRACED){
-				result = Findsorteddata(&baselist,j,0);
-				//Addtolist(result,DRAW_NORMAL,L"sorted");
-				if(!result){
-                  length=Readmemory(cmd,j,MAXCMDSIZE,MM_SILENT|MM_PARTIAL);
-                  if (length==0) Addtolist(j,DRAW_NORMAL,L"Readmemory returned zero!");
-                  decode=Finddecode(j,&declength);
-                  if (decode!=NULL && declength<length) 
-                     decode=NULL;
-                  length=Disasm(cmd,length,j,decode,&da,DA_TEXT|DA_OPCOMM|DA_MEMORY,NULL,NULL);
-                  if (length==0) Addtolist(j,DRAW_NORMAL,L"Disasm returned zero!");
-                  StrcopyW(hitlistitem.decodedinstruction,TEXTLEN,da.result);
-			      hitlistitem.index=j;
-                  hitlistitem.size=1;
-                  hitlistitem.type=0;
-                  Addsorteddata(&(hitlisttable.sorted),&hitlistitem);
-				}
-			}
-		}
-	  }
-	if (hitlisttable.hw==NULL){
-      // Create table window. Third parameter (ncolumn) is the number of
-      // visible columns in the newly created window (ignored if appearance is
-      // restored from the initialization file). If it's lower than the total
-      // number of columns, remaining columns are initially invisible. Fourth
-      // parameter is the name of icon - as OllyDbg resource.
-      Createtablewindow(&hitlisttable,0,hitlisttable.bar.nbar,NULL, L"ICO_PLUGIN",PLUGINNAME);
-	}
+    if (eventtable.hw==NULL)
+      Createtablewindow(&eventtable,0,eventtable.bar.nbar,NULL,L"ICO_PLUGIN",PLUGINNAME);
     else
-      Activatetablewindow(&hitlisttable);
-	return MENU_REDRAW;
-	}
+      Activatetablewindow(&eventtable);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Event Snapshots window, marks selected event as the start
+// of the diff.
+static int MMarkevent(t_table *pt,wchar_t *name,ulong index,int mode) {
+  t_eventrow *row;
+  row=(t_eventrow *)Getsortedbyselection(&pt->sorted,pt->sorted.selected);
+  if (mode==MENU_VERIFY)
+    return (row==NULL?MENU_ABSENT:(row->addr==autostart?MENU_CHECKED:MENU_NORMAL));
+  else if (mode==MENU_EXECUTE) {
+    autostart=(row->addr==autostart?0:row->addr);
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Event Snapshots window, shows instructions hit after the
+// marked event up to and including the selected one.
+static int MDiffevents(t_table *pt,wchar_t *name,ulong index,int mode) {
+  t_eventrow *row;
+  row=(t_eventrow *)Getsortedbyselection(&pt->sorted,pt->sorted.selected);
+  if (mode==MENU_VERIFY)
+    return (row==NULL || row->addr<=autostart?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    if (Autodiff(autostart,row->addr)!=0) {
+      Snapfree(&diffsnap);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to calculate diff"); };
+    Diffviewreset();
+    diffview.selected=(diffsnap.nhit>0?0:-1);
+    hitlisttable.offset=0;
+    Showdiffwindow();
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Event Snapshots window, shows instructions hit in the phase
+// that ends with the selected event, i.e. since the previous phase event.
+static int MShowphase(t_table *pt,wchar_t *name,ulong index,int mode) {
+  int i;
+  ulong first;
+  t_eventrow *row,*prev;
+  row=(t_eventrow *)Getsortedbyselection(&pt->sorted,pt->sorted.selected);
+  if (mode==MENU_VERIFY)
+    return (row==NULL || row->event!=AUTO_PHASE?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    first=0;
+    for (i=0; i<pt->sorted.n; i++) {
+      prev=(t_eventrow *)Getsortedbyindex(&pt->sorted,i);
+      if (prev->addr>=row->addr) break;
+      if (prev->event==AUTO_PHASE) first=prev->addr; };
+    if (Autodiff(first,row->addr)!=0) {
+      Snapfree(&diffsnap);
+      Addtolist(0,DRAW_HILITE,L"DiffSnake: Low memory, unable to calculate diff"); };
+    Diffviewreset();
+    diffview.selected=(diffsnap.nhit>0?0:-1);
+    hitlisttable.offset=0;
+    Showdiffwindow();
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Event Snapshots window, discards all events.
+static int MClearevents(t_table *pt,wchar_t *name,ulong index,int mode) {
+  if (mode==MENU_VERIFY)
+    return (autoserial==0?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    Autoreset();
+    return MENU_REDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+// Menu function of Run Trace Order and Execution Count Delta windows, follows
+// selected row in the CPU Disassembler.
+static int MFollowrow(t_table *pt,wchar_t *name,ulong index,int mode) {
+  t_sorthdr *row;
+  row=(t_sorthdr *)Getsortedbyselection(&pt->sorted,pt->sorted.selected);
+  if (mode==MENU_VERIFY)
+    return (row==NULL?MENU_ABSENT:MENU_NORMAL);
+  else if (mode==MENU_EXECUTE) {
+    Setcpu(0,row->addr,0,0,0,CPU_ASMHIST|CPU_ASMCENTER|CPU_ASMFOCUS);
+    return MENU_NOREDRAW;
+  };
+  return MENU_ABSENT;
+};
+
+#ifdef _DEBUG
+
+typedef struct t_oldrow {              // Row of the diff before Installrows()
+  ulong          addr;                 // Address of the command
+  ulong          size;                 // Always 1
+  ulong          type;                 // Always 0
+  wchar_t        text[TEXTLEN];        // Disassembled command
+} t_oldrow;
+
+// Menu function of main menu, available only in Debug builds. Measures how
+// long it takes to fill sorted data with 10k, 100k and 1M rows item by item
+// with Addsorteddata(), as DiffSnake did before with rows that kept the
+// disassembled text, and with a single call to Installrows() that adds bare
+// t_sorthdr rows, as now. Results are reported to the log window.
+static int MBenchmark(t_table *pt,wchar_t *name,ulong index,int mode) {
+  static int nrows[3] = { 10000, 100000, 1000000 };
+  int i,k;
+  ulong offset;
+  LARGE_INTEGER freq,t0,t1,t2,t3;
+  t_sorted sd;
+  t_sorthdr *row;
+  t_oldrow item;
+  if (mode==MENU_VERIFY)
+    return MENU_NORMAL;                // Always available
+  else if (mode==MENU_EXECUTE) {
+    QueryPerformanceFrequency(&freq);
+    StrcopyW(item.text,TEXTLEN,L"MOV EAX,DWORD PTR SS:[EBP+8]");
+    for (i=0; i<3; i++) {
+      if (Createsorteddata(&sd,sizeof(t_oldrow),10,NULL,NULL,0)!=0)
+        break;
+      // Old way: one Addsorteddata() per hit. Addresses grow, as in real scan.
+      QueryPerformanceCounter(&t0);
+      for (k=0; k<nrows[i]; k++) {
+        item.addr=0x00401000+k*3;
+        item.size=1;
+        item.type=0;
+        if (Addsorteddata(&sd,&item)==NULL) break; };
+      QueryPerformanceCounter(&t1);
+      Destroysorteddata(&sd);
+      if (k<nrows[i]) {
+        Addtolist(0,DRAW_HILITE,
+          L"DiffSnake: Addsorteddata failed after %i rows",k);
+        break; };
+      if (Createsorteddata(&sd,sizeof(t_sorthdr),10,NULL,NULL,0)!=0)
+        break;
+      // New way: rows are accumulated in arena and installed at once. Time
+      // includes accumulation.
+      QueryPerformanceCounter(&t2);
+      Arenareset(&hitarena);
+      for (k=0; k<nrows[i]; k++) {
+        offset=Arenaalloc(&hitarena,sizeof(t_sorthdr));
+        if (offset==ARENA_NULL) break;
+        row=(t_sorthdr *)Arenaptr(&hitarena,offset);
+        row->addr=0x00401000+k*3;
+        row->size=1;
+        row->type=0; };
+      Installrows(&sd,&hitarena,sizeof(t_sorthdr));
+      QueryPerformanceCounter(&t3);
+      Addtolist(0,DRAW_NORMAL,
+        L"DiffSnake: %i rows: Addsorteddata %i ms, Installrows %i ms",nrows[i],
+        (int)((t1.QuadPart-t0.QuadPart)*1000/freq.QuadPart),
+        (int)((t3.QuadPart-t2.QuadPart)*1000/freq.QuadPart));
+      Destroysorteddata(&sd);
+    };
+    Arenareset(&hitarena);
+    return MENU_NOREDRAW;
+  };
   return MENU_ABSENT;
 };
 
+#endif
+
 
 // Plugin menu that will appear in the main OllyDbg menu. Note that this menu
 // must be static and must be kept for the whole duration of the debugging
@@ -319,9 +3561,98 @@ static t_menu mainmenu[] = {
   { L"Take baseline",
        L"Make note of all the addresses that have been marked by the Hit Trace",
        K_NONE, MMarkTrace, NULL, 0 },
+  { L"Scan filter...",
+       L"Select modules and address ranges that are included in snapshots",
+       K_NONE, MScanfilter, NULL, 0 },
+  { L"Include executable memory",
+       L"Scan executable memory outside of modules and match it by contents",
+       K_NONE, MDynscan, NULL, 0 },
+  { L"Detect modified code",
+       L"Hash executed code pages at baseline and mark hits on changed pages",
+       K_NONE, MPagecheck, NULL, 0 },
   { L"Show Diff",
        L"Show all instructions that have been executed since last baseline",
        K_NONE, MCompareTrace, NULL, 0 },
+  { L"Stream diff to file...",
+       L"Write diff to file while it is calculated and page it into the table",
+       K_NONE, MStreamdiff, NULL, 0 },
+  { L"Stream disassembly too",
+       L"Also write streamed diff as text with disassembly",
+       K_NONE, MStreamtext, NULL, 0 },
+  { L"Show run trace order",
+       L"List new instructions from the run trace in the order of execution",
+       K_NONE, MRuntraceorder, NULL, 0 },
+  { L"Mark run trace",
+       L"Count executions in the run trace, later ones are compared to them",
+       K_NONE, MMarkruntrace, NULL, 0 },
+  { L"Show execution count delta",
+       L"List commands executed more or less often since the run trace mark",
+       K_NONE, MCountdelta, NULL, 0 },
+  { L"Show new calls and jumps",
+       L"List known jumps and calls from executed to new instructions",
+       K_NONE, MNewedges, NULL, 0 },
+  { L"|Snapshot on module load",
+       L"Take snapshot automatically when new module is loaded",
+       K_NONE, MAutoevent, NULL, AUTO_NEWMOD },
+  { L"Snapshot on module unload",
+       L"Take snapshot automatically when module is unloaded",
+       K_NONE, MAutoevent, NULL, AUTO_ENDMOD },
+  { L"Snapshot on pause",
+       L"Take snapshot automatically when application pauses (breakpoint, step)",
+       K_NONE, MAutoevent, NULL, AUTO_PAUSE },
+  { L"Snapshot on run",
+       L"Take snapshot automatically when execution continues",
+       K_NONE, MAutoevent, NULL, AUTO_RUN },
+  { L"Snapshot on exception",
+       L"Take snapshot automatically when application raises exception",
+       K_NONE, MAutoevent, NULL, AUTO_EXCEPTION },
+  { L"Timed snapshots...",
+       L"Take snapshot automatically every N seconds of run time",
+       K_NONE, MAutointerval, NULL, 0 },
+  { L"Shade by first event",
+       L"Shade addresses in Disassembler by the event that first hit them",
+       K_NONE, MEpochshade, NULL, 0 },
+  { L"Snapshot and clear",
+       L"Record hits of this phase as event and clear the hit trace",
+       K_NONE, MEndphase, NULL, 0 },
+  { L"Show event snapshots",
+       L"List snapshots taken on debug events",
+       K_NONE, MShowevents, NULL, 0 },
+  { L"|Show baseline as hit trace",
+       L"Replace hit trace marks with baseline, live marks are saved",
+       K_NONE, MPainttrace, NULL, 0 },
+  { L"Show diff as hit trace",
+       L"Replace hit trace marks with diff, live marks are saved",
+       K_NONE, MPainttrace, NULL, 1 },
+  { L"Show file as hit trace...",
+       L"Replace hit trace marks with snapshot or coverage file",
+       K_NONE, MPaintfile, NULL, 0 },
+  { L"Swap shown and live hit trace",
+       L"Exchange shown snapshot with saved live hit trace",
+       K_NONE, MSwaptrace, NULL, 0 },
+  { L"Restore live hit trace",
+       L"Bring back live hit trace and forget shown snapshot",
+       K_NONE, MRestoretrace, NULL, 0 },
+  { L"|Import baseline...",
+       L"Load baseline from snapshot, drcov log or list of addresses",
+       K_NONE, MImportbaseline, NULL, 0 },
+  { L"Save baseline...",
+       L"Save baseline to snapshot file",
+       K_NONE, MSavesnapshot, NULL, 0 },
+  { L"Save diff...",
+       L"Save new instructions to snapshot file",
+       K_NONE, MSavesnapshot, NULL, 1 },
+  { L"Export baseline to drcov...",
+       L"Write baseline as drcov log for coverage viewers",
+       K_NONE, MExportdrcov, NULL, 0 },
+  { L"Export diff to drcov...",
+       L"Write new instructions as drcov log for coverage viewers",
+       K_NONE, MExportdrcov, NULL, 1 },
+#ifdef _DEBUG
+  { L"|Benchmark table insertion",
+       L"Compare per-item and bulk insertion of 10k, 100k and 1M diff rows",
+       K_NONE, MBenchmark, NULL, 0 },
+#endif
   { L"|About",
        L"About Bookmarks plugin",
        K_NONE, Mabout, NULL, 0 },
@@ -333,11 +3664,54 @@ static t_menu disasmmenu[] = {
   // Menu items that set new bookmarks
   { L"Take baseline", L"Make note of all the addresses that have been marked by the Hit Trace", K_NONE, MMarkTrace, NULL, 0 },
   { L"Show Diff",     L"Show all instructions that have been executed since last baseline", K_NONE, MCompareTrace, NULL, 0 },
+  { L"Find in diff",  L"Select this command or the next new instruction in Hit Trace Difference", K_NONE, MFindindiff, NULL, 0 },
+  { L"|Which events hit this", L"List event snapshots that contain this command", K_NONE, MWhichevents, NULL, 0 },
+  { L"Same events only", L"Show commands contained in exactly the same event snapshots", K_NONE, MSameevents, NULL, 0 },
   // End of menu.
   { NULL, NULL, K_NONE, NULL, NULL, 0 }
 };
 
 
+// Popup menu of Hit Trace Difference window.
+static t_menu diffmenu[] = {
+  { L"Follow in Disassembler", L"Follow selected instruction in CPU Disassembler", K_FOLLOWDASM, MFollowdiff, NULL, 0 },
+  { L"|Go to row...",          L"Select N-th new instruction", K_NONE, MGotorow, NULL, 0 },
+  { L"Go to address...",       L"Select instruction at or after given address", K_GOTO, MGotoaddr, NULL, 0 },
+  { L"|Sort by instruction",   L"Sort new instructions by their text", K_NONE, MSortbytext, NULL, 0 },
+  { L"Show only this instruction", L"Hide rows with different instruction", K_NONE, MFilterbytext, NULL, 0 },
+  { L"Show all by address",    L"Remove sorting and filter", K_NONE, MShowall, NULL, 0 },
+  { L"|Attribute to threads",  L"Find threads that executed new instructions in the run trace", K_NONE, MAttributethreads, NULL, 0 },
+  { L"Show only this thread",  L"Hide rows not executed by the thread of this row", K_NONE, MFilterbythread, NULL, 0 },
+  { L"|Export control flow graph...", L"Write basic blocks of new code in this memory block as Graphviz or JSON", K_NONE, MExportcfg, NULL, 0 },
+  { NULL, NULL, K_NONE, NULL, NULL, 0 }
+};
+
+// Popup menu of Run Trace Order and Execution Count Delta windows.
+static t_menu ordermenu[] = {
+  { L"Follow in Disassembler", L"Follow selected instruction in CPU Disassembler", K_FOLLOWDASM, MFollowrow, NULL, 0 },
+  { NULL, NULL, K_NONE, NULL, NULL, 0 }
+};
+
+
+// Popup menu of Event Snapshots window.
+static t_menu eventmenu[] = {
+  { L"Start diff here",        L"Diff will include instructions hit after this event", K_NONE, MMarkevent, NULL, 0 },
+  { L"Show diff up to here",   L"Show instructions hit between start event and this one", K_NONE, MDiffevents, NULL, 0 },
+  { L"Show phase",             L"Show instructions hit since the previous phase end", K_NONE, MShowphase, NULL, 0 },
+  { L"|Clear all events",      L"Discard all event snapshots", K_NONE, MClearevents, NULL, 0 },
+  { NULL, NULL, K_NONE, NULL, NULL, 0 }
+};
+
+
+// Popup menu of New Calls and Jumps window.
+static t_menu edgemenu[] = {
+  { L"Follow source",          L"Follow jump or call in CPU Disassembler", K_FOLLOWDASM, MFollowedge, NULL, 0 },
+  { L"Follow destination",     L"Follow destination in CPU Disassembler", K_NONE, MFollowedge, NULL, 1 },
+  { L"|Export to Graphviz...", L"Write jumps and calls as graph in DOT language", K_NONE, MExportedges, NULL, 0 },
+  { NULL, NULL, K_NONE, NULL, NULL, 0 }
+};
+
+
 // Adds items either to main OllyDbg menu (type=PWM_MAIN) or to popup menu in
 // one of the standard OllyDbg windows, like PWM_DISASM or PWM_MEMORY. When
 // type matches, plugin should return address of menu. When there is no menu of
@@ -393,29 +3767,17 @@ extc int __cdecl ODBG2_Pluginquery(int ollydbgversion,ulong *features,
 // make one-time initializations and allocate resources. On error, it must
 // clean up and return -1. On success, it must return 0.
 extc int __cdecl ODBG2_Plugininit(void) {
-  // Data contains no resources, so destructor is
-  // not necessary. (Destructor is called each time data item is removed from
-  // the sorted data). 	
-	  // create list of hit addresses
-      if (Createsorteddata(
-                       &baselist,                // Descriptor of sorted data
-                       sizeof(t_hitlist),                // Size of single data item
-                       10,                                // Initial number of allocated items
-                       NULL,//(SORTFUNC *)Bookmarksortfunc,      // Sorting function
-                       NULL,//(DESTFUNC *)Bookmarkdestfunc,      // Data destructor
-                       0)!=0)                             // Simple data, no special options
-        return -1;
-	  // create list of differential hit addresses
-      if (Createsorteddata(
-                       &(hitlisttable.sorted),                // Descriptor of sorted data
-                       sizeof(t_hitlist),                // Size of single data item
-                       10,                                // Initial number of allocated items
-                       NULL,//(SORTFUNC *)Bookmarksortfunc,      // Sorting function
-                       NULL,//(DESTFUNC *)Bookmarkdestfunc,      // Data destructor
-                       0)!=0)                             // Simple data, no special options
-        return -1;
+  int i;
+  // Baseline and diff are bitmaps, memory is allocated when they are taken.
+      Snapinit(&basesnap);
+      Snapinit(&diffsnap);
+      Arenainit(&hitarena,65536);
+      Poolinit(&textpool);
+      diffview.selected=-1;
+      diffview.nvisible=1;
       wcscpy(hitlisttable.name,L"Hit Trace Difference");
-      hitlisttable.mode=TABLE_SAVEALL;
+      // Table is drawn by Hitlistdraw() line by line and has no sorted data.
+      hitlisttable.mode=TABLE_SAVEALL|TABLE_USERDEF;
       hitlisttable.bar.visible=1;
       hitlisttable.bar.name[0]=L"Address";
       hitlisttable.bar.expl[0]=L"Address of instruction";
@@ -425,24 +3787,328 @@ extc int __cdecl ODBG2_Plugininit(void) {
       hitlisttable.bar.expl[1]=L"Decoded Instruction";
       hitlisttable.bar.mode[1]=BAR_FLAT;
       hitlisttable.bar.defdx[1]=80;
-      hitlisttable.bar.nbar=2;
+      hitlisttable.bar.name[2]=L"Thread";
+      hitlisttable.bar.expl[2]=L"Thread that executed instruction in run trace";
+      hitlisttable.bar.mode[2]=BAR_FLAT;
+      hitlisttable.bar.defdx[2]=11;
+      hitlisttable.bar.name[3]=L"Code";
+      hitlisttable.bar.expl[3]=L"Code page was modified since baseline";
+      hitlisttable.bar.mode[3]=BAR_FLAT;
+      hitlisttable.bar.defdx[3]=9;
+      hitlisttable.bar.name[4]=L"Epoch";
+      hitlisttable.bar.expl[4]=L"First event snapshot that contained instruction";
+      hitlisttable.bar.mode[4]=BAR_FLAT;
+      hitlisttable.bar.defdx[4]=6;
+      hitlisttable.bar.nbar=5;
       hitlisttable.tabfunc=HitlistSelfunc;
       hitlisttable.custommode=0;
-      hitlisttable.customdata=NULL;
+      hitlisttable.customdata=&diffview;
       hitlisttable.updatefunc=NULL;
       hitlisttable.drawfunc=(DRAWFUNC *)Hitlistdraw;
       hitlisttable.tableselfunc=NULL;
-      hitlisttable.menu=NULL;
+      hitlisttable.menu=diffmenu;
+      // Run Trace Order keeps rows in sorted data and is drawn by OllyDbg.
+      Mapinit(&tracemap);
+      if (Createsorteddata(&ordertable.sorted,sizeof(t_orderrow),1024,
+        (SORTFUNC *)Ordersortfunc,NULL,0)!=0) {
+        Arenadestroy(&hitarena);
+        return -1; };
+      wcscpy(ordertable.name,L"Run Trace Order");
+      ordertable.mode=TABLE_SAVEALL;
+      ordertable.bar.visible=1;
+      ordertable.bar.name[0]=L"Index";
+      ordertable.bar.expl[0]=L"Run trace record of first execution";
+      ordertable.bar.mode[0]=BAR_SORT;
+      ordertable.bar.defdx[0]=9;
+      ordertable.bar.name[1]=L"Address";
+      ordertable.bar.expl[1]=L"Address of instruction";
+      ordertable.bar.mode[1]=BAR_SORT;
+      ordertable.bar.defdx[1]=9;
+      ordertable.bar.name[2]=L"Thread";
+      ordertable.bar.expl[2]=L"Thread that executed instruction first";
+      ordertable.bar.mode[2]=BAR_SORT;
+      ordertable.bar.defdx[2]=9;
+      ordertable.bar.name[3]=L"Instruction";
+      ordertable.bar.expl[3]=L"Decoded Instruction";
+      ordertable.bar.mode[3]=BAR_FLAT;
+      ordertable.bar.defdx[3]=80;
+      ordertable.bar.nbar=4;
+      ordertable.tabfunc=Rowselfunc;
+      ordertable.custommode=0;
+      ordertable.customdata=NULL;
+      ordertable.updatefunc=NULL;
+      ordertable.drawfunc=(DRAWFUNC *)Orderdraw;
+      ordertable.tableselfunc=NULL;
+      ordertable.menu=ordermenu;
+      // Execution Count Delta is sorted by growth of execution count.
+      Mapinit(&markcount);
+      Snapinit(&swaptrace);
+      Snapinit(&painttrace);
+      swapstate=SWAP_NONE;
+      Mapinit(&epochmap);
+      Mapinit(&eventindex);
+      Mapinit(&sigstep);
+      Poolinit(&sigpool);
+      Indexreset();
+      epochshade=0;
+      Getfromini(NULL,PLUGINNAME,L"Epoch shading",L"%i",&epochshade);
+      Mapinit(&basepages);
+      Mapinit(&changedpages);
+      streampath[0]=L'\0';
+      streamtext=0;
+      Getfromini(NULL,PLUGINNAME,L"Stream text",L"%i",&streamtext);
+      markrecords=-1;
+      if (Createsorteddata(&counttable.sorted,sizeof(t_countrow),1024,
+        (SORTFUNC *)Countsortfunc,NULL,0)!=0) {
+        Destroysorteddata(&ordertable.sorted);
+        Arenadestroy(&hitarena);
+        return -1; };
+      wcscpy(counttable.name,L"Execution Count Delta");
+      counttable.mode=TABLE_SAVEALL;
+      counttable.bar.visible=1;
+      counttable.bar.name[0]=L"Delta";
+      counttable.bar.expl[0]=L"Change of execution count";
+      counttable.bar.mode[0]=BAR_SORT;
+      counttable.bar.defdx[0]=9;
+      counttable.bar.name[1]=L"Address";
+      counttable.bar.expl[1]=L"Address of instruction";
+      counttable.bar.mode[1]=BAR_SORT;
+      counttable.bar.defdx[1]=9;
+      counttable.bar.name[2]=L"Before";
+      counttable.bar.expl[2]=L"Executions before run trace mark";
+      counttable.bar.mode[2]=BAR_SORT;
+      counttable.bar.defdx[2]=9;
+      counttable.bar.name[3]=L"After";
+      counttable.bar.expl[3]=L"Executions after run trace mark";
+      counttable.bar.mode[3]=BAR_SORT;
+      counttable.bar.defdx[3]=9;
+      counttable.bar.name[4]=L"Instruction";
+      counttable.bar.expl[4]=L"Decoded Instruction";
+      counttable.bar.mode[4]=BAR_FLAT;
+      counttable.bar.defdx[4]=80;
+      counttable.bar.nbar=5;
+      counttable.tabfunc=Rowselfunc;
+      counttable.custommode=0;
+      counttable.customdata=NULL;
+      counttable.updatefunc=NULL;
+      counttable.drawfunc=(DRAWFUNC *)Countdraw;
+      counttable.tableselfunc=NULL;
+      counttable.menu=ordermenu;
+      // New Calls and Jumps is filled from the jump tables of modules.
+      if (Createsorteddata(&edgetable.sorted,sizeof(t_edgerow),256,
+        (SORTFUNC *)Edgesortfunc,NULL,0)!=0) {
+        Destroysorteddata(&counttable.sorted);
+        Destroysorteddata(&ordertable.sorted);
+        Arenadestroy(&hitarena);
+        return -1; };
+      wcscpy(edgetable.name,L"New Calls and Jumps");
+      edgetable.mode=TABLE_SAVEALL;
+      edgetable.bar.visible=1;
+      edgetable.bar.name[0]=L"Source";
+      edgetable.bar.expl[0]=L"Address of jump or call";
+      edgetable.bar.mode[0]=BAR_SORT;
+      edgetable.bar.defdx[0]=9;
+      edgetable.bar.name[1]=L"Destination";
+      edgetable.bar.expl[1]=L"Address of new instruction";
+      edgetable.bar.mode[1]=BAR_SORT;
+      edgetable.bar.defdx[1]=9;
+      edgetable.bar.name[2]=L"Type";
+      edgetable.bar.expl[2]=L"Type of jump";
+      edgetable.bar.mode[2]=BAR_SORT;
+      edgetable.bar.defdx[2]=12;
+      edgetable.bar.name[3]=L"Caller";
+      edgetable.bar.expl[3]=L"Symbolic source";
+      edgetable.bar.mode[3]=BAR_FLAT;
+      edgetable.bar.defdx[3]=32;
+      edgetable.bar.name[4]=L"Callee";
+      edgetable.bar.expl[4]=L"Symbolic destination";
+      edgetable.bar.mode[4]=BAR_FLAT;
+      edgetable.bar.defdx[4]=32;
+      edgetable.bar.nbar=5;
+      edgetable.tabfunc=NULL;
+      edgetable.custommode=0;
+      edgetable.customdata=NULL;
+      edgetable.updatefunc=NULL;
+      edgetable.drawfunc=(DRAWFUNC *)Edgedraw;
+      edgetable.tableselfunc=NULL;
+      edgetable.menu=edgemenu;
+      // Event Snapshots lists events in the ring, snapshots are kept aside.
+      Snapinit(&autolast);
+      for (i=0; i<NAUTOSNAP; i++)
+        Snapinit(&autoring[i].delta);
+      automask=0;
+      Getfromini(NULL,PLUGINNAME,L"Snapshot events",L"%i",&automask);
+      autointerval=0;
+      Getfromini(NULL,PLUGINNAME,L"Snapshot interval",L"%i",&autointerval);
+      nexttimer=autointerval*1000;
+      // Scan filter is kept as entered, bad filter is ignored.
+      filtertext[0]=L'\0';
+      Stringfromini(PLUGINNAME,L"Scan filter",filtertext,TEXTLEN);
+      if (Parsefilter(filtertext)!=0)
+        filtertext[0]=L'\0';
+      dynscan=0;
+      Getfromini(NULL,PLUGINNAME,L"Executable memory",L"%i",&dynscan);
+      pagecheck=0;
+      Getfromini(NULL,PLUGINNAME,L"Page hashes",L"%i",&pagecheck);
+      if (Createsorteddata(&eventtable.sorted,sizeof(t_eventrow),NAUTOSNAP,
+        NULL,NULL,0)!=0) {
+        Destroysorteddata(&edgetable.sorted);
+        Destroysorteddata(&counttable.sorted);
+        Destroysorteddata(&ordertable.sorted);
+        Arenadestroy(&hitarena);
+        return -1; };
+      wcscpy(eventtable.name,L"Event Snapshots");
+      eventtable.mode=TABLE_SAVEALL;
+      eventtable.bar.visible=1;
+      eventtable.bar.name[0]=L"Event";
+      eventtable.bar.expl[0]=L"Number of event";
+      eventtable.bar.mode[0]=BAR_FLAT;
+      eventtable.bar.defdx[0]=6;
+      eventtable.bar.name[1]=L"Type";
+      eventtable.bar.expl[1]=L"Debug event that triggered snapshot";
+      eventtable.bar.mode[1]=BAR_FLAT;
+      eventtable.bar.defdx[1]=16;
+      eventtable.bar.name[2]=L"Run time";
+      eventtable.bar.expl[2]=L"Seconds of run time at the moment of event";
+      eventtable.bar.mode[2]=BAR_FLAT;
+      eventtable.bar.defdx[2]=10;
+      eventtable.bar.name[3]=L"EIP";
+      eventtable.bar.expl[3]=L"EIP at the moment of event";
+      eventtable.bar.mode[3]=BAR_FLAT;
+      eventtable.bar.defdx[3]=9;
+      eventtable.bar.name[4]=L"New hits";
+      eventtable.bar.expl[4]=L"Instructions hit since the previous event";
+      eventtable.bar.mode[4]=BAR_FLAT;
+      eventtable.bar.defdx[4]=9;
+      eventtable.bar.name[5]=L"Timeline";
+      eventtable.bar.expl[5]=L"New hits relative to the largest interval";
+      eventtable.bar.mode[5]=BAR_FLAT;
+      eventtable.bar.defdx[5]=TIMELINEBAR+1;
+      eventtable.bar.name[6]=L"Details";
+      eventtable.bar.expl[6]=L"Module or exception";
+      eventtable.bar.mode[6]=BAR_FLAT;
+      eventtable.bar.defdx[6]=40;
+      eventtable.bar.nbar=7;
+      eventtable.tabfunc=NULL;
+      eventtable.custommode=0;
+      eventtable.customdata=NULL;
+      eventtable.updatefunc=NULL;
+      eventtable.drawfunc=(DRAWFUNC *)Eventdraw;
+      eventtable.tableselfunc=NULL;
+      eventtable.menu=eventmenu;
 
   // Report success.
   return 0;
 };
 
+// Optional entry, called each time OllyDbg passes main Windows loop. When
+// debugged application is running, function is called repeatedly, and it is
+// used here to count run time and to take timed snapshots. Function must be
+// fast, so it does nothing but compare tick counts if timer is not due.
+extc void __cdecl ODBG2_Pluginmainloop(DEBUG_EVENT *debugevent) {
+  ulong tick;
+  tick=GetTickCount();
+  if (run.status>=STAT_RUNNING && run.status<=STAT_TILLUSER)
+    runtime+=tick-runtick;             // Running, stepping or tracing
+  runtick=tick;
+  if (autointerval!=0 && runtime>=nexttimer) {
+    nexttimer=runtime+autointerval*1000;
+    Autosnapshot(AUTO_TIMER,NULL); };
+};
+
+// Optional entry, notifies plugin on relatively infrequent events. Here it
+// takes event snapshots. Module is reported by PN_NEWMOD when it is already
+// in the table, and by PN_ENDMOD before it is removed, so that in both cases
+// its code is part of the snapshot. PN_STATUS is sent on every change of
+// status, snapshot is taken only when application becomes paused.
+extc void __cdecl ODBG2_Pluginnotify(int code,void *data,ulong parm1,ulong parm2) {
+  t_module *pmod;
+  switch (code) {
+    case PN_NEWMOD:                    // New module is added to the table
+    case PN_ENDMOD:                    // Module is removed from the memory
+      if ((automask & (code==PN_NEWMOD?AUTO_NEWMOD:AUTO_ENDMOD))==0) break;
+      pmod=(t_module *)data;
+      Autosnapshot(code==PN_NEWMOD?AUTO_NEWMOD:AUTO_ENDMOD,
+        (pmod==NULL?NULL:pmod->modname));
+      break;
+    case PN_STATUS:                    // Execution status has changed
+      if ((automask & AUTO_PAUSE)!=0 && run.status==STAT_PAUSED &&
+        autostatus!=STAT_PAUSED)
+        Autosnapshot(AUTO_PAUSE,NULL);
+      autostatus=run.status;
+      break;
+    case PN_RUN:                       // User continues code execution
+      if ((automask & AUTO_RUN)!=0)
+        Autosnapshot(AUTO_RUN,NULL);
+      break;
+    default: break;
+  };
+};
+
+// Optional entry, called when application raises exception. Takes event
+// snapshot and leaves exception to OllyDbg.
+extc int __cdecl ODBG2_Pluginexception(t_run *prun,const t_disasm *da,
+  t_thread *pthr,t_reg *preg,wchar_t *message) {
+  wchar_t s[SHORTNAME];
+  if ((automask & AUTO_EXCEPTION)!=0) {
+    Swprintf(s,L"%08X",prun->de.u.Exception.ExceptionRecord.ExceptionCode);
+    Autosnapshot(AUTO_EXCEPTION,s); };
+  return PE_IGNORED;
+};
+
 // Function is called when user opens new or restarts current application.
 // Plugin should reset internal variables and data structures to the initial
 // state.
 extc void __cdecl ODBG2_Pluginreset(void) {
-  Deletesorteddatarange(&(hitlisttable.sorted),0,0xFFFFFFFF);
+  Snapfree(&diffsnap);
+  Diffviewreset();
+  diffview.selected=-1;
+  hitlisttable.offset=0;
+  Deletesorteddatarange(&ordertable.sorted,0,0xFFFFFFFF);
+  Deletesorteddatarange(&counttable.sorted,0,0xFFFFFFFF);
+  Deletesorteddatarange(&edgetable.sorted,0,0xFFFFFFFF);
+  Mapreset(&markcount);
+  markrecords=-1;
+  liveregion.n=0;
+  Mapreset(&changedpages);
+  Snapfree(&swaptrace);                // Decoding is gone with the process
+  Snapfree(&painttrace);
+  swapstate=SWAP_NONE;
+  Autoreset();
+  Arenareset(&hitarena);
+};
+
+// OllyDbg calls this optional function once on exit. At this moment, all MDI
+// windows created by plugin are already destroyed (and received WM_DESTROY
+// messages). Function must free all internally allocated resources, like
+// window classes, files, memory etc.
+extc void __cdecl ODBG2_Plugindestroy(void) {
+  int i;
+  Snapfree(&basesnap);
+  Snapfree(&diffsnap);
+  Diffviewreset();
+  Poolfree(&textpool);
+  Destroysorteddata(&ordertable.sorted);
+  Destroysorteddata(&counttable.sorted);
+  Destroysorteddata(&edgetable.sorted);
+  for (i=0; i<NCFGCACHE; i++)
+    Freecfg(cfgcache+i);
+  Mapfree(&tracemap);
+  Mapfree(&markcount);
+  Freeregions(&liveregion);
+  Freeregions(&scanregion);
+  Freeregions(&baseregion);
+  Snapfree(&swaptrace);
+  Snapfree(&painttrace);
+  Mapfree(&epochmap);
+  Mapfree(&eventindex);
+  Mapfree(&sigstep);
+  Poolfree(&sigpool);
+  Mapfree(&basepages);
+  Mapfree(&changedpages);
+  Autoreset();
+  Destroysorteddata(&eventtable.sorted);
+  Arenadestroy(&hitarena);
 };
 
 
@@ -472,13 +4138,12 @@ extc void __cdecl ODBG2_Pluginreset(void) {
 // impair the responsiveness of the OllyDbg. Always make it switchable with
 // default set to OFF!
 extc int _export cdecl ODBG2_Plugindump(t_dump *pd, wchar_t *s,uchar *mask,int n,int *select,ulong addr,int column) {
-  int i=0;
-  wchar_t w[TEXTLEN];
-  void * result;
+  int i=0,shade,color;
+  u32 epoch;
   if (column==DF_FILLCACHE) {
-    // Check if there are any trace diffs to annotate at all
-    if (hitlisttable.sorted.n==0)
-      return 0;                        // empty diff means no annotations to do
+    // Check if there are any trace diffs or epochs to annotate at all
+    if (Diffhits()==0 && (epochshade==0 || epochmap.nkey==0))
+      return 0;                        // Nothing to annotate
     // Check whether it's Disassembler pane of the CPU window.
     if (pd==NULL || (pd->menutype & DMT_CPUMASK)!=DMT_CPUDASM)
       return 0;                        // Not a Disassembler
@@ -490,11 +4155,26 @@ extc int _export cdecl ODBG2_Plugindump(t_dump *pd, wchar_t *s,uchar *mask,int n
       return 0;                        // Invalid dump type
     // if we got to here return 1 to indicate that we want to annotate the second column
     return 1; }                        // No bookmarks to display
+  else if (column==0) {
+    // Address is shaded by epoch: hits of the last events are highlighted,
+    // of the oldest grayed.
+    if (epochshade==0 || autoserial==0)
+      return n;
+    epoch=Getepoch(addr);
+    if (epoch==0)
+      return n;                        // Not hit by any event
+    shade=(int)((autoserial-epoch)*NSHADE/autoserial);
+    color=(shade==0?DRAW_HILITE:(shade==1?DRAW_NORMAL:DRAW_GRAY));
+    if ((*select & DRAW_MASK)==0) {
+      memset(mask,DRAW_NORMAL,n);
+      *select|=DRAW_MASK; };
+    for (i=0; i<n; i++)
+      mask[i]=(uchar)((mask[i] & ~DRAW_COLOR)|color);
+  }
   else if (column==2) {
     // Check whether there is a bookmark. Note that there may be several marks
     // on the same address!
-    result = Findsorteddata(&(hitlisttable.sorted),addr,0);
-    if (result==0)
+    if (Difftest(addr)==0)
       return n;                        // No diff hits on address
     // Skip graphical symbols (loop brackets).(count number of graphical symbols at beginning of line
     for (i=0; i<n; i++) {
@@ -0,0 +1,324 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                       DiffSnake CORE SELF-CHECK                            //
+//                                                                            //
+// Checks of the portable core on Linux: rank and select, round-trips of      //
+// native files and of the snapshot store, and the diff stream codec. Each    //
+// check compares results with a plain sorted list of hit addresses. Run by   //
+// 'make check', returns 0 if all checks pass.                                //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapcore.h"
+#include "covfile.h"
+
+#define MAXREF         262144          // Max hits in reference list
+
+typedef struct t_refset {              // Reference list of hit addresses
+  u32            *addr;                // Addresses in ascending order
+  u32            n;                    // Number of addresses
+} t_refset;
+
+static u32       seed=12345;           // State of pseudorandom generator
+static int       nfail;                // Number of failed checks
+
+// Reports failed check.
+static void Fail(const char *what,u32 value) {
+  printf("FAIL: %s (%08X)\n",what,value);
+  nfail++;
+};
+
+// Returns next pseudorandom number.
+static u32 Random(void) {
+  seed=seed*1103515245u+12345u;
+  return seed>>8;
+};
+
+// Fills block with hits, one of density bytes on average, and appends them
+// to the reference list.
+static void Fillblock(t_hitblock *pb,u32 density,t_refset *pr) {
+  u32 i;
+  for (i=0; i<pb->size; i++) {
+    if (Random()%density!=0 || pr->n>=MAXREF) continue;
+    Setbit(pb,i);
+    pr->addr[pr->n++]=pb->base+i;
+  };
+};
+
+// Builds test snapshot: a short block, a block long enough for several select
+// samples, a block with the last bits of the last word unused, and a block at
+// the very end of the address space. Returns 0 on success and -1 on error.
+static int Buildsnap(t_snapshot *ps,t_refset *pr,u32 density) {
+  static const u32 layout[4][2] = {
+    { 0x00401000, 0x3000 },
+    { 0x10000000, 0x60000 },
+    { 0x20000000, 0x1235 },
+    { 0xFFFF0000, 0xFFFF } };
+  int i;
+  t_hitblock *pb;
+  Snapinit(ps);
+  pr->n=0;
+  for (i=0; i<4; i++) {
+    pb=Snapaddblock(ps,layout[i][0],layout[i][1]);
+    if (pb==NULL)
+      return -1;
+    Fillblock(pb,density+(u32)i*3,pr);
+  };
+  return Snapbuildrank(ps);
+};
+
+// Checks that snapshot contains exactly the addresses in the reference list.
+static void Checksame(const char *what,const t_snapshot *ps,const t_refset *pr) {
+  u32 i,addr;
+  t_snapiter it;
+  if (ps->nhit!=pr->n) {
+    Fail(what,ps->nhit); return; };
+  Snapiterinit(&it,ps,0,0xFFFFFFFF);
+  for (i=0; i<pr->n; i++) {
+    if (Snapiternext(&it,&addr)==0 || addr!=pr->addr[i]) {
+      Fail(what,pr->addr[i]); return; };
+  };
+  if (Snapiternext(&it,&addr)!=0)
+    Fail(what,addr);
+  return;
+};
+
+// Checks Snaprank(), Snapselect() and Snaptest() against the reference list.
+static void Checkrank(const t_snapshot *ps,const t_refset *pr) {
+  u32 i,addr;
+  Checksame("iterator",ps,pr);
+  if (Snaprank(ps,0)!=0 || Snaprank(ps,0xFFFFFFFF)!=pr->n)
+    Fail("rank of limits",pr->n);
+  for (i=0; i<pr->n; i++) {
+    addr=pr->addr[i];
+    if (Snaprank(ps,addr)!=i || Snaprank(ps,addr+1)!=i+1) {
+      Fail("rank",addr); break; };
+    if (Snapselect(ps,i,&addr)!=0 || addr!=pr->addr[i]) {
+      Fail("select",pr->addr[i]); break; };
+    if (Snaptest(ps,addr)==0 ||
+      (i+1<pr->n && pr->addr[i+1]!=addr+1 && Snaptest(ps,addr+1)!=0)) {
+      Fail("test",addr); break; };
+  };
+  if (Snapselect(ps,pr->n,&addr)==0)
+    Fail("select beyond the last hit",pr->n);
+  return;
+};
+
+// Checks that module table survived round-trip.
+static void Checkmodules(const char *what,const t_covmodule *mod,int nmod,
+  const t_covmodule *ref,int nref) {
+  int i;
+  if (mod==NULL || nmod!=nref) {
+    Fail(what,(u32)nmod); return; };
+  for (i=0; i<nmod; i++) {
+    if (mod[i].base!=ref[i].base || mod[i].size!=ref[i].size ||
+      mod[i].entry!=ref[i].entry || strcmp(mod[i].path,ref[i].path)!=0) {
+      Fail(what,ref[i].base); return; };
+  };
+  return;
+};
+
+// Writes snapshot in native format and reads it back with Covreadnative() and
+// Covmapnative().
+static void Checknative(const t_snapshot *ps,const t_refset *pr,
+  const t_covmodule *ref,int nref) {
+  int nmod;
+  long size;
+  u8 *image;
+  FILE *f;
+  t_snapshot snap;
+  t_covmodule *mod;
+  f=tmpfile();
+  if (f==NULL || Covwritenative(f,ps,ref,nref)!=0) {
+    Fail("write native",0);
+    if (f!=NULL) fclose(f);
+    return; };
+  rewind(f);
+  Snapinit(&snap); mod=NULL; nmod=0;
+  if (Covreadnative(f,&snap,&mod,&nmod)!=0 || Snapbuildrank(&snap)!=0)
+    Fail("read native",0);
+  else {
+    Checksame("native read",&snap,pr);
+    Checkmodules("native modules",mod,nmod,ref,nref); };
+  Snapfree(&snap);
+  if (mod!=NULL) free(mod);
+  // Same file mapped in place.
+  fseek(f,0,SEEK_END);
+  size=ftell(f);
+  rewind(f);
+  image=(u8 *)malloc(size>0?(size_t)size:1);
+  if (image==NULL || fread(image,1,(size_t)size,f)!=(size_t)size)
+    Fail("load native",(u32)size);
+  else {
+    Snapinit(&snap); mod=NULL; nmod=0;
+    if (Covmapnative(image,(u32)size,&snap,&mod,&nmod)!=0 ||
+      Snapbuildrank(&snap)!=0)
+      Fail("map native",0);
+    else {
+      Checksame("native map",&snap,pr);
+      Checkmodules("mapped modules",mod,nmod,ref,nref); };
+    Snapfree(&snap);
+    if (mod!=NULL) free(mod);
+    // Truncated image must be rejected.
+    Snapinit(&snap); mod=NULL;
+    if (Covmapnative(image,(u32)size-4,&snap,&mod,&nmod)==0)
+      Fail("truncated native accepted",(u32)size-4);
+    Snapfree(&snap);
+    if (mod!=NULL) free(mod);
+  };
+  if (image!=NULL) free(image);
+  fclose(f);
+  return;
+};
+
+// Builds reference list of a-b.
+static void Refandnot(t_refset *dest,const t_refset *a,const t_refset *b) {
+  u32 i,j;
+  dest->n=0;
+  for (i=j=0; i<a->n; i++) {
+    while (j<b->n && b->addr[j]<a->addr[i]) j++;
+    if (j<b->n && b->addr[j]==a->addr[i]) continue;
+    dest->addr[dest->n++]=a->addr[i];
+  };
+  return;
+};
+
+// Adds two snapshots with the same layout to the new store, reopens it and
+// checks loaded snapshots and their difference.
+static void Checkstore(const t_snapshot *a,const t_refset *ra,
+  const t_snapshot *b,const t_refset *rb,
+  const t_covmodule *ref,int nref) {
+  int fd,ia,ib,nmod;
+  u32 nnew,nskip;
+  char path[32];
+  t_store store;
+  t_snapshot snap;
+  t_covmodule *mod;
+  t_refset diff;
+  strcpy(path,"/tmp/dsnapXXXXXX");
+  fd=mkstemp(path);
+  if (fd<0) {
+    Fail("temporary store",0); return; };
+  close(fd);
+  remove(path);                        // Store must be created from scratch
+  if (Storeopen(&store,path,1)!=0) {
+    Fail("create store",0); return; };
+  ia=Storeadd(&store,"a",a,ref,nref,&nnew);
+  ib=Storeadd(&store,"b",b,ref,nref,&nnew);
+  if (ia!=0 || ib!=1)
+    Fail("add to store",(u32)ib);
+  // Adding the same snapshot again must not write new chunks.
+  if (Storeadd(&store,"a again",a,ref,nref,&nnew)!=2 || nnew!=0)
+    Fail("deduplicate chunks",nnew);
+  Storeclose(&store);
+  if (Storeopen(&store,path,0)!=0) {
+    Fail("reopen store",0); remove(path); return; };
+  if (store.nsnap!=3 || Storefind(&store,"b")!=1)
+    Fail("find in store",(u32)store.nsnap);
+  Snapinit(&snap); mod=NULL; nmod=0;
+  if (Storeload(&store,ia,&snap,&mod,&nmod)!=0)
+    Fail("load from store",0);
+  else {
+    Checksame("store load",&snap,ra);
+    Checkmodules("store modules",mod,nmod,ref,nref); };
+  Snapfree(&snap);
+  if (mod!=NULL) free(mod);
+  diff.addr=(u32 *)malloc(MAXREF*sizeof(u32));
+  if (diff.addr!=NULL) {
+    Refandnot(&diff,ra,rb);
+    Snapinit(&snap); mod=NULL;
+    if (Storediff(&store,ia,ib,&snap,&mod,&nmod,&nskip)!=0)
+      Fail("diff in store",0);
+    else
+      Checksame("store diff",&snap,&diff);
+    Snapfree(&snap);
+    if (mod!=NULL) free(mod);
+    // Snapshot minus itself is empty, and all chunks cancel out unread.
+    diff.n=0;
+    Snapinit(&snap); mod=NULL;
+    if (Storediff(&store,ia,2,&snap,&mod,&nmod,&nskip)!=0 || nskip==0)
+      Fail("diff of equal snapshots",nskip);
+    else
+      Checksame("empty diff",&snap,&diff);
+    Snapfree(&snap);
+    if (mod!=NULL) free(mod);
+    free(diff.addr); };
+  Storeclose(&store);
+  remove(path);
+  return;
+};
+
+// Streams reference list and reads it back by rows and by addresses.
+static void Checkstream(const t_refset *pr) {
+  u32 i,row,addr;
+  FILE *f;
+  t_diffstream stream;
+  f=tmpfile();
+  if (f==NULL || Streamcreate(&stream,f)!=0) {
+    Fail("create stream",0); return; };
+  for (i=0; i<pr->n; i++) {
+    if (Streamput(&stream,pr->addr[i])!=0) {
+      Fail("put to stream",pr->addr[i]); break; };
+  };
+  if (Streamfinish(&stream)!=0 || stream.nhit!=pr->n)
+    Fail("finish stream",stream.nhit);
+  else {
+    for (i=0; i<pr->n; i++) {
+      if (Streamget(&stream,i,&addr)!=0 || addr!=pr->addr[i]) {
+        Fail("get from stream",pr->addr[i]); break; };
+    };
+    if (Streamget(&stream,pr->n,&addr)==0)
+      Fail("get beyond the end of stream",pr->n);
+    // Search, in random order to defeat the decoded page.
+    for (i=0; i<4096 && pr->n>0; i++) {
+      row=Random()%pr->n;
+      if (Streamfind(&stream,pr->addr[row])!=row ||
+        (row>0 && pr->addr[row-1]+1<pr->addr[row] &&
+        Streamfind(&stream,pr->addr[row-1]+1)!=row)) {
+        Fail("find in stream",pr->addr[row]); break; };
+    };
+    if (Streamfind(&stream,0)!=0 ||
+      (pr->n>0 && Streamfind(&stream,pr->addr[pr->n-1]+1)!=pr->n))
+      Fail("find limits in stream",pr->n);
+  };
+  Streamfree(&stream);
+  return;
+};
+
+int main(void) {
+  static t_covmodule ref[2];
+  t_snapshot a,b;
+  t_refset ra,rb,empty;
+  ra.addr=(u32 *)malloc(MAXREF*sizeof(u32));
+  rb.addr=(u32 *)malloc(MAXREF*sizeof(u32));
+  if (ra.addr==NULL || rb.addr==NULL) {
+    printf("Low memory\n"); return 1; };
+  ref[0].base=0x00400000; ref[0].size=0x8000; ref[0].entry=0x00401000;
+  strcpy(ref[0].path,"C:\\Program Files\\Test\\test.exe");
+  ref[1].base=0x10000000; ref[1].size=0x60000;
+  strcpy(ref[1].path,"C:\\Windows\\system32\\test.dll");
+  if (Buildsnap(&a,&ra,3)!=0 || Buildsnap(&b,&rb,5)!=0) {
+    printf("Low memory\n"); return 1; };
+  Checkrank(&a,&ra);
+  Checkrank(&b,&rb);
+  Checknative(&a,&ra,ref,2);
+  Checkstore(&a,&ra,&b,&rb,ref,2);
+  Checkstream(&ra);
+  empty.addr=NULL; empty.n=0;
+  Checkstream(&empty);
+  Snapfree(&a);
+  Snapfree(&b);
+  free(ra.addr);
+  free(rb.addr);
+  if (nfail!=0) {
+    printf("%i check(s) failed\n",nfail); return 1; };
+  printf("All checks passed\n");
+  return 0;
+};
@@ -0,0 +1,965 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                      DiffSnake COMMAND-LINE TOOL                           //
+//                                                                            //
+// Offline processing of saved snapshots on Linux, without debugger. Uses the //
+// same portable core as the plugin. Snapshot files are mapped into memory    //
+// and their bits are used in place; work is split between all processors by  //
+// ranges of addresses.                                                       //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapcore.h"
+#include "covfile.h"
+
+#define CHUNKWORDS     16384           // Words of bitmap per parallel task
+#define MAXRPN         256             // Max length of compiled expression
+#define MAXPLANE       32              // Max bit planes of frequency counter
+
+#define OP_OR          (-1)            // Union
+#define OP_AND         (-2)            // Intersection
+#define OP_ANDNOT      (-3)            // Difference
+#define OP_XOR         (-4)            // Symmetric difference
+
+typedef struct t_snapfile {            // Snapshot file mapped into memory
+  const char     *name;                // Name of the file
+  u8             *image;               // Mapped file or NULL
+  size_t         size;                 // Size of the file, bytes
+  t_snapshot     snap;                 // Snapshot with bits in image
+  t_covmodule    *mod;                 // Table of modules or NULL
+  int            nmod;                 // Number of modules
+  int            error;                // Error code, 0 if loaded
+} t_snapfile;
+
+typedef struct t_task {                // Range of words of result layout
+  u32            addr;                 // Address of the first word
+  u32            *bits;                // First word in result or NULL
+  u32            nword;                // Number of words
+  int            error;                // Task failed, memory is low
+} t_task;
+
+typedef void TASKFUNC(int index,void *arg);
+
+typedef struct t_pool {                // Tasks shared between threads
+  TASKFUNC       *func;                // Function that executes task
+  void           *arg;                 // Argument of func
+  int            ntask;                // Number of tasks
+  int            next;                 // Next task to execute
+  pthread_mutex_t lock;                // Protects next
+} t_pool;
+
+static int       nthread;              // Number of worker threads
+static t_snapfile *file;               // Snapshot files from command line
+static int       nfile;                // Number of snapshot files
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////// SERVICE /////////////////////////////////////
+
+static double Seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec+ts.tv_nsec*1e-9;
+};
+
+// Returns size of bitmaps of the snapshot, bytes.
+static u64 Bitmapbytes(const t_snapshot *ps) {
+  int i;
+  u64 n=0;
+  for (i=0; i<ps->nblock; i++)
+    n+=Nwords(ps->block[i].size)*4;
+  return n;
+};
+
+// Reports throughput to stderr.
+static void Reportspeed(const char *what,u64 bytes,double t) {
+  if (t<=0.0) t=1e-9;
+  fprintf(stderr,"diffsnake-cli: %s %.1f MB of bitmaps in %.3f s, %.2f GB/s\n",
+    what,bytes/1048576.0,t,bytes/t/1e9);
+};
+
+// Thread function: takes tasks from the pool until all are done.
+static void *Worker(void *arg) {
+  int index;
+  t_pool *pp=(t_pool *)arg;
+  while (1) {
+    pthread_mutex_lock(&pp->lock);
+    index=pp->next++;
+    pthread_mutex_unlock(&pp->lock);
+    if (index>=pp->ntask)
+      break;
+    pp->func(index,pp->arg);
+  };
+  return NULL;
+};
+
+// Executes ntask tasks on all threads and waits for their completion.
+static void Parallel(TASKFUNC *func,int ntask,void *arg) {
+  int i,n;
+  pthread_t *th;
+  t_pool pool;
+  pool.func=func;
+  pool.arg=arg;
+  pool.ntask=ntask;
+  pool.next=0;
+  pthread_mutex_init(&pool.lock,NULL);
+  n=(nthread<ntask?nthread:ntask);
+  th=(pthread_t *)malloc((n>0?n:1)*sizeof(pthread_t));
+  for (i=0; th!=NULL && i<n; i++) {
+    if (pthread_create(th+i,NULL,Worker,&pool)!=0) break; };
+  if (th==NULL || i==0)
+    Worker(&pool);                     // No threads, do it myself
+  else {
+    n=i;
+    for (i=0; i<n; i++) pthread_join(th[i],NULL); };
+  if (th!=NULL) free(th);
+  pthread_mutex_destroy(&pool.lock);
+};
+
+// Splits all words of the layout into tasks of at most CHUNKWORDS words.
+// Returns allocated array of tasks or NULL if memory is low.
+static t_task *Splitlayout(const t_snapshot *layout,int *ntask) {
+  int i,n;
+  u32 w,nword;
+  t_task *task;
+  for (i=n=0; i<layout->nblock; i++)
+    n+=(Nwords(layout->block[i].size)+CHUNKWORDS-1)/CHUNKWORDS;
+  task=(t_task *)malloc((n>0?n:1)*sizeof(t_task));
+  if (task==NULL)
+    return NULL;
+  for (i=n=0; i<layout->nblock; i++) {
+    nword=Nwords(layout->block[i].size);
+    for (w=0; w<nword; w+=CHUNKWORDS,n++) {
+      task[n].addr=layout->block[i].base+w*32;
+      task[n].bits=layout->block[i].bits+w;
+      task[n].nword=(nword-w<CHUNKWORDS?nword-w:CHUNKWORDS);
+      task[n].error=0;
+    };
+  };
+  *ntask=n;
+  return task;
+};
+
+
+// Returns 1 if any of the tasks has failed.
+static int Taskfailed(const t_task *task,int ntask) {
+  int i;
+  for (i=0; i<ntask; i++) {
+    if (task[i].error) return 1; };
+  return 0;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////// SNAPSHOT FILES ////////////////////////////////
+
+// Maps one snapshot file and builds its rank directory.
+static void Loadtask(int index,void *arg) {
+  int fd;
+  struct stat st;
+  void *image;
+  t_snapfile *pf=file+index;
+  (void)arg;                           // Files are global
+  fd=open(pf->name,O_RDONLY);
+  if (fd<0) {
+    pf->error=errno;
+    return; };
+  if (fstat(fd,&st)!=0 || st.st_size<=0 || st.st_size>0xFFFFFFFFu) {
+    close(fd);
+    pf->error=EINVAL;
+    return; };
+  image=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (image==MAP_FAILED) {
+    pf->error=errno;
+    return; };
+  pf->image=(u8 *)image;
+  pf->size=st.st_size;
+  if (Covmapnative(pf->image,(u32)pf->size,&pf->snap,&pf->mod,&pf->nmod)!=0)
+    pf->error=EINVAL;
+};
+
+// Loads all files from the command line in parallel. Returns 0 on success and
+// -1 if some file can't be used.
+static int Loadfiles(char **names,int n) {
+  int i,result;
+  u64 bytes;
+  double t;
+  file=(t_snapfile *)calloc(n>0?n:1,sizeof(t_snapfile));
+  if (file==NULL)
+    return -1;
+  nfile=n;
+  for (i=0; i<n; i++) {
+    file[i].name=names[i];
+    Snapinit(&file[i].snap); };
+  t=Seconds();
+  Parallel(Loadtask,n,NULL);
+  t=Seconds()-t;
+  result=0;
+  bytes=0;
+  for (i=0; i<n; i++) {
+    if (file[i].error==EINVAL)
+      fprintf(stderr,"diffsnake-cli: %s: not a DiffSnake snapshot\n",file[i].name);
+    else if (file[i].error!=0)
+      fprintf(stderr,"diffsnake-cli: %s: %s\n",file[i].name,strerror(file[i].error));
+    else
+      bytes+=Bitmapbytes(&file[i].snap);
+    if (file[i].error!=0) result=-1;
+  };
+  if (result==0)
+    Reportspeed("loaded and ranked",bytes,t);
+  return result;
+};
+
+static void Unloadfiles(void) {
+  int i;
+  for (i=0; i<nfile; i++) {
+    Snapfree(&file[i].snap);
+    if (file[i].mod!=NULL) free(file[i].mod);
+    if (file[i].image!=NULL) munmap(file[i].image,file[i].size); };
+  if (file!=NULL) free(file);
+  file=NULL;
+  nfile=0;
+};
+
+// Creates layout that covers all loaded files.
+static int Layoutall(t_snapshot *layout) {
+  int i,result;
+  const t_snapshot **src;
+  src=(const t_snapshot **)malloc((nfile>0?nfile:1)*sizeof(t_snapshot *));
+  if (src==NULL)
+    return -1;
+  for (i=0; i<nfile; i++)
+    src[i]=&file[i].snap;
+  result=Snaplayout(layout,src,nfile);
+  free(src);
+  return result;
+};
+
+// Writes snapshot with the given module table.
+static int Savesnapshot(const char *name,const t_snapshot *ps,
+  const t_covmodule *mod,int nmod) {
+  int result;
+  FILE *f;
+  f=fopen(name,"wb");
+  if (f==NULL) {
+    fprintf(stderr,"diffsnake-cli: %s: %s\n",name,strerror(errno));
+    return -1; };
+  result=Covwritenative(f,ps,mod,nmod);
+  if (fclose(f)!=0) result=-1;
+  if (result!=0)
+    fprintf(stderr,"diffsnake-cli: error writing %s\n",name);
+  return result;
+};
+
+static void Listaddresses(const t_snapshot *ps) {
+  u32 addr;
+  t_snapiter it;
+  Snapiterinit(&it,ps,0,0xFFFFFFFF);
+  while (Snapiternext(&it,&addr))
+    printf("%08X\n",addr);
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////// SET EXPRESSIONS //////////////////////////////
+
+// Expression consists of operands $1..$N (files in the order of command line),
+// operators | (union), ^ (symmetric difference), & (intersection) and -
+// (difference), and parentheses. & and - bind stronger than | and ^. It is
+// compiled into reverse Polish notation: non-negative codes are indices of
+// files, negative are OP_xxx.
+
+typedef struct t_expr {                // Compiled set expression
+  const char     *p;                   // Parsing: next character
+  int            code[MAXRPN];         // Reverse Polish notation
+  int            ncode;                // Length of code
+  int            error;                // Syntax error
+} t_expr;
+
+static void Parseor(t_expr *pe);
+
+static void Emit(t_expr *pe,int code) {
+  if (pe->ncode>=MAXRPN)
+    pe->error=1;
+  else
+    pe->code[pe->ncode++]=code;
+};
+
+static void Skipspaces(t_expr *pe) {
+  while (*pe->p==' ' || *pe->p=='\t') pe->p++;
+};
+
+static void Parseoperand(t_expr *pe) {
+  char *end;
+  long n;
+  Skipspaces(pe);
+  if (*pe->p=='(') {
+    pe->p++;
+    Parseor(pe);
+    Skipspaces(pe);
+    if (*pe->p!=')') pe->error=1;
+    else pe->p++;
+    return; };
+  if (*pe->p!='$') {
+    pe->error=1;
+    return; };
+  n=strtol(pe->p+1,&end,10);
+  if (end==pe->p+1 || n<1 || n>nfile) {
+    pe->error=1;
+    return; };
+  pe->p=end;
+  Emit(pe,(int)n-1);
+};
+
+static void Parseand(t_expr *pe) {
+  char op;
+  Parseoperand(pe);
+  while (pe->error==0) {
+    Skipspaces(pe);
+    op=*pe->p;
+    if (op!='&' && op!='-') break;
+    pe->p++;
+    Parseoperand(pe);
+    Emit(pe,op=='&'?OP_AND:OP_ANDNOT);
+  };
+};
+
+static void Parseor(t_expr *pe) {
+  char op;
+  Parseand(pe);
+  while (pe->error==0) {
+    Skipspaces(pe);
+    op=*pe->p;
+    if (op!='|' && op!='^') break;
+    pe->p++;
+    Parseand(pe);
+    Emit(pe,op=='|'?OP_OR:OP_XOR);
+  };
+};
+
+typedef struct t_evaljob {             // Evaluation of expression
+  t_expr         *pe;                  // Compiled expression
+  int            depth;                // Max depth of evaluation stack
+  t_task         *task;                // Ranges of result
+} t_evaljob;
+
+// Evaluates expression over one range of the result. Stack holds whole runs
+// of words, so each operator is a tight loop over the range. Bottom of the
+// stack is the result itself.
+static void Evaltask(int index,void *arg) {
+  int i,sp,code;
+  u32 w,n,*a,*b,*tmp,**stack;
+  t_snapcursor cur;
+  t_evaljob *job=(t_evaljob *)arg;
+  t_task *pt=job->task+index;
+  n=pt->nword;
+  stack=(u32 **)malloc(job->depth*sizeof(u32 *));
+  tmp=(u32 *)malloc(((size_t)job->depth-1)*n*sizeof(u32)+1);
+  if (stack==NULL || tmp==NULL) {
+    if (stack!=NULL) free(stack);
+    if (tmp!=NULL) free(tmp);
+    pt->error=1;
+    return; };
+  stack[0]=pt->bits;
+  for (i=1; i<job->depth; i++)
+    stack[i]=tmp+(size_t)(i-1)*n;
+  for (i=sp=0; i<job->pe->ncode; i++) {
+    code=job->pe->code[i];
+    if (code>=0) {
+      // Operand may repeat, therefore cursor starts anew for each read.
+      Snapcursorinit(&cur,&file[code].snap,pt->addr);
+      Snapgetwords(&cur,pt->addr,stack[sp++],n);
+      continue; };
+    sp--;
+    a=stack[sp-1]; b=stack[sp];
+    switch (code) {
+      case OP_OR:     for (w=0; w<n; w++) a[w]|=b[w]; break;
+      case OP_AND:    for (w=0; w<n; w++) a[w]&=b[w]; break;
+      case OP_ANDNOT: for (w=0; w<n; w++) a[w]&=~b[w]; break;
+      case OP_XOR:    for (w=0; w<n; w++) a[w]^=b[w]; break;
+      default: break;
+    };
+  };
+  free(tmp);
+  free(stack);
+};
+
+static int Cmdeval(const char *text,const char *outname,int list) {
+  int i,j,ntask;
+  u64 bytes;
+  double t;
+  t_expr expr;
+  t_evaljob job;
+  t_snapshot result;
+  memset(&expr,0,sizeof(expr));
+  expr.p=text;
+  Parseor(&expr);
+  Skipspaces(&expr);
+  if (expr.error || *expr.p!='\0') {
+    fprintf(stderr,"diffsnake-cli: error in expression near '%s'\n",expr.p);
+    return 1; };
+  Snapinit(&result);
+  if (Layoutall(&result)!=0) {
+    fprintf(stderr,"diffsnake-cli: low memory\n");
+    return 1; };
+  // Depth of the stack: operands push, operators pop one.
+  for (i=j=0,job.depth=1; i<expr.ncode; i++) {
+    j+=(expr.code[i]>=0?1:-1);
+    if (j>job.depth) job.depth=j; };
+  job.pe=&expr;
+  job.task=Splitlayout(&result,&ntask);
+  if (job.task==NULL) {
+    Snapfree(&result);
+    fprintf(stderr,"diffsnake-cli: low memory\n");
+    return 1; };
+  t=Seconds();
+  Parallel(Evaltask,ntask,&job);
+  if (Taskfailed(job.task,ntask) || Snapbuildrank(&result)!=0) {
+    free(job.task);
+    Snapfree(&result);
+    fprintf(stderr,"diffsnake-cli: low memory\n");
+    return 1; };
+  t=Seconds()-t;
+  // Count each operand once, even if it appears several times.
+  for (i=0,bytes=0; i<expr.ncode; i++) {
+    if (expr.code[i]<0) continue;
+    for (j=0; j<i && expr.code[j]!=expr.code[i]; j++) ;
+    if (j==i) bytes+=Bitmapbytes(&file[expr.code[i]].snap);
+  };
+  Reportspeed("evaluated",bytes,t);
+  printf("%u\n",result.nhit);
+  if (list)
+    Listaddresses(&result);
+  i=0;
+  if (outname!=NULL)
+    i=Savesnapshot(outname,&result,file[0].mod,file[0].nmod);
+  free(job.task);
+  Snapfree(&result);
+  return (i==0?0:1);
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////// FREQUENCIES //////////////////////////////////
+
+// Frequency of address is the number of files that hit it. Counters are kept
+// bit-sliced: plane j of the range holds bit j of the counters of all
+// addresses, so that adding whole bitmap word is a ripple of ANDs and XORs
+// over at most log2(nfile) planes. Files are added one by one, so that each
+// file is read sequentially.
+
+typedef struct t_freqjob {             // Frequency count
+  t_task         *task;                // Ranges of layout
+  int            nplane;               // Number of bit planes
+  u32            maxlist;              // List addresses with freq<=maxlist
+  u64            *hist;                // Number of addresses by frequency
+  u32            **list;               // Listed addresses of each task
+  u32            *nlist;               // Number of listed addresses
+  pthread_mutex_t lock;                // Protects hist
+} t_freqjob;
+
+static void Freqtask(int index,void *arg) {
+  int i,j;
+  u32 w,k,x,carry,any,count,nlist,maxn,maxlist,*list,*plane,*buf,*p;
+  u64 *hist;
+  t_snapcursor cur;
+  t_freqjob *job=(t_freqjob *)arg;
+  t_task *pt=job->task+index;
+  plane=(u32 *)calloc((size_t)job->nplane*pt->nword,sizeof(u32));
+  buf=(u32 *)malloc(pt->nword*sizeof(u32));
+  hist=(u64 *)calloc(nfile+1,sizeof(u64));
+  if (plane==NULL || buf==NULL || hist==NULL) {
+    if (plane!=NULL) free(plane);
+    if (buf!=NULL) free(buf);
+    if (hist!=NULL) free(hist);
+    pt->error=1;
+    return; };
+  // Bits of this range that are hit at least once are kept in layout.
+  for (i=0; i<nfile; i++) {
+    Snapcursorinit(&cur,&file[i].snap,pt->addr);
+    Snapgetwords(&cur,pt->addr,buf,pt->nword);
+    for (w=0; w<pt->nword; w++) {
+      x=buf[w];
+      if (x==0) continue;
+      pt->bits[w]|=x;
+      for (j=0,carry=x; carry!=0 && j<job->nplane; j++) {
+        p=plane+(size_t)j*pt->nword+w;
+        x=*p & carry;
+        *p^=carry;
+        carry=x;
+      };
+    };
+  };
+  free(buf);
+  list=NULL; nlist=maxn=0; maxlist=job->maxlist;
+  for (w=0; w<pt->nword; w++) {
+    for (any=pt->bits[w]; any!=0; any&=any-1) {
+      k=__builtin_ctz(any);
+      for (j=0,count=0; j<job->nplane; j++)
+        count|=((plane[(size_t)j*pt->nword+w]>>k) & 1)<<j;
+      hist[count]++;
+      if (count<=maxlist) {
+        if (nlist>=maxn) {
+          p=(u32 *)realloc(list,(maxn*2+256)*sizeof(u32));
+          if (p==NULL) { maxlist=0; pt->error=1; continue; };
+          list=p;
+          maxn=maxn*2+256; };
+        list[nlist++]=pt->addr+w*32+k;
+      };
+    };
+  };
+  job->list[index]=list;
+  job->nlist[index]=nlist;
+  pthread_mutex_lock(&job->lock);
+  for (i=0; i<=nfile; i++)
+    job->hist[i]+=hist[i];
+  pthread_mutex_unlock(&job->lock);
+  free(hist);
+  free(plane);
+};
+
+static int Cmdfreq(u32 maxlist) {
+  int i,ntask,result;
+  u32 k;
+  u64 bytes,total;
+  double t;
+  t_snapshot layout;
+  t_freqjob job;
+  Snapinit(&layout);
+  memset(&job,0,sizeof(job));
+  if (Layoutall(&layout)!=0 || (job.task=Splitlayout(&layout,&ntask))==NULL) {
+    Snapfree(&layout);
+    fprintf(stderr,"diffsnake-cli: low memory\n");
+    return 1; };
+  for (job.nplane=1; job.nplane<MAXPLANE && ((u32)nfile>>job.nplane)!=0; job.nplane++) ;
+  job.maxlist=maxlist;
+  job.hist=(u64 *)calloc(nfile+1,sizeof(u64));
+  job.list=(u32 **)calloc(ntask>0?ntask:1,sizeof(u32 *));
+  job.nlist=(u32 *)calloc(ntask>0?ntask:1,sizeof(u32));
+  result=0;
+  if (job.hist==NULL || job.list==NULL || job.nlist==NULL)
+    result=1;
+  else {
+    pthread_mutex_init(&job.lock,NULL);
+    t=Seconds();
+    Parallel(Freqtask,ntask,&job);
+    t=Seconds()-t;
+    pthread_mutex_destroy(&job.lock);
+    result=Taskfailed(job.task,ntask); };
+  if (result!=0) {
+    for (i=0; job.list!=NULL && i<ntask; i++) {
+      if (job.list[i]!=NULL) free(job.list[i]); };
+    if (job.hist!=NULL) free(job.hist);
+    if (job.list!=NULL) free(job.list);
+    if (job.nlist!=NULL) free(job.nlist);
+    free(job.task);
+    Snapfree(&layout);
+    fprintf(stderr,"diffsnake-cli: low memory\n");
+    return 1; };
+  for (i=0,bytes=0; i<nfile; i++)
+    bytes+=Bitmapbytes(&file[i].snap);
+  Reportspeed("counted",bytes,t);
+  printf("files  addresses\n");
+  for (i=1,total=0; i<=nfile; i++) {
+    if (job.hist[i]==0) continue;
+    printf("%5i  %llu\n",i,(unsigned long long)job.hist[i]);
+    total+=job.hist[i]; };
+  printf("total  %llu\n",(unsigned long long)total);
+  if (maxlist>0) {
+    printf("addresses hit by at most %u files:\n",maxlist);
+    for (i=0; i<ntask; i++) {
+      for (k=0; k<job.nlist[i]; k++) printf("%08X\n",job.list[i][k]);
+      if (job.list[i]!=NULL) free(job.list[i]);
+    };
+  };
+  free(job.hist);
+  free(job.list);
+  free(job.nlist);
+  free(job.task);
+  Snapfree(&layout);
+  return 0;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////// SUMMARY /////////////////////////////////////
+
+typedef struct t_modsum {              // Coverage of one module
+  t_covmodule    *pm;                  // Module descriptor
+  u32            nunion;               // Addresses hit by any file
+  u32            nfiles;               // Files that hit module
+  u32            maxhit;               // Max hits in single file
+  int            error;                // Union is incomplete, memory is low
+} t_modsum;
+
+// Compares modules by base address and size, for qsort().
+static int Modsumcmp(const void *a,const void *b) {
+  const t_covmodule *ma=((const t_modsum *)a)->pm,*mb=((const t_modsum *)b)->pm;
+  if (ma->base!=mb->base) return (ma->base<mb->base?-1:1);
+  if (ma->size!=mb->size) return (ma->size<mb->size?-1:1);
+  return strcmp(ma->path,mb->path);
+};
+
+// Calculates coverage of one module: union of all files over the range of
+// module, and per-file counts, which rank directories give immediately.
+static void Sumtask(int index,void *arg) {
+  int i;
+  u32 n,k,w,addr,first,end,mask,*acc,*buf;
+  t_snapcursor *cur;
+  t_modsum *ms=(t_modsum *)arg+index;
+  first=ms->pm->base;
+  end=ms->pm->base+ms->pm->size;
+  for (i=0; i<nfile; i++) {
+    n=Snaprank(&file[i].snap,end)-Snaprank(&file[i].snap,first);
+    if (n>0) ms->nfiles++;
+    if (n>ms->maxhit) ms->maxhit=n; };
+  if (ms->nfiles==0 || end<=first)
+    return;
+  cur=(t_snapcursor *)malloc(nfile*sizeof(t_snapcursor));
+  acc=(u32 *)malloc(CHUNKWORDS*sizeof(u32));
+  buf=(u32 *)malloc(CHUNKWORDS*sizeof(u32));
+  if (cur==NULL || acc==NULL || buf==NULL) {
+    if (cur!=NULL) free(cur);
+    if (acc!=NULL) free(acc);
+    if (buf!=NULL) free(buf);
+    ms->error=1;
+    return; };
+  for (i=0; i<nfile; i++)
+    Snapcursorinit(cur+i,&file[i].snap,first);
+  for (addr=first & 0xFFFFFFE0; addr<end && addr>=(first & 0xFFFFFFE0); addr+=n*32) {
+    n=((end-addr+31)>>5);
+    if (n>CHUNKWORDS) n=CHUNKWORDS;
+    memset(acc,0,n*sizeof(u32));
+    for (i=0; i<nfile; i++) {
+      Snapgetwords(cur+i,addr,buf,n);
+      for (w=0; w<n; w++) acc[w]|=buf[w]; };
+    for (w=0; w<n; w++) {
+      mask=0xFFFFFFFF;
+      k=addr+w*32;
+      if (k<first) mask&=0xFFFFFFFF<<(first-k);
+      if (end-k<32) mask&=(1u<<(end-k))-1;
+      ms->nunion+=Popcount(acc[w] & mask);
+    };
+  };
+  free(buf);
+  free(acc);
+  free(cur);
+};
+
+static int Cmdsummary(void) {
+  int i,j,n;
+  double t;
+  u64 bytes;
+  const char *name;
+  t_modsum *ms;
+  for (i=n=0; i<nfile; i++)
+    n+=file[i].nmod;
+  ms=(t_modsum *)calloc(n>0?n:1,sizeof(t_modsum));
+  if (ms==NULL) {
+    fprintf(stderr,"diffsnake-cli: low memory\n");
+    return 1; };
+  // Modules of all files, same module listed by several files counts once.
+  for (i=n=0; i<nfile; i++) {
+    for (j=0; j<file[i].nmod; j++) ms[n++].pm=file[i].mod+j; };
+  qsort(ms,n,sizeof(t_modsum),Modsumcmp);
+  for (i=j=0; i<n; i++) {
+    if (j>0 && Modsumcmp(ms+j-1,ms+i)==0) continue;
+    ms[j++]=ms[i]; };
+  n=j;
+  t=Seconds();
+  Parallel(Sumtask,n,ms);
+  t=Seconds()-t;
+  for (i=0; i<n && ms[i].error==0; i++) ;
+  if (i<n) {
+    free(ms);
+    fprintf(stderr,"diffsnake-cli: low memory\n");
+    return 1; };
+  for (i=0,bytes=0; i<nfile; i++)
+    bytes+=Bitmapbytes(&file[i].snap);
+  Reportspeed("summarized",bytes,t);
+  printf("base      size      union     files  maxhit    module\n");
+  for (i=0; i<n; i++) {
+    name=ms[i].pm->path+strlen(ms[i].pm->path);
+    while (name>ms[i].pm->path && name[-1]!='\\' && name[-1]!='/') name--;
+    printf("%08X  %08X  %-8u  %5u  %-8u  %s\n",ms[i].pm->base,ms[i].pm->size,
+      ms[i].nunion,ms[i].nfiles,ms[i].maxhit,name);
+  };
+  free(ms);
+  return 0;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////// MINIMIZATION //////////////////////////////////
+
+// Prints smallest (by greedy estimate) subset of files that covers all hits,
+// in the order of selection, with number of hits added by each file. Union may
+// be saved as snapshot.
+static int Cmdminimize(const char *outname) {
+  int i,n,result,*order;
+  u32 *gain,total;
+  u64 bytes;
+  double t;
+  const t_snapshot **src;
+  t_snapshot covered;
+  src=(const t_snapshot **)malloc((nfile>0?nfile:1)*sizeof(t_snapshot *));
+  order=(int *)malloc((nfile>0?nfile:1)*sizeof(int));
+  gain=(u32 *)malloc((nfile>0?nfile:1)*sizeof(u32));
+  Snapinit(&covered);
+  n=-1;
+  if (src!=NULL && order!=NULL && gain!=NULL) {
+    for (i=0; i<nfile; i++) src[i]=&file[i].snap;
+    t=Seconds();
+    n=Snapmincover(src,nfile,order,gain,&covered);
+    t=Seconds()-t;
+    for (i=0,bytes=0; i<nfile; i++)
+      bytes+=Bitmapbytes(&file[i].snap);
+    if (n>=0) Reportspeed("minimized",bytes,t);
+  };
+  result=0;
+  if (n<0) {
+    fprintf(stderr,"diffsnake-cli: low memory\n");
+    result=1; }
+  else {
+    printf("%i of %i files cover %u addresses\n",n,nfile,covered.nhit);
+    printf("gain      total     %%       file\n");
+    for (i=0,total=0; i<n; i++) {
+      total+=gain[i];
+      printf("%-8u  %-8u  %6.2f  %s\n",gain[i],total,
+        covered.nhit==0?0.0:total*100.0/covered.nhit,file[order[i]].name);
+    };
+    if (outname!=NULL &&
+      Savesnapshot(outname,&covered,file[0].mod,file[0].nmod)!=0)
+      result=1;
+  };
+  if (src!=NULL) free(src);
+  if (order!=NULL) free(order);
+  if (gain!=NULL) free(gain);
+  Snapfree(&covered);
+  return result;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////// STORE //////////////////////////////////////
+
+// Store is a single file that keeps many snapshots, each distinct chunk of
+// bitmap only once (see covfile.c). Subcommands: add files under their names,
+// list stored snapshots, get one back as snapshot file, and diff two stored
+// snapshots without reading chunks that they share.
+
+static int Storeaddfiles(t_store *pt,char **names,int n) {
+  int i,result;
+  u32 nnew,total;
+  u64 bytes;
+  double t;
+  if (Loadfiles(names,n)!=0)
+    return 1;
+  result=0; total=0; bytes=0;
+  t=Seconds();
+  for (i=0; i<nfile; i++) {
+    if (Storeadd(pt,file[i].name,&file[i].snap,
+      file[i].mod,file[i].nmod,&nnew)<0) {
+      fprintf(stderr,"diffsnake-cli: %s: error writing store\n",file[i].name);
+      result=1;
+      break; };
+    printf("%-8u  %s\n",nnew,file[i].name);
+    total+=nnew;
+    bytes+=Bitmapbytes(&file[i].snap);
+  };
+  t=Seconds()-t;
+  Reportspeed("stored",bytes,t);
+  printf("%u new chunks, store holds %u chunks and %i snapshots\n",
+    total,pt->nchunk,pt->nsnap);
+  return result;
+};
+
+static int Storeget(t_store *pt,const char *name,int index,const char *outname,
+  int list) {
+  int result,nmod;
+  t_snapshot snap;
+  t_covmodule *mod;
+  Snapinit(&snap);
+  if (Storeload(pt,index,&snap,&mod,&nmod)!=0) {
+    fprintf(stderr,"diffsnake-cli: %s: error reading store\n",name);
+    return 1; };
+  printf("%u\n",snap.nhit);
+  if (list)
+    Listaddresses(&snap);
+  result=0;
+  if (outname!=NULL && Savesnapshot(outname,&snap,mod,nmod)!=0)
+    result=1;
+  if (mod!=NULL) free(mod);
+  Snapfree(&snap);
+  return result;
+};
+
+static int Storediffnames(t_store *pt,char **names,const char *outname,
+  int list) {
+  int i,a,b,result,nmod;
+  u32 nskip,nchunk;
+  double t;
+  t_snapshot snap;
+  t_covmodule *mod;
+  a=Storefind(pt,names[0]);
+  b=Storefind(pt,names[1]);
+  if (a<0 || b<0) {
+    fprintf(stderr,"diffsnake-cli: %s: no such snapshot in store\n",
+      names[a<0?0:1]);
+    return 1; };
+  Snapinit(&snap);
+  t=Seconds();
+  if (Storediff(pt,a,b,&snap,&mod,&nmod,&nskip)!=0) {
+    fprintf(stderr,"diffsnake-cli: error reading store\n");
+    return 1; };
+  t=Seconds()-t;
+  for (i=0,nchunk=0; i<snap.nblock; i++)
+    nchunk+=(Nwords(snap.block[i].size)+STORECHUNK-1)/STORECHUNK;
+  fprintf(stderr,"diffsnake-cli: %u of %u chunks skipped by hash in %.3f s\n",
+    nskip,nchunk,t);
+  printf("%u\n",snap.nhit);
+  if (list)
+    Listaddresses(&snap);
+  result=0;
+  if (outname!=NULL && Savesnapshot(outname,&snap,mod,nmod)!=0)
+    result=1;
+  if (mod!=NULL) free(mod);
+  Snapfree(&snap);
+  return result;
+};
+
+// Executes subcommand sub. First of n arguments is the name of the store.
+static int Cmdstore(const char *sub,char **args,int n,const char *outname,
+  int list) {
+  int i,result;
+  t_store store;
+  if (Storeopen(&store,args[0],strcmp(sub,"add")==0)!=0) {
+    fprintf(stderr,"diffsnake-cli: %s: not a DiffSnake store\n",args[0]);
+    return 1; };
+  result=0;
+  if (strcmp(sub,"add")==0)
+    result=Storeaddfiles(&store,args+1,n-1);
+  else if (strcmp(sub,"list")==0) {
+    printf("hits      blocks  name\n");
+    for (i=0; i<store.nsnap; i++) {
+      // Snapshot replaced by the later one with the same name is not listed.
+      if (Storefind(&store,store.snap[i].name)!=i) continue;
+      printf("%-8u  %-6u  %s\n",store.snap[i].nhit,store.snap[i].nblock,
+        store.snap[i].name);
+    }; }
+  else if (strcmp(sub,"get")==0) {
+    i=Storefind(&store,args[1]);
+    if (i<0) {
+      fprintf(stderr,"diffsnake-cli: %s: no such snapshot in store\n",args[1]);
+      result=1; }
+    else
+      result=Storeget(&store,args[1],i,outname,list);
+    ; }
+  else
+    result=Storediffnames(&store,args+1,outname,list);
+  Storeclose(&store);
+  Unloadfiles();
+  return result;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////// MAIN //////////////////////////////////////
+
+static void Usage(void) {
+  fprintf(stderr,
+    "usage: diffsnake-cli [-j threads] command [options] file.dsnap...\n"
+    "commands:\n"
+    "  eval [-o out.dsnap] [-l] EXPR   evaluate set expression over files $1..$N:\n"
+    "                                  | union, & intersection, - difference,\n"
+    "                                  ^ symmetric difference, parentheses;\n"
+    "                                  prints number of hits, -l lists them\n"
+    "  freq [-r max]                   number of addresses hit by 1, 2... files,\n"
+    "                                  -r lists addresses hit by at most max files\n"
+    "  summary                         coverage of each module by all files\n"
+    "  minimize [-o union.dsnap]       smallest subset of files that covers all\n"
+    "                                  hits, with new hits added by each file\n"
+    "usage: diffsnake-cli store add STORE file.dsnap...\n"
+    "       diffsnake-cli store list STORE\n"
+    "       diffsnake-cli store get [-o out.dsnap] [-l] STORE name\n"
+    "       diffsnake-cli store diff [-o out.dsnap] [-l] STORE name1 name2\n"
+    "                                  snapshots in the deduplicating store, diff\n"
+    "                                  prints hits of name1 that name2 has not\n");
+};
+
+int main(int argc,char *argv[]) {
+  int i,n,result,list;
+  u32 maxlist;
+  const char *cmd,*sub,*outname,*expr;
+  nthread=(int)sysconf(_SC_NPROCESSORS_ONLN);
+  outname=NULL; expr=NULL; list=0; maxlist=0;
+  i=1;
+  if (i+1<argc && strcmp(argv[i],"-j")==0) {
+    nthread=atoi(argv[i+1]);
+    i+=2; };
+  if (nthread<1) nthread=1;
+  if (i>=argc) {
+    Usage();
+    return 2; };
+  cmd=argv[i++];
+  sub=NULL;
+  if (strcmp(cmd,"store")==0 && i<argc)
+    sub=argv[i++];
+  for (; i<argc && argv[i][0]=='-'; i++) {
+    if (strcmp(argv[i],"-o")==0 && i+1<argc &&
+      (strcmp(cmd,"eval")==0 || strcmp(cmd,"minimize")==0 || sub!=NULL))
+      outname=argv[++i];
+    else if (strcmp(argv[i],"-l")==0 && (strcmp(cmd,"eval")==0 || sub!=NULL))
+      list=1;
+    else if (strcmp(argv[i],"-r")==0 && i+1<argc && strcmp(cmd,"freq")==0)
+      maxlist=(u32)strtoul(argv[++i],NULL,10);
+    else {
+      Usage();
+      return 2;
+    };
+  };
+  if (sub!=NULL) {
+    // Store name and arguments of the subcommand.
+    n=argc-i;
+    if ((strcmp(sub,"add")==0 && n>=2) || (strcmp(sub,"list")==0 && n==1) ||
+      (strcmp(sub,"get")==0 && n==2) || (strcmp(sub,"diff")==0 && n==3))
+      return Cmdstore(sub,argv+i,n,outname,list);
+    Usage();
+    return 2; };
+  if (strcmp(cmd,"eval")==0 && i<argc)
+    expr=argv[i++];
+  if (i>=argc || (strcmp(cmd,"eval")==0 && expr==NULL)) {
+    Usage();
+    return 2; };
+  if (strcmp(cmd,"eval")!=0 && strcmp(cmd,"freq")!=0 &&
+    strcmp(cmd,"summary")!=0 && strcmp(cmd,"minimize")!=0) {
+    Usage();
+    return 2; };
+  if (Loadfiles(argv+i,argc-i)!=0) {
+    Unloadfiles();
+    return 1; };
+  if (strcmp(cmd,"eval")==0)
+    result=Cmdeval(expr,outname,list);
+  else if (strcmp(cmd,"freq")==0)
+    result=Cmdfreq(maxlist);
+  else if (strcmp(cmd,"minimize")==0)
+    result=Cmdminimize(outname);
+  else
+    result=Cmdsummary();
+  Unloadfiles();
+  return result;
+};
@@ -0,0 +1,1223 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                         DiffSnake COVERAGE FILES                           //
+//                                                                            //
+// This file must not include windows.h or plugin.h. It is shared between the //
+// plugin and offline tools.                                                  //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+  #define _POSIX_C_SOURCE 200112L      // ftruncate() and fileno()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#ifdef _WIN32
+  #include <io.h>
+#else
+  #include <unistd.h>
+#endif
+
+#include "covfile.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////// DRCOV ///////////////////////////////////////
+
+// Drcov log, as written by DynamoRIO and read by Lighthouse and similar
+// viewers, consists of text header with the module table followed by binary
+// table of basic blocks. Each block is 8 bytes: u32 offset from module base,
+// u16 size and u16 module id, all little-endian. Snapshot knows only where
+// commands begin, not where basic blocks end, so each hit is written as a
+// block of size 1. Viewers mark command as executed if block covers its first
+// byte, therefore coverage is displayed exactly.
+
+// Stores 16- and 32-bit values in little-endian order regardless of host.
+static void Putle16(u8 *p,u32 u) {
+  p[0]=(u8)u; p[1]=(u8)(u>>8);
+};
+
+static void Putle32(u8 *p,u32 u) {
+  p[0]=(u8)u; p[1]=(u8)(u>>8); p[2]=(u8)(u>>16); p[3]=(u8)(u>>24);
+};
+
+// Writes snapshot to the drcov log. Modules must be sorted by base and must
+// not overlap, hits outside of modules are not written. Snapshot must be
+// ranked: number of blocks must precede the table, and rank directory gives
+// it without extra walk. Records are then streamed directly from the bitmap
+// through small buffer. Returns number of written blocks or -1 on error.
+int Covwritedrcov(FILE *f,const t_snapshot *ps,const t_covmodule *mod,int nmod) {
+  int i,err;
+  u32 n,nbuf,total,addr;
+  u8 *buf;
+  t_snapiter it;
+  if (ps->ranked==0)
+    return -1;
+  total=0;
+  for (i=0; i<nmod; i++)
+    total+=Snaprank(ps,mod[i].base+mod[i].size)-Snaprank(ps,mod[i].base);
+  fprintf(f,"DRCOV VERSION: 2\n");
+  fprintf(f,"DRCOV FLAVOR: drcov\n");
+  fprintf(f,"Module Table: version 2, count %i\n",nmod);
+  fprintf(f,"Columns: id, base, end, entry, checksum, timestamp, path\n");
+  for (i=0; i<nmod; i++)
+    fprintf(f,"%3i, 0x%08X, 0x%08X, 0x%08X, 0x00000000, 0x00000000, %s\n",
+      i,mod[i].base,mod[i].base+mod[i].size,mod[i].entry,mod[i].path);
+  fprintf(f,"BB Table: %u bbs\n",total);
+  buf=(u8 *)malloc(COVBUFREC*8);
+  if (buf==NULL)
+    return -1;
+  n=nbuf=0; err=0;
+  for (i=0; i<nmod && err==0; i++) {
+    if (mod[i].size==0) continue;
+    Snapiterinit(&it,ps,mod[i].base,mod[i].base+mod[i].size-1);
+    while (err==0 && Snapiternext(&it,&addr)) {
+      Putle32(buf+nbuf*8,addr-mod[i].base);
+      Putle16(buf+nbuf*8+4,1);
+      Putle16(buf+nbuf*8+6,(u32)i);
+      nbuf++;
+      if (nbuf==COVBUFREC) {
+        if (fwrite(buf,8,nbuf,f)!=nbuf) err=1;
+        n+=nbuf; nbuf=0;
+      };
+    };
+  };
+  if (err==0 && nbuf>0 && fwrite(buf,8,nbuf,f)!=nbuf) err=1;
+  n+=nbuf;
+  free(buf);
+  if (err!=0 || n!=total || ferror(f))
+    return -1;
+  return (int)n;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// NATIVE FORMAT //////////////////////////////////
+
+// Native snapshot file is designed to be mapped into memory and used without
+// copying. All values are little-endian 32-bit words:
+//   header:  SNAPMAGIC, SNAPVERSION, nmod, nblock, nhit, 0;
+//   modules: nmod times base, size, entry, prefbase, length of path, followed
+//            by UTF-8 path padded with zeros to the multiple of 4 bytes;
+//   blocks:  nblock times base, size, nhit, 0;
+//   bits:    Nwords(size) words of each block, in the order of blocks.
+// Rank directories are not saved, they are rebuilt on load at the cost of one
+// pass over the bits.
+
+#define NATIVEHDR      6               // Words in the header
+
+// Returns 1 if host stores words little-endian, so that file bits can be used
+// directly.
+static int Islittleendian(void) {
+  u32 u=1;
+  return *(u8 *)&u;
+};
+
+static u32 Getle32(const u8 *p) {
+  return p[0]|(p[1]<<8)|(p[2]<<16)|((u32)p[3]<<24);
+};
+
+// Writes n words in little-endian order. Returns 0 on success and -1 on error.
+static int Writewords(FILE *f,const u32 *data,u32 n) {
+  u32 i,k;
+  u8 buf[1024];
+  if (Islittleendian())
+    return (fwrite(data,4,n,f)==n?0:-1);
+  for (i=0; i<n; i+=k) {
+    for (k=0; k<sizeof(buf)/4 && i+k<n; k++)
+      Putle32(buf+k*4,data[i+k]);
+    if (fwrite(buf,4,k,f)!=k) return -1;
+  };
+  return 0;
+};
+
+// Writes snapshot with the table of modules in the native format. Snapshot
+// must be ranked. Returns 0 on success and -1 on error.
+int Covwritenative(FILE *f,const t_snapshot *ps,const t_covmodule *mod,int nmod) {
+  int i;
+  u32 hdr[NATIVEHDR],len,zero=0;
+  const t_hitblock *pb;
+  if (ps->ranked==0)
+    return -1;
+  hdr[0]=SNAPMAGIC; hdr[1]=SNAPVERSION;
+  hdr[2]=(u32)nmod; hdr[3]=(u32)ps->nblock;
+  hdr[4]=ps->nhit; hdr[5]=0;
+  if (Writewords(f,hdr,NATIVEHDR)!=0)
+    return -1;
+  for (i=0; i<nmod; i++) {
+    len=(u32)strlen(mod[i].path);
+    hdr[0]=mod[i].base; hdr[1]=mod[i].size;
+    hdr[2]=mod[i].entry; hdr[3]=mod[i].prefbase; hdr[4]=len;
+    if (Writewords(f,hdr,5)!=0 || fwrite(mod[i].path,1,len,f)!=len ||
+      fwrite(&zero,1,(4-(len & 3)) & 3,f)!=((4-(len & 3)) & 3))
+      return -1;
+  };
+  for (i=0; i<ps->nblock; i++) {
+    pb=ps->block+i;
+    hdr[0]=pb->base; hdr[1]=pb->size; hdr[2]=pb->nhit; hdr[3]=0;
+    if (Writewords(f,hdr,4)!=0) return -1; };
+  for (i=0; i<ps->nblock; i++) {
+    pb=ps->block+i;
+    if (Writewords(f,pb->bits,Nwords(pb->size))!=0) return -1; };
+  return (ferror(f)?-1:0);
+};
+
+// Parses native file image. If copy is 0, bits of the snapshot point directly
+// into the image, which must remain valid while snapshot is used. Module
+// table, if requested, is allocated and must be freed by the caller.
+static int Parsenative(const u8 *image,u32 size,t_snapshot *ps,
+  t_covmodule **mod,int *nmod,int copy) {
+  int i;
+  u32 n,nblock,pos,len,blocks,words;
+  u32 *bits;
+  t_hitblock *pb;
+  t_covmodule *pm;
+  Snapfree(ps);
+  if (mod!=NULL) *mod=NULL;
+  if (nmod!=NULL) *nmod=0;
+  if (size<NATIVEHDR*4 || Getle32(image)!=SNAPMAGIC ||
+    Getle32(image+4)!=SNAPVERSION)
+    return -1;
+  // Words can be used in place only on little-endian hosts and if aligned.
+  if (Islittleendian()==0 || ((unsigned long)image & 3)!=0)
+    copy=1;
+  n=Getle32(image+8);
+  nblock=Getle32(image+12);
+  // Each module takes at least 20 bytes, and the size of the table must not
+  // wrap on 32-bit hosts.
+  if (n>(size-NATIVEHDR*4)/20 || n>UINT_MAX/sizeof(t_covmodule))
+    return -1;
+  pm=NULL;
+  if (mod!=NULL && n>0) {
+    pm=(t_covmodule *)malloc(n*sizeof(t_covmodule));
+    if (pm==NULL) return -1; };
+  pos=NATIVEHDR*4;
+  for (i=0; (u32)i<n; i++) {
+    if (size-pos<20) break;
+    len=Getle32(image+pos+16);
+    if (len>size-pos-20) break;
+    if (pm!=NULL) {
+      pm[i].base=Getle32(image+pos);
+      pm[i].size=Getle32(image+pos+4);
+      pm[i].entry=Getle32(image+pos+8);
+      pm[i].prefbase=Getle32(image+pos+12);
+      memcpy(pm[i].path,image+pos+20,(len<COVPATH?len:COVPATH-1));
+      pm[i].path[len<COVPATH?len:COVPATH-1]='\0'; };
+    pos+=20+((len+3) & 0xFFFFFFFC);
+  };
+  if ((u32)i<n || pos>size || (size-pos)/16<nblock) {
+    if (pm!=NULL) free(pm);
+    return -1; };
+  blocks=pos;
+  pos+=nblock*16;
+  for (i=0; (u32)i<nblock; i++) {
+    n=Getle32(image+blocks+i*16+4);
+    words=Nwords(n);
+    if (pos>size || (size-pos)/4<words) break;
+    // Bits beyond the end of the block would be counted as hits.
+    if ((n & 31)!=0 && (Getle32(image+pos+words*4-4)>>(n & 31))!=0) break;
+    if (copy) {
+      pb=Snapaddblock(ps,Getle32(image+blocks+i*16),n);
+      if (pb==NULL) break;
+      for (bits=pb->bits; words>0; words--,pos+=4)
+        *bits++=Getle32(image+pos);
+      ; }
+    else {
+      pb=Snapattachblock(ps,Getle32(image+blocks+i*16),n,(u32 *)(image+pos));
+      if (pb==NULL) break;
+      pos+=words*4;
+    };
+  };
+  if ((u32)i<nblock || Snapbuildrank(ps)!=0) {
+    Snapfree(ps);
+    if (pm!=NULL) free(pm);
+    return -1; };
+  if (mod!=NULL) *mod=pm;
+  if (nmod!=NULL) *nmod=(int)Getle32(image+8);
+  return 0;
+};
+
+// Uses native file mapped into memory as snapshot without copying the bits.
+// Image must stay mapped while snapshot is in use. Module table is optional
+// and must be freed by the caller. Returns 0 on success and -1 on error.
+int Covmapnative(const u8 *image,u32 size,t_snapshot *ps,
+  t_covmodule **mod,int *nmod) {
+  return Parsenative(image,size,ps,mod,nmod,0);
+};
+
+// Reads native file into the snapshot that owns its bits. File must be
+// opened in binary mode and positioned at the beginning. Returns 0 on success
+// and -1 on error.
+int Covreadnative(FILE *f,t_snapshot *ps,t_covmodule **mod,int *nmod) {
+  int result;
+  long size;
+  u8 *image;
+  if (fseek(f,0,SEEK_END)!=0 || (size=ftell(f))<=0 || fseek(f,0,SEEK_SET)!=0)
+    return -1;
+  image=(u8 *)malloc(size);
+  if (image==NULL)
+    return -1;
+  if (fread(image,1,size,f)!=(size_t)size)
+    result=-1;
+  else
+    result=Parsenative(image,(u32)size,ps,mod,nmod,1);
+  free(image);
+  return result;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////// IMPORT //////////////////////////////////////
+
+// Import accepts drcov logs (binary or text table of blocks) and plain text
+// lists with one address per line, as written by other tracers and by IDA
+// scripts. Line of the list may be:
+//   module+offset     offset of command from the base of named module;
+//   segment:address   IDA style, address at preferred module base;
+//   address           either actual address, address at preferred module
+//                     base, or offset from the base of the main module.
+// Numbers are hexadecimal, with or without 0x prefix or h suffix. Text after
+// the number and lines that begin with # or ; are ignored. All addresses are
+// relocated to the actual module bases, so coverage taken with different
+// layout is comparable with hit trace. File is read sequentially and hits go
+// directly into the bitmaps of modules.
+
+// Returns pointer to the file name in the path.
+static const char *Covbasename(const char *path) {
+  const char *p;
+  for (p=path; *path!='\0'; path++) {
+    if (*path=='\\' || *path=='/') p=path+1; };
+  return p;
+};
+
+// Finds module with given short name, compared case-insensitively. Name may
+// omit extension. Returns index of the module or -1.
+static int Covfindmodule(const t_covmodule *mod,int nmod,const char *name,int len) {
+  int i,k;
+  const char *p;
+  for (i=0; i<nmod; i++) {
+    p=Covbasename(mod[i].path);
+    for (k=0; k<len && p[k]!='\0'; k++) {
+      if (tolower((u8)p[k])!=tolower((u8)name[k])) break; };
+    if (k==len && (p[k]=='\0' || p[k]=='.'))
+      return i;
+  };
+  return -1;
+};
+
+// Parses hexadecimal number that ends with space, comma or end of line.
+// Returns number of consumed characters, 0 if there is no number.
+static int Covparsehex(const char *s,u32 *value) {
+  int n=0,d;
+  u32 u=0;
+  if (s[0]=='0' && (s[1]=='x' || s[1]=='X') && isxdigit((u8)s[2]))
+    n=2;
+  while (isxdigit((u8)s[n])) {
+    d=((u8)s[n]<='9'?s[n]-'0':tolower((u8)s[n])-'a'+10);
+    u=(u<<4)|(u32)d;
+    n++; };
+  if (n==0)
+    return 0;
+  if (s[n]=='h' || s[n]=='H') n++;
+  if (s[n]!='\0' && s[n]!=' ' && s[n]!='\t' && s[n]!=',' && s[n]!=';')
+    return 0;                          // Not a number but some word
+  *value=u;
+  return n;
+};
+
+// Returns index of module that contains given address or -1. Modules are
+// sorted by address.
+static int Covmoduleat(const t_covmodule *mod,int nmod,u32 addr) {
+  int lo=0,hi=nmod-1,mid;
+  while (lo<=hi) {
+    mid=(lo+hi)/2;
+    if (addr<mod[mid].base) hi=mid-1;
+    else if (addr-mod[mid].base>=mod[mid].size) lo=mid+1;
+    else return mid;
+  };
+  return -1;
+};
+
+// Marks command at offset from the base of the module. If size is above 1,
+// offset is the start of basic block, and all commands in the block are
+// marked, provided that cmdlen is able to tell their lengths.
+static void Covmark(t_snapshot *ps,int index,u32 offset,u32 size,
+  CMDLENFUNC *cmdlen,t_covstat *st) {
+  u32 n,base;
+  t_hitblock *pb;
+  pb=ps->block+index;
+  if (offset>=pb->size) {
+    st->nlost++;
+    return; };
+  if (size>pb->size-offset) size=pb->size-offset;
+  base=pb->base;
+  do {
+    Setbit(pb,offset);
+    if (size<=1 || cmdlen==NULL)
+      break;
+    n=cmdlen(base+offset);
+    if (n==0 || n>=size)
+      break;
+    offset+=n; size-=n;
+  } while (1);
+};
+
+// Strips trailing newline and whitespace from the line read by fgets().
+static void Covstripline(char *s) {
+  int n;
+  n=(int)strlen(s);
+  while (n>0 && (s[n-1]=='\n' || s[n-1]=='\r' || isspace((u8)s[n-1]))) n--;
+  s[n]='\0';
+};
+
+// Reads table of modules and blocks of drcov log. First line (DRCOV VERSION)
+// is already read. Drcov modules are matched to the known modules by file
+// name. Returns 0 on success and -1 on error.
+static int Covreaddrcov(FILE *f,char *line,t_snapshot *ps,
+  const t_covmodule *mod,int nmod,CMDLENFUNC *cmdlen,t_covstat *st) {
+  int i,k,n,nfield,idcol,pathcol,count,id,*map;
+  u32 nbb,start,size;
+  u8 rec[8];
+  char *p;
+  count=-1;
+  idcol=0; pathcol=-1;
+  map=NULL;
+  nbb=0;
+  while (fgets(line,COVLINE,f)!=NULL) {
+    Covstripline(line);
+    if (strncmp(line,"Module Table:",13)==0) {
+      // Either "Module Table: N" (version 1) or "version V, count N".
+      p=strstr(line,"count");
+      count=atoi(p!=NULL?p+5:line+13);
+      if (count<0) count=0; }
+    else if (strncmp(line,"Columns:",8)==0) {
+      for (p=line+8,nfield=0; p!=NULL; nfield++) {
+        while (*p==' ') p++;
+        if (strncmp(p,"id",2)==0 && (p[2]==',' || p[2]=='\0')) idcol=nfield;
+        if (strncmp(p,"path",4)==0) pathcol=nfield;
+        p=strchr(p,',');
+        if (p!=NULL) p++;
+      };
+    }
+    else if (strncmp(line,"BB Table:",9)==0) {
+      nbb=(u32)strtoul(line+9,NULL,10);
+      break; }
+    else if (count>=0 && isdigit((u8)line[strspn(line," ")])) {
+      // Module line. Path is the last column and may contain commas.
+      if (map==NULL) {
+        map=(int *)malloc((count>0?count:1)*sizeof(int));
+        if (map==NULL) return -1;
+        for (i=0; i<count; i++) map[i]=-1; };
+      id=-1;
+      for (p=line,k=0; p!=NULL; k++) {
+        while (*p==' ') p++;
+        if (k==idcol) id=atoi(p);
+        if (k==pathcol || (pathcol<0 && strchr(p,',')==NULL))
+          break;
+        p=strchr(p,',');
+        if (p!=NULL) p++;
+      };
+      if (p!=NULL && id>=0 && id<count) {
+        n=(int)strlen(Covbasename(p));
+        map[id]=Covfindmodule(mod,nmod,Covbasename(p),n); };
+    };
+  };
+  if (map==NULL)
+    return -1;                         // Module table is missing
+  // Block table is either binary or, if drcov was run with -dump_text, text
+  // lines "module[  id]: 0xoffset, size".
+  k=fgetc(f);
+  if (k!=EOF) ungetc(k,f);
+  if (k=='m') {
+    while (fgets(line,COVLINE,f)!=NULL) {
+      p=strchr(line,'[');
+      if (p==NULL) { st->nbad++; continue; };
+      id=atoi(p+1);
+      p=strchr(p,':');
+      if (p==NULL) { st->nbad++; continue; };
+      p++;
+      while (*p==' ') p++;
+      if (Covparsehex(p,&start)==0) { st->nbad++; continue; };
+      p=strchr(p,',');
+      size=(p==NULL?1:(u32)strtoul(p+1,NULL,10));
+      st->nrecord++;
+      if (id<0 || id>=count || map[id]<0)
+        st->nlost++;
+      else
+        Covmark(ps,map[id],start,size,cmdlen,st);
+    }; }
+  else {
+    while (nbb>0 && fread(rec,8,1,f)==1) {
+      start=rec[0]|(rec[1]<<8)|(rec[2]<<16)|((u32)rec[3]<<24);
+      size=rec[4]|(rec[5]<<8);
+      id=rec[6]|(rec[7]<<8);
+      st->nrecord++;
+      nbb--;
+      if (id>=count || map[id]<0)
+        st->nlost++;
+      else
+        Covmark(ps,map[id],start,size,cmdlen,st);
+    };
+  };
+  free(map);
+  return 0;
+};
+
+// Parses one line of address list and marks the command. Main module, if not
+// -1, is used for offsets without module name.
+static void Covreadline(char *line,t_snapshot *ps,const t_covmodule *mod,
+  int nmod,int mainmod,t_covstat *st) {
+  int i;
+  u32 addr;
+  char *p,*q;
+  for (p=line; *p==' ' || *p=='\t'; p++) ;
+  if (*p=='\0' || *p=='#' || *p==';')
+    return;
+  for (q=p; *q!='\0' && *q!='+' && *q!=':' && *q!=' ' && *q!='\t' && *q!=','; q++) ;
+  if (*q=='+') {
+    // Offset from the base of named module.
+    i=Covfindmodule(mod,nmod,p,(int)(q-p));
+    if (Covparsehex(q+1,&addr)==0) {
+      st->nbad++; return; };
+    st->nrecord++;
+    if (i<0) st->nlost++;
+    else Covmark(ps,i,addr,1,NULL,st);
+    return; };
+  if (*q==':') p=q+1;                  // IDA segment prefix
+  if (Covparsehex(p,&addr)==0) {
+    st->nbad++; return; };
+  st->nrecord++;
+  i=Covmoduleat(mod,nmod,addr);
+  if (i>=0) {
+    Covmark(ps,i,addr-mod[i].base,1,NULL,st);
+    return; };
+  for (i=0; i<nmod; i++) {
+    if (mod[i].prefbase!=0 && addr-mod[i].prefbase<mod[i].size) {
+      Covmark(ps,i,addr-mod[i].prefbase,1,NULL,st);
+      return;
+    };
+  };
+  if (mainmod>=0 && mainmod<nmod && addr<mod[mainmod].size)
+    Covmark(ps,mainmod,addr,1,NULL,st);
+  else
+    st->nlost++;
+};
+
+// Reads coverage file into the snapshot. Previous contents of snapshot is
+// discarded. Snapshot gets one block per module, modules must be sorted by
+// base and must not overlap. Function cmdlen, if not NULL, is used to split
+// basic blocks of drcov logs into commands. Native snapshot files are loaded
+// as they are, without relocation. On success, returns 0 and builds rank
+// directory, on error returns -1. File must be opened in binary mode.
+int Covread(FILE *f,t_snapshot *ps,const t_covmodule *mod,int nmod,
+  int mainmod,CMDLENFUNC *cmdlen,t_covstat *st) {
+  int i,result;
+  u8 magic[4];
+  char *line;
+  memset(st,0,sizeof(t_covstat));
+  Snapfree(ps);
+  if (fread(magic,1,4,f)==4 && Getle32(magic)==SNAPMAGIC) {
+    result=Covreadnative(f,ps,NULL,NULL);
+    if (result==0) st->nrecord=ps->nhit;
+    return result; };
+  rewind(f);
+  for (i=0; i<nmod; i++) {
+    if (Snapaddblock(ps,mod[i].base,mod[i].size)==NULL) {
+      Snapfree(ps);
+      return -1;
+    };
+  };
+  line=(char *)malloc(COVLINE);
+  if (line==NULL) {
+    Snapfree(ps);
+    return -1; };
+  result=0;
+  if (fgets(line,COVLINE,f)!=NULL) {
+    Covstripline(line);
+    if (strncmp(line,"DRCOV VERSION",13)==0)
+      result=Covreaddrcov(f,line,ps,mod,nmod,cmdlen,st);
+    else {
+      do {
+        Covstripline(line);
+        Covreadline(line,ps,mod,nmod,mainmod,st);
+      } while (fgets(line,COVLINE,f)!=NULL);
+    };
+  };
+  free(line);
+  if (result==0 && ferror(f)) result=-1;
+  if (result==0) result=Snapbuildrank(ps);
+  if (result!=0) Snapfree(ps);
+  return result;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// SNAPSHOT STORE /////////////////////////////////
+
+// Store file starts with STOREMAGIC, STOREVERSION, 0, 0 and is followed by
+// records, which are only ever appended. Each record is tag, length of data in
+// bytes, and data; all values are little-endian 32-bit words:
+//   STORE_CHUNK: hash0, hash1, nword, followed by nword words of bits;
+//   STORE_SNAP:  length of name, nhit, nblock, nmod, UTF-8 name padded to the
+//                multiple of 4 bytes, modules as in native file, nblock times
+//                base, size, nhit, 0, and finally hash0, hash1 of each chunk
+//                of each block.
+// Record that was cut by crash is ignored and overwritten by the next one. If
+// the same name is stored again, the latest manifest wins. Collisions of
+// 64-bit hash are not checked: store is meant for thousands of snapshots, not
+// billions of chunks.
+
+#define STORE_CHUNK    1               // Record with distinct chunk
+#define STORE_SNAP     2               // Record with manifest
+#define STOREHDR       4               // Words in the header
+#define STORESEED      0x9E3779B1      // Seed of the second hash
+
+#define Nchunks(size)  ((Nwords(size)+STORECHUNK-1)/STORECHUNK)
+
+typedef struct t_manifest {            // Manifest read from the store
+  u8             *data;                // Whole manifest, must be freed
+  u32            nmod;                 // Number of modules
+  const u8       *mods;                // First module
+  u32            nblock;               // Number of blocks
+  const u8       *blocks;              // Table of blocks, 16 bytes each
+  const u8       *hashes;              // Hashes of chunks, 8 bytes each
+} t_manifest;
+
+// Calculates both hashes of nword words. Hashes are taken from little-endian
+// image, so that store is portable. Buf must hold STORECHUNK words. Returns 0
+// if chunk is empty, and 1 otherwise.
+static int Hashchunk(const u32 *bits,u32 nword,u32 *hash,u8 *buf) {
+  u32 i;
+  const u8 *image;
+  for (i=0; i<nword && bits[i]==0; i++) ;
+  if (i>=nword) {
+    hash[0]=hash[1]=0;
+    return 0; };
+  if (Islittleendian())
+    image=(const u8 *)bits;
+  else {
+    for (i=0; i<nword; i++) Putle32(buf+i*4,bits[i]);
+    image=buf; };
+  hash[0]=Hashbytes(image,nword*4,0);
+  hash[1]=Hashbytes(image,nword*4,STORESEED);
+  if (hash[0]==0 && hash[1]==0)
+    hash[1]=1;                         // 0:0 is reserved for empty chunk
+  return 1;
+};
+
+// Rebuilds hash table of chunks, doubling it if it is more than half full.
+static int Storerehash(t_store *pt) {
+  u32 i,j,n,*hash;
+  n=(pt->nhash==0?1024:pt->nhash);
+  while (pt->nchunk*2>=n) n*=2;
+  hash=(u32 *)calloc(n,sizeof(u32));
+  if (hash==NULL)
+    return -1;
+  for (i=0; i<pt->nchunk; i++) {
+    for (j=pt->chunk[i].hash[0] & (n-1); hash[j]!=0; j=(j+1) & (n-1)) ;
+    hash[j]=i+1; };
+  if (pt->hash!=NULL) free(pt->hash);
+  pt->hash=hash;
+  pt->nhash=n;
+  return 0;
+};
+
+static t_storechunk *Storelookup(const t_store *pt,const u32 *hash) {
+  u32 j;
+  t_storechunk *pc;
+  if (pt->nhash==0)
+    return NULL;
+  for (j=hash[0] & (pt->nhash-1); pt->hash[j]!=0; j=(j+1) & (pt->nhash-1)) {
+    pc=pt->chunk+pt->hash[j]-1;
+    if (pc->hash[0]==hash[0] && pc->hash[1]==hash[1]) return pc; };
+  return NULL;
+};
+
+// Adds chunk to the index. Returns 0 on success and -1 if memory is low.
+static int Storeindex(t_store *pt,const u32 *hash,u32 nword,long offset) {
+  u32 j;
+  t_storechunk *pc;
+  if (pt->nchunk>=pt->maxchunk) {
+    pc=(t_storechunk *)realloc(pt->chunk,
+      (pt->maxchunk*2+1024)*sizeof(t_storechunk));
+    if (pc==NULL)
+      return -1;
+    pt->chunk=pc;
+    pt->maxchunk=pt->maxchunk*2+1024; };
+  pc=pt->chunk+pt->nchunk;
+  pc->hash[0]=hash[0]; pc->hash[1]=hash[1];
+  pc->nword=nword;
+  pc->offset=offset;
+  pt->nchunk++;
+  if ((pt->nchunk*2>=pt->nhash && Storerehash(pt)!=0)) {
+    pt->nchunk--;
+    return -1; };
+  for (j=hash[0] & (pt->nhash-1); pt->hash[j]!=0; j=(j+1) & (pt->nhash-1)) ;
+  pt->hash[j]=pt->nchunk;
+  return 0;
+};
+
+// Adds manifest to the list. Name is cut to COVPATH-1 bytes.
+static int Storeaddsnap(t_store *pt,const char *name,u32 namelen,
+  long offset,u32 length,u32 nhit,u32 nblock) {
+  t_storesnap *psn;
+  if (pt->nsnap>=pt->maxsnap) {
+    psn=(t_storesnap *)realloc(pt->snap,
+      (pt->maxsnap*2+64)*sizeof(t_storesnap));
+    if (psn==NULL)
+      return -1;
+    pt->snap=psn;
+    pt->maxsnap=pt->maxsnap*2+64; };
+  psn=pt->snap+pt->nsnap++;
+  if (namelen>=COVPATH) namelen=COVPATH-1;
+  memcpy(psn->name,name,namelen);
+  psn->name[namelen]='\0';
+  psn->offset=offset;
+  psn->length=length;
+  psn->nhit=nhit;
+  psn->nblock=nblock;
+  return 0;
+};
+
+// Opens store file and reads the index of chunks and manifests. Only headers
+// of records are read, chunks stay on disk. If file does not exist and create
+// is set, creates empty store. Returns 0 on success and -1 on error.
+int Storeopen(t_store *pt,const char *path,int create) {
+  u32 tag,len,hdr[STOREHDR];
+  long pos,size;
+  u8 buf[16],name[COVPATH];
+  memset(pt,0,sizeof(t_store));
+  pt->f=fopen(path,"r+b");
+  if (pt->f==NULL && create==0)
+    pt->f=fopen(path,"rb");            // Read-only store can be listed
+  else if (pt->f==NULL) {
+    pt->f=fopen(path,"w+b");
+    if (pt->f==NULL)
+      return -1;
+    hdr[0]=STOREMAGIC; hdr[1]=STOREVERSION; hdr[2]=hdr[3]=0;
+    if (Writewords(pt->f,hdr,STOREHDR)!=0 || fflush(pt->f)!=0) {
+      Storeclose(pt);
+      return -1; };
+    pt->end=STOREHDR*4;
+    return 0; };
+  if (pt->f==NULL)
+    return -1;
+  if (fseek(pt->f,0,SEEK_END)!=0 || (size=ftell(pt->f))<STOREHDR*4 ||
+    fseek(pt->f,0,SEEK_SET)!=0 || fread(buf,1,16,pt->f)!=16 ||
+    Getle32(buf)!=STOREMAGIC || Getle32(buf+4)!=STOREVERSION) {
+    Storeclose(pt);
+    return -1; };
+  pos=STOREHDR*4;
+  while (size-pos>=8) {
+    if (fseek(pt->f,pos,SEEK_SET)!=0 || fread(buf,1,8,pt->f)!=8) break;
+    tag=Getle32(buf); len=Getle32(buf+4);
+    if ((len & 3)!=0 || (u32)(size-pos-8)<len) break;
+    if (tag==STORE_CHUNK) {
+      if (len<12 || fread(buf,1,12,pt->f)!=12) break;
+      hdr[0]=Getle32(buf); hdr[1]=Getle32(buf+4); hdr[2]=Getle32(buf+8);
+      if (hdr[2]==0 || hdr[2]>STORECHUNK || len!=12+hdr[2]*4) break;
+      if (Storelookup(pt,hdr)==NULL &&
+        Storeindex(pt,hdr,hdr[2],pos+20)!=0) break; }
+    else if (tag==STORE_SNAP) {
+      if (len<16 || fread(buf,1,16,pt->f)!=16) break;
+      hdr[0]=Getle32(buf);
+      if (hdr[0]>len-16) break;
+      if (hdr[0]>=COVPATH) hdr[0]=COVPATH-1;
+      if (fread(name,1,hdr[0],pt->f)!=hdr[0]) break;
+      if (Storeaddsnap(pt,(char *)name,hdr[0],pos+8,len,
+        Getle32(buf+4),Getle32(buf+8))!=0) break;
+    };                                 // Unknown records are skipped
+    pos+=8+len;
+  };
+  pt->end=pos;
+  return 0;
+};
+
+void Storeclose(t_store *pt) {
+  if (pt->f!=NULL) fclose(pt->f);
+  if (pt->chunk!=NULL) free(pt->chunk);
+  if (pt->hash!=NULL) free(pt->hash);
+  if (pt->snap!=NULL) free(pt->snap);
+  memset(pt,0,sizeof(t_store));
+};
+
+// Returns index of the latest snapshot with given name or -1 if there is none.
+int Storefind(const t_store *pt,const char *name) {
+  int i;
+  for (i=pt->nsnap-1; i>=0; i--) {
+    if (strcmp(pt->snap[i].name,name)==0) return i; };
+  return -1;
+};
+
+// Writes record header and words of the chunk at the current position.
+static int Writechunk(FILE *f,const u32 *hash,const u32 *bits,u32 nword) {
+  u32 hdr[5];
+  hdr[0]=STORE_CHUNK; hdr[1]=12+nword*4;
+  hdr[2]=hash[0]; hdr[3]=hash[1]; hdr[4]=nword;
+  if (Writewords(f,hdr,5)!=0 || Writewords(f,bits,nword)!=0)
+    return -1;
+  return 0;
+};
+
+// Cuts off file after given size. Stream must be flushed. Returns 0 on success
+// and -1 on error.
+static int Truncatefile(FILE *f,long size) {
+#ifdef _WIN32
+  return (_chsize(_fileno(f),size)==0?0:-1);
+#else
+  return (ftruncate(fileno(f),(off_t)size)==0?0:-1);
+#endif
+};
+
+// Adds snapshot to the store. Only chunks that are not yet in the store are
+// written, their number is returned in nnew (optional). Snapshot must be
+// ranked. On error, store remains as it was before the call. Returns index of
+// the new manifest or -1 on error.
+int Storeadd(t_store *pt,const char *name,const t_snapshot *ps,
+  const t_covmodule *mod,int nmod,u32 *nnew) {
+  int i,err;
+  u32 w,n,k,nw,len,namelen,oldchunk,zero=0,hdr[8],*hashes;
+  long pos;
+  u8 *buf;
+  const t_hitblock *pb;
+  if (nnew!=NULL) *nnew=0;
+  if (pt->f==NULL || ps->ranked==0)
+    return -1;
+  // Tail of the failed or interrupted write may lie beyond the end. Shorter
+  // record would leave part of it in place, so tail is removed first.
+  if (fflush(pt->f)!=0 || Truncatefile(pt->f,pt->end)!=0 ||
+    fseek(pt->f,pt->end,SEEK_SET)!=0)
+    return -1;
+  for (i=0,n=0; i<ps->nblock; i++)
+    n+=Nchunks(ps->block[i].size);
+  hashes=(u32 *)malloc((n*2+1)*sizeof(u32));
+  buf=(u8 *)malloc(STORECHUNK*4);
+  if (hashes==NULL || buf==NULL) {
+    if (hashes!=NULL) free(hashes);
+    if (buf!=NULL) free(buf);
+    return -1; };
+  oldchunk=pt->nchunk;
+  pos=pt->end;
+  err=0;
+  for (i=0,k=0; i<ps->nblock && err==0; i++) {
+    pb=ps->block+i;
+    nw=Nwords(pb->size);
+    for (w=0; w<nw && err==0; w+=STORECHUNK,k+=2) {
+      n=(nw-w<STORECHUNK?nw-w:STORECHUNK);
+      if (Hashchunk(pb->bits+w,n,hashes+k,buf)==0 ||
+        Storelookup(pt,hashes+k)!=NULL)
+        continue;                      // Empty or already stored
+      if (Writechunk(pt->f,hashes+k,pb->bits+w,n)!=0 ||
+        Storeindex(pt,hashes+k,n,pos+20)!=0)
+        err=1;
+      pos+=20+n*4;
+    };
+  };
+  // Manifest.
+  namelen=(u32)strlen(name);
+  if (namelen>=COVPATH) namelen=COVPATH-1;
+  len=16+((namelen+3) & 0xFFFFFFFC)+ps->nblock*16+k*4;
+  for (i=0; i<nmod; i++)
+    len+=20+(((u32)strlen(mod[i].path)+3) & 0xFFFFFFFC);
+  hdr[0]=STORE_SNAP; hdr[1]=len;
+  hdr[2]=namelen; hdr[3]=ps->nhit; hdr[4]=(u32)ps->nblock; hdr[5]=(u32)nmod;
+  if (err==0 && (Writewords(pt->f,hdr,6)!=0 ||
+    fwrite(name,1,namelen,pt->f)!=namelen ||
+    fwrite(&zero,1,(4-(namelen & 3)) & 3,pt->f)!=((4-(namelen & 3)) & 3)))
+    err=1;
+  for (i=0; i<nmod && err==0; i++) {
+    n=(u32)strlen(mod[i].path);
+    hdr[0]=mod[i].base; hdr[1]=mod[i].size;
+    hdr[2]=mod[i].entry; hdr[3]=mod[i].prefbase; hdr[4]=n;
+    if (Writewords(pt->f,hdr,5)!=0 || fwrite(mod[i].path,1,n,pt->f)!=n ||
+      fwrite(&zero,1,(4-(n & 3)) & 3,pt->f)!=((4-(n & 3)) & 3))
+      err=1;
+  };
+  for (i=0; i<ps->nblock && err==0; i++) {
+    pb=ps->block+i;
+    hdr[0]=pb->base; hdr[1]=pb->size; hdr[2]=pb->nhit; hdr[3]=0;
+    if (Writewords(pt->f,hdr,4)!=0) err=1; };
+  if (err==0 && Writewords(pt->f,hashes,k)!=0)
+    err=1;
+  if (err==0 && fflush(pt->f)!=0)
+    err=1;
+  if (err==0 &&
+    Storeaddsnap(pt,name,namelen,pos+8,len,ps->nhit,(u32)ps->nblock)!=0)
+    err=1;
+  if (err==0 && nnew!=NULL)
+    *nnew=pt->nchunk-oldchunk;
+  if (err!=0) {
+    // Partially written records are cut off. If this fails, next call to
+    // Storeadd() tries again.
+    fflush(pt->f);
+    Truncatefile(pt->f,pt->end);
+    pt->nchunk=oldchunk;
+    Storerehash(pt); }
+  else
+    pt->end=pos+8+len;
+  free(buf);
+  free(hashes);
+  return (err==0?pt->nsnap-1:-1);
+};
+
+// Reads and checks manifest of the snapshot. All lengths and counts are
+// checked against the size of the manifest, so that parts can be accessed
+// without further checks.
+static int Readmanifest(t_store *pt,int index,t_manifest *pm) {
+  u32 i,n,pos,len,plen,nchunk;
+  const t_storesnap *psn;
+  memset(pm,0,sizeof(t_manifest));
+  if (index<0 || index>=pt->nsnap)
+    return -1;
+  psn=pt->snap+index;
+  pm->data=(u8 *)malloc(psn->length);
+  if (pm->data==NULL)
+    return -1;
+  if (fseek(pt->f,psn->offset,SEEK_SET)!=0 ||
+    fread(pm->data,1,psn->length,pt->f)!=psn->length) {
+    free(pm->data);
+    pm->data=NULL;
+    return -1; };
+  len=psn->length;
+  n=Getle32(pm->data);
+  pos=(n>len-16?len+1:16+((n+3) & 0xFFFFFFFC));
+  pm->nblock=Getle32(pm->data+8);
+  pm->nmod=Getle32(pm->data+12);
+  pm->mods=pm->data+pos;
+  for (i=0; i<pm->nmod; i++) {
+    if (pos>len || len-pos<20) break;
+    plen=Getle32(pm->data+pos+16);
+    if (plen>len-pos-20) break;
+    pos+=20+((plen+3) & 0xFFFFFFFC); };
+  if (i<pm->nmod || pos>len || (len-pos)/16<pm->nblock) {
+    free(pm->data);
+    pm->data=NULL;
+    return -1; };
+  pm->blocks=pm->data+pos;
+  pos+=pm->nblock*16;
+  pm->hashes=pm->data+pos;
+  for (i=0,nchunk=0; i<pm->nblock; i++) {
+    n=Getle32(pm->blocks+i*16+4);
+    if (n>0xFFFFFFE0 || Nchunks(n)>(len-pos)/8-nchunk) break;
+    nchunk+=Nchunks(n); };
+  if (i<pm->nblock || (len-pos)/8!=nchunk) {
+    free(pm->data);
+    pm->data=NULL;
+    return -1; };
+  return 0;
+};
+
+// Converts module table of the manifest. Lengths of paths were checked by
+// Readmanifest(). Returns 0 on success and -1 if memory is low.
+static int Manifestmodules(const t_manifest *pm,t_covmodule **mod,int *nmod) {
+  u32 i,pos,len;
+  t_covmodule *pcm;
+  if (mod!=NULL) *mod=NULL;
+  if (nmod!=NULL) *nmod=0;
+  if (mod==NULL || pm->nmod==0)
+    return 0;
+  pcm=(t_covmodule *)malloc(pm->nmod*sizeof(t_covmodule));
+  if (pcm==NULL)
+    return -1;
+  for (i=0,pos=0; i<pm->nmod; i++) {
+    pcm[i].base=Getle32(pm->mods+pos);
+    pcm[i].size=Getle32(pm->mods+pos+4);
+    pcm[i].entry=Getle32(pm->mods+pos+8);
+    pcm[i].prefbase=Getle32(pm->mods+pos+12);
+    len=Getle32(pm->mods+pos+16);
+    memcpy(pcm[i].path,pm->mods+pos+20,(len<COVPATH?len:COVPATH-1));
+    pcm[i].path[len<COVPATH?len:COVPATH-1]='\0';
+    pos+=20+((len+3) & 0xFFFFFFFC);
+  };
+  *mod=pcm;
+  if (nmod!=NULL) *nmod=(int)pm->nmod;
+  return 0;
+};
+
+// Reads bits of the chunk with given hashes into nword words at bits. Empty
+// chunk is not read, caller must provide zeroed words.
+static int Readchunk(t_store *pt,const u8 *hash,u32 *bits,u32 nword) {
+  u32 i,h[2];
+  t_storechunk *pc;
+  h[0]=Getle32(hash); h[1]=Getle32(hash+4);
+  if (h[0]==0 && h[1]==0)
+    return 0;
+  pc=Storelookup(pt,h);
+  if (pc==NULL || pc->nword!=nword || fseek(pt->f,pc->offset,SEEK_SET)!=0 ||
+    fread(bits,4,nword,pt->f)!=nword)
+    return -1;
+  if (Islittleendian()==0) {
+    for (i=0; i<nword; i++) bits[i]=Getle32((u8 *)(bits+i)); };
+  return 0;
+};
+
+// Reads snapshot from the store into ps, which gets its own bits, and builds
+// rank directory. Module table, if requested, is allocated and must be freed
+// by the caller. Returns 0 on success and -1 on error.
+int Storeload(t_store *pt,int index,t_snapshot *ps,
+  t_covmodule **mod,int *nmod) {
+  u32 i,w,n,nw;
+  const u8 *hash;
+  t_hitblock *pb;
+  t_manifest man;
+  Snapfree(ps);
+  if (mod!=NULL) *mod=NULL;
+  if (nmod!=NULL) *nmod=0;
+  if (Readmanifest(pt,index,&man)!=0)
+    return -1;
+  hash=man.hashes;
+  for (i=0; i<man.nblock; i++) {
+    pb=Snapaddblock(ps,Getle32(man.blocks+i*16),Getle32(man.blocks+i*16+4));
+    if (pb==NULL) break;
+    nw=Nwords(pb->size);
+    for (w=0; w<nw; w+=STORECHUNK,hash+=8) {
+      n=(nw-w<STORECHUNK?nw-w:STORECHUNK);
+      if (Readchunk(pt,hash,pb->bits+w,n)!=0) break; };
+    if (w<nw) break;
+  };
+  if (i<man.nblock || Snapbuildrank(ps)!=0 ||
+    Manifestmodules(&man,mod,nmod)!=0) {
+    Snapfree(ps);
+    free(man.data);
+    return -1; };
+  free(man.data);
+  return 0;
+};
+
+// Calculates difference a-b of two stored snapshots. Where both have block
+// with the same base and size, chunks with equal hashes are known to cancel
+// out and are not read at all; their number is returned in nskip (optional).
+// Remaining blocks of a are subtracted from the whole snapshot b. Result gets
+// layout and, if requested, module table of a. Returns 0 on success and -1 on
+// error.
+int Storediff(t_store *pt,int a,int b,t_snapshot *ps,
+  t_covmodule **mod,int *nmod,u32 *nskip) {
+  int err,partial;
+  u32 i,j,k,w,n,nw,base,size,skipped,*tmp;
+  const u8 *ha,*hb,*hashb;
+  t_hitblock *pb;
+  t_manifest ma,mb;
+  t_snapshot full,result;
+  Snapfree(ps);
+  if (mod!=NULL) *mod=NULL;
+  if (nmod!=NULL) *nmod=0;
+  if (nskip!=NULL) *nskip=0;
+  if (Readmanifest(pt,a,&ma)!=0)
+    return -1;
+  if (Readmanifest(pt,b,&mb)!=0) {
+    free(ma.data);
+    return -1; };
+  tmp=(u32 *)malloc(STORECHUNK*sizeof(u32));
+  err=(tmp==NULL || Manifestmodules(&ma,mod,nmod)!=0);
+  partial=0; skipped=0;
+  ha=ma.hashes; hashb=mb.hashes;
+  for (i=0,j=0; i<ma.nblock && err==0; i++) {
+    base=Getle32(ma.blocks+i*16);
+    size=Getle32(ma.blocks+i*16+4);
+    pb=Snapaddblock(ps,base,size);
+    if (pb==NULL) {
+      err=1;
+      break; };
+    // Blocks of both manifests are sorted, so single merge walk suffices.
+    while (j<mb.nblock && Getle32(mb.blocks+j*16)<base) {
+      hashb+=8*Nchunks(Getle32(mb.blocks+j*16+4));
+      j++; };
+    hb=NULL;
+    if (j<mb.nblock && Getle32(mb.blocks+j*16)==base &&
+      Getle32(mb.blocks+j*16+4)==size)
+      hb=hashb;
+    else
+      partial=1;
+    nw=Nwords(size);
+    for (w=0; w<nw && err==0; w+=STORECHUNK,ha+=8) {
+      n=(nw-w<STORECHUNK?nw-w:STORECHUNK);
+      if (hb!=NULL && memcmp(ha,hb,8)==0) {
+        skipped++; }
+      else if (Readchunk(pt,ha,pb->bits+w,n)!=0)
+        err=1;
+      else if (hb!=NULL && (Getle32(hb)|Getle32(hb+4))!=0) {
+        for (k=0; k<n; k++) tmp[k]=0;
+        if (Readchunk(pt,hb,tmp,n)!=0) err=1;
+        for (k=0; k<n; k++) pb->bits[w+k]&=~tmp[k];
+      };
+      if (hb!=NULL) hb+=8;
+    };
+  };
+  if (tmp!=NULL) free(tmp);
+  free(ma.data);
+  free(mb.data);
+  if (err==0 && partial) {
+    // Layouts differ, subtract snapshot b as a whole.
+    Snapinit(&full);
+    Snapinit(&result);
+    Snapbuildrank(ps);
+    if (Storeload(pt,b,&full,NULL,NULL)!=0 || Snapandnot(&result,ps,&full)!=0)
+      err=1;
+    Snapfree(&full);
+    Snapfree(ps);
+    *ps=result; };
+  if (err==0 && Snapbuildrank(ps)!=0)
+    err=1;
+  if (err!=0) {
+    Snapfree(ps);
+    if (mod!=NULL && *mod!=NULL) free(*mod);
+    if (mod!=NULL) *mod=NULL;
+    if (nmod!=NULL) *nmod=0;
+    return -1; };
+  if (nskip!=NULL) *nskip=skipped;
+  return 0;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////// DIFF STREAM ///////////////////////////////////
+
+// Diff stream file consists of little-endian words STREAMMAGIC, STREAMVERSION,
+// nhit, STREAMSTEP, offset of index, number of groups, followed by varints and
+// the index. Varint keeps 7 bits per byte, lowest first, and bit 7 is set in
+// all bytes except the last. Index lists offset and first address of each
+// group. Header is completed by Streamfinish(), until then nhit is 0.
+
+#define STREAMHDR      6               // Words in the header
+
+// Creates stream in the file that must be opened for reading and writing in
+// binary mode. From now on, file belongs to the stream and is closed by
+// Streamfree(), also if creation fails. Returns 0 on success and -1 on error.
+int Streamcreate(t_diffstream *pd,FILE *f) {
+  u32 hdr[STREAMHDR];
+  memset(pd,0,sizeof(t_diffstream));
+  pd->group=STREAM_NONE;
+  pd->f=f;
+  pd->buf=(u8 *)malloc(STREAMBUF);
+  if (pd->buf==NULL) {
+    Streamfree(pd);
+    return -1; };
+  hdr[0]=STREAMMAGIC; hdr[1]=STREAMVERSION; hdr[2]=0;
+  hdr[3]=STREAMSTEP; hdr[4]=hdr[5]=0;
+  if (Writewords(f,hdr,STREAMHDR)!=0) {
+    Streamfree(pd);
+    return -1; };
+  return 0;
+};
+
+// Appends address to the stream. Addresses must be strictly ascending. Returns
+// 0 on success and -1 on error.
+int Streamput(t_diffstream *pd,u32 addr) {
+  u32 delta,*pi;
+  if (pd->nhit>0 && addr<=pd->last)
+    return -1;
+  if ((pd->nhit % STREAMSTEP)==0) {
+    if (pd->nindex>=pd->maxindex) {
+      pi=(u32 *)realloc(pd->index,(pd->maxindex*2+256)*2*sizeof(u32));
+      if (pi==NULL)
+        return -1;
+      pd->index=pi;
+      pd->maxindex=pd->maxindex*2+256; };
+    pd->index[pd->nindex*2]=pd->size;
+    pd->index[pd->nindex*2+1]=addr;
+    pd->nindex++;
+    delta=addr; }
+  else
+    delta=addr-pd->last;
+  if (pd->nbuf>STREAMBUF-5) {
+    if (fwrite(pd->buf,1,pd->nbuf,pd->f)!=pd->nbuf)
+      return -1;
+    pd->nbuf=0; };
+  while (delta>=0x80) {
+    pd->buf[pd->nbuf++]=(u8)(delta | 0x80);
+    delta>>=7;
+    pd->size++; };
+  pd->buf[pd->nbuf++]=(u8)delta;
+  pd->size++;
+  pd->nhit++;
+  pd->last=addr;
+  return 0;
+};
+
+// Writes buffered varints, index and final header. Stream remains open for
+// reading. Returns 0 on success and -1 on error.
+int Streamfinish(t_diffstream *pd) {
+  u32 hdr[STREAMHDR];
+  if (pd->nbuf>0 && fwrite(pd->buf,1,pd->nbuf,pd->f)!=pd->nbuf)
+    return -1;
+  pd->nbuf=0;
+  hdr[0]=STREAMMAGIC; hdr[1]=STREAMVERSION; hdr[2]=pd->nhit;
+  hdr[3]=STREAMSTEP; hdr[4]=STREAMHDR*4+pd->size; hdr[5]=pd->nindex;
+  if ((pd->nindex>0 && Writewords(pd->f,pd->index,pd->nindex*2)!=0) ||
+    fseek(pd->f,0,SEEK_SET)!=0 || Writewords(pd->f,hdr,STREAMHDR)!=0 ||
+    fflush(pd->f)!=0)
+    return -1;
+  return 0;
+};
+
+// Decodes group into page. Returns 0 on success and -1 on error.
+static int Streamload(t_diffstream *pd,u32 group) {
+  u32 i,n,k,end,addr,delta,shift;
+  if (group==pd->group)
+    return 0;
+  if (pd->page==NULL) {
+    pd->page=(u32 *)malloc(STREAMSTEP*sizeof(u32));
+    if (pd->page==NULL) return -1; };
+  pd->group=STREAM_NONE;
+  end=(group+1<pd->nindex?pd->index[group*2+2]:pd->size);
+  n=end-pd->index[group*2];
+  if (n>STREAMBUF || fseek(pd->f,STREAMHDR*4+pd->index[group*2],SEEK_SET)!=0 ||
+    fread(pd->buf,1,n,pd->f)!=n)
+    return -1;
+  for (i=k=0,addr=0; k<STREAMSTEP && i<n; k++) {
+    for (delta=0,shift=0; i<n; shift+=7) {
+      delta|=(u32)(pd->buf[i] & 0x7F)<<shift;
+      if ((pd->buf[i++] & 0x80)==0) break; };
+    addr+=delta;
+    pd->page[k]=addr;
+  };
+  pd->group=group;
+  return 0;
+};
+
+// Reads address in given row of finished stream. Returns 0 on success and -1
+// on error or if row is out of range.
+int Streamget(t_diffstream *pd,u32 row,u32 *addr) {
+  if (pd->f==NULL || row>=pd->nhit || Streamload(pd,row/STREAMSTEP)!=0)
+    return -1;
+  *addr=pd->page[row % STREAMSTEP];
+  return 0;
+};
+
+// Returns row of the first address not below addr, or nhit if there is none
+// or on error. Index gives the group, and only this group is decoded.
+u32 Streamfind(t_diffstream *pd,u32 addr) {
+  u32 lo,hi,mid,n;
+  if (pd->f==NULL || pd->nindex==0 || addr>pd->last)
+    return pd->nhit;
+  // Last group that starts at or below addr.
+  lo=0; hi=pd->nindex;
+  while (hi-lo>1) {
+    mid=(lo+hi)/2;
+    if (pd->index[mid*2+1]<=addr) lo=mid;
+    else hi=mid; };
+  if (Streamload(pd,lo)!=0)
+    return pd->nhit;
+  n=(pd->nhit-lo*STREAMSTEP<STREAMSTEP?pd->nhit-lo*STREAMSTEP:STREAMSTEP);
+  hi=n;
+  lo=0;
+  while (lo<hi) {
+    mid=(lo+hi)/2;
+    if (pd->page[mid]<addr) lo=mid+1;
+    else hi=mid; };
+  return pd->group*STREAMSTEP+lo;
+};
+
+// Closes the file and releases memory.
+void Streamfree(t_diffstream *pd) {
+  if (pd->f!=NULL) fclose(pd->f);
+  if (pd->buf!=NULL) free(pd->buf);
+  if (pd->index!=NULL) free(pd->index);
+  if (pd->page!=NULL) free(pd->page);
+  memset(pd,0,sizeof(t_diffstream));
+  pd->group=STREAM_NONE;
+};
@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                    DiffSnake COVERAGE FILES HEADER FILE                    //
+//                                                                            //
+// Snapshot files: native format and formats of other coverage tools. Like   //
+// snapcore, this part is portable and must not include windows.h or          //
+// plugin.h.                                                                  //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __COVFILE_H
+#define __COVFILE_H
+
+#include <stdio.h>
+
+#include "snapcore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COVPATH        520             // Max length of UTF-8 module path
+#define COVBUFREC      4096            // Records buffered before write
+#define COVLINE        1024            // Max length of text line in import
+
+#define SNAPMAGIC      0x504E5344      // "DSNP", first word of native file
+#define SNAPVERSION    1               // Version of native file format
+
+typedef struct t_covmodule {           // Module listed in coverage file
+  u32            base;                 // Base address in memory
+  u32            size;                 // Size of memory image, bytes
+  u32            entry;                // Entry point or 0 if unknown
+  u32            prefbase;             // Preferred (file) base or 0
+  char           path[COVPATH];        // Full path, UTF-8
+} t_covmodule;
+
+typedef struct t_covstat {             // Statistics of import
+  u32            nrecord;              // Records (blocks or addresses) read
+  u32            nlost;                // Records outside of known modules
+  u32            nbad;                 // Unrecognized text lines
+} t_covstat;
+
+// Returns length of command at given address, or 0 if unknown.
+typedef u32 CMDLENFUNC(u32 addr);
+
+int    Covwritedrcov(FILE *f,const t_snapshot *ps,
+         const t_covmodule *mod,int nmod);
+int    Covwritenative(FILE *f,const t_snapshot *ps,
+         const t_covmodule *mod,int nmod);
+int    Covmapnative(const u8 *image,u32 size,t_snapshot *ps,
+         t_covmodule **mod,int *nmod);
+int    Covreadnative(FILE *f,t_snapshot *ps,t_covmodule **mod,int *nmod);
+int    Covread(FILE *f,t_snapshot *ps,const t_covmodule *mod,int nmod,
+         int mainmod,CMDLENFUNC *cmdlen,t_covstat *st);
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// SNAPSHOT STORE /////////////////////////////////
+
+// Store keeps many snapshots in one file. Bitmaps are cut into chunks of
+// STORECHUNK words, counted from the base of the block, and each distinct
+// chunk is saved once under the hash of its contents. Snapshot itself is only
+// a manifest that lists hashes of its chunks. Empty chunks are not saved at
+// all and have hash 0:0.
+
+#define STOREMAGIC     0x54535344      // "DSST", first word of store file
+#define STOREVERSION   1               // Version of store file format
+#define STORECHUNK     256             // Bitmap words per chunk
+
+typedef struct t_storechunk {          // Distinct chunk saved in the store
+  u32            hash[2];              // Two hashes of little-endian words
+  u32            nword;                // Number of words, 1..STORECHUNK
+  long           offset;               // Position of words in the file
+} t_storechunk;
+
+typedef struct t_storesnap {           // Manifest of the stored snapshot
+  char           name[COVPATH];        // Name of the snapshot, UTF-8
+  long           offset;               // Position of manifest in the file
+  u32            length;               // Length of manifest, bytes
+  u32            nhit;                 // Number of hits
+  u32            nblock;               // Number of blocks
+} t_storesnap;
+
+typedef struct t_store {               // Open snapshot store
+  FILE           *f;                   // Store file or NULL
+  long           end;                  // End of the last complete record
+  t_storechunk   *chunk;               // Distinct chunks
+  u32            nchunk;               // Number of distinct chunks
+  u32            maxchunk;             // Allocated entries in chunk
+  u32            *hash;                // Hash table: chunk index+1 or 0
+  u32            nhash;                // Size of hash table, power of 2
+  t_storesnap    *snap;                // Manifests in the order of addition
+  int            nsnap;                // Number of manifests
+  int            maxsnap;              // Allocated entries in snap
+} t_store;
+
+int    Storeopen(t_store *pt,const char *path,int create);
+void   Storeclose(t_store *pt);
+int    Storefind(const t_store *pt,const char *name);
+int    Storeadd(t_store *pt,const char *name,const t_snapshot *ps,
+         const t_covmodule *mod,int nmod,u32 *nnew);
+int    Storeload(t_store *pt,int index,t_snapshot *ps,
+         t_covmodule **mod,int *nmod);
+int    Storediff(t_store *pt,int a,int b,t_snapshot *ps,
+         t_covmodule **mod,int *nmod,u32 *nskip);
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////// DIFF STREAM ///////////////////////////////////
+
+// Diff stream is a file of ascending addresses written one by one as they are
+// found, so that diff of any size takes constant memory while it is produced.
+// Addresses are delta-coded varints. Every STREAMSTEP-th address starts a new
+// group coded from zero, and only the position of each group is kept in
+// memory; rows are read back by decoding single group.
+
+#define STREAMMAGIC    0x46445344      // "DSDF", first word of diff stream
+#define STREAMVERSION  1               // Version of diff stream format
+#define STREAMSTEP     4096            // Addresses per group
+#define STREAMBUF      65536           // Size of file buffer, bytes
+#define STREAM_NONE    0xFFFFFFFF      // No group is decoded
+
+typedef struct t_diffstream {          // Diff streamed to file
+  FILE           *f;                   // Stream file or NULL
+  u32            nhit;                 // Number of written addresses
+  u32            last;                 // Last written address
+  u32            size;                 // Bytes of varints, buffered included
+  u8             *buf;                 // File buffer, STREAMBUF bytes
+  u32            nbuf;                 // Bytes waiting in buf
+  u32            *index;               // Offset and first address of groups
+  u32            nindex;               // Number of groups
+  u32            maxindex;             // Allocated groups in index
+  u32            *page;                // Decoded addresses of one group
+  u32            group;                // Group in page or STREAM_NONE
+} t_diffstream;
+
+int    Streamcreate(t_diffstream *pd,FILE *f);
+int    Streamput(t_diffstream *pd,u32 addr);
+int    Streamfinish(t_diffstream *pd);
+int    Streamget(t_diffstream *pd,u32 row,u32 *addr);
+u32    Streamfind(t_diffstream *pd,u32 addr);
+void   Streamfree(t_diffstream *pd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                                 // __COVFILE_H
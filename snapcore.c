@@ -0,0 +1,982 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                          DiffSnake PORTABLE CORE                           //
+//                                                                            //
+// This file must not include windows.h or plugin.h. It is shared between the //
+// plugin and offline tools.                                                  //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapcore.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////// BUMP ARENA ////////////////////////////////////
+
+// Initializes empty arena. Memory is allocated on the first request.
+void Arenainit(t_arena *pa,u32 initsize) {
+  pa->data=NULL;
+  pa->used=0;
+  pa->size=0;
+  pa->initsize=(initsize<256?256:initsize);
+};
+
+// Reserves size bytes in the arena and returns offset of the reserved area, or
+// ARENA_NULL if memory is exhausted. Contents of reserved memory is undefined.
+u32 Arenaalloc(t_arena *pa,u32 size) {
+  u32 offset,newsize;
+  u8 *newdata;
+  size=(size+ARENA_ALIGN-1) & ~(u32)(ARENA_ALIGN-1);
+  if (size>0x7FFFFFFF-pa->used)
+    return ARENA_NULL;                 // Arena can't exceed 2 GB
+  if (pa->used+size>pa->size) {
+    newsize=(pa->size==0?pa->initsize:pa->size);
+    while (newsize<pa->used+size)
+      newsize*=2;
+    newdata=(u8 *)realloc(pa->data,newsize);
+    if (newdata==NULL)
+      return ARENA_NULL;
+    pa->data=newdata;
+    pa->size=newsize; };
+  offset=pa->used;
+  pa->used+=size;
+  return offset;
+};
+
+// Discards all allocations but keeps the buffer for reuse.
+void Arenareset(t_arena *pa) {
+  pa->used=0;
+};
+
+// Releases memory occupied by arena. Arena remains usable.
+void Arenadestroy(t_arena *pa) {
+  if (pa->data!=NULL)
+    free(pa->data);
+  pa->data=NULL;
+  pa->used=0;
+  pa->size=0;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////// HIT SNAPSHOTS ///////////////////////////////////
+
+// Returns number of set bits in u. Old compilers have no intrinsic for this.
+u32 Popcount(u32 u) {
+  u=u-((u>>1) & 0x55555555);
+  u=(u & 0x33333333)+((u>>2) & 0x33333333);
+  u=(u+(u>>4)) & 0x0F0F0F0F;
+  return (u*0x01010101)>>24;
+};
+
+// Returns position of the n-th (0-based) set bit in u. Bit must exist.
+static u32 Selectinword(u32 u,u32 n) {
+  u32 pos=0,c;
+  c=Popcount(u & 0xFFFF);
+  if (n>=c) { n-=c; u>>=16; pos+=16; };
+  c=Popcount(u & 0xFF);
+  if (n>=c) { n-=c; u>>=8; pos+=8; };
+  while (1) {
+    if (u & 1) {
+      if (n==0) return pos;
+      n--; };
+    u>>=1; pos++;
+  };
+};
+
+// Initializes empty snapshot.
+void Snapinit(t_snapshot *ps) {
+  ps->nblock=0;
+  ps->maxblock=0;
+  ps->block=NULL;
+  ps->nhit=0;
+  ps->ranked=1;
+  ps->mapped=0;
+};
+
+// Frees all memory occupied by the snapshot. Snapshot remains valid and empty.
+void Snapfree(t_snapshot *ps) {
+  int i;
+  for (i=0; i<ps->nblock; i++) {
+    if (ps->mapped==0) free(ps->block[i].bits);
+    if (ps->block[i].rank!=NULL) free(ps->block[i].rank);
+    if (ps->block[i].sample!=NULL) free(ps->block[i].sample); };
+  if (ps->block!=NULL) free(ps->block);
+  Snapinit(ps);
+};
+
+// Adds block with no hits. Blocks must be added in ascending order of
+// addresses and must not overlap. Returns pointer to the new block (valid
+// till the next call to Snapaddblock()) or NULL on error.
+t_hitblock *Snapaddblock(t_snapshot *ps,u32 base,u32 size) {
+  if (ps->mapped)
+    return NULL;                       // Can't mix own and external bits
+  return Snapattachblock(ps,base,size,NULL);
+};
+
+// Adds block with bits that are owned by the caller, usually mapped from the
+// file, or, if bits is NULL, allocates zeroed bits. Snapshot with external
+// bits is read-only: Snapfree() releases descriptors and rank directories,
+// but not the bits. Block must end below 0xFFFFFFFF, so that base+size and
+// Nwords(size) don't wrap.
+t_hitblock *Snapattachblock(t_snapshot *ps,u32 base,u32 size,u32 *bits) {
+  t_hitblock *pb;
+  if (size==0 || (ps->nblock>0 && (bits!=NULL)!=(ps->mapped!=0)))
+    return NULL;                       // Empty block or mixed ownership
+  if (size>0xFFFFFFFF-base || size>0xFFFFFFE0)
+    return NULL;                       // Block wraps around address space
+  if (ps->nblock>0) {
+    pb=ps->block+ps->nblock-1;
+    if (base<pb->base+pb->size)
+      return NULL;                     // Unordered or overlapping block
+  };
+  if (ps->nblock>=ps->maxblock) {
+    pb=(t_hitblock *)realloc(ps->block,
+      (ps->maxblock*2+16)*sizeof(t_hitblock));
+    if (pb==NULL)
+      return NULL;
+    ps->block=pb;
+    ps->maxblock=ps->maxblock*2+16; };
+  pb=ps->block+ps->nblock;
+  if (bits!=NULL) {
+    pb->bits=bits;
+    ps->mapped=1; }
+  else {
+    pb->bits=(u32 *)calloc(Nwords(size),sizeof(u32));
+    if (pb->bits==NULL)
+      return NULL;
+  };
+  pb->base=base;
+  pb->size=size;
+  pb->nhit=0;
+  pb->first=0;
+  pb->rank=NULL;
+  pb->sample=NULL;
+  ps->nblock++;
+  ps->ranked=0;
+  return pb;
+};
+
+// Returns block that contains given address or NULL.
+t_hitblock *Snapfindblock(const t_snapshot *ps,u32 addr) {
+  int lo=0,hi=ps->nblock-1,mid;
+  t_hitblock *pb;
+  while (lo<=hi) {
+    mid=(lo+hi)/2;
+    pb=ps->block+mid;
+    if (addr<pb->base)
+      hi=mid-1;
+    else if (addr>=pb->base+pb->size)
+      lo=mid+1;
+    else
+      return pb;
+  };
+  return NULL;
+};
+
+// Checks whether address is in the snapshot.
+int Snaptest(const t_snapshot *ps,u32 addr) {
+  t_hitblock *pb;
+  pb=Snapfindblock(ps,addr);
+  if (pb==NULL)
+    return 0;
+  return Testbit(pb,addr-pb->base);
+};
+
+// Builds rank directories and select samples of all blocks and counts hits.
+// Directory costs one 32-bit counter per SUPERBITS bits, i.e. 1/16 of the
+// bitmap, samples are negligible. Returns 0 on success and -1 if memory is
+// low.
+int Snapbuildrank(t_snapshot *ps) {
+  int i;
+  u32 j,k,nword,nsuper,count,total;
+  t_hitblock *pb;
+  total=0;
+  for (i=0; i<ps->nblock; i++) {
+    pb=ps->block+i;
+    nword=Nwords(pb->size);
+    nsuper=(nword+SUPERWORDS-1)/SUPERWORDS;
+    if (pb->rank!=NULL) free(pb->rank);
+    if (pb->sample!=NULL) free(pb->sample);
+    pb->sample=NULL;
+    pb->rank=(u32 *)malloc((nsuper+1)*sizeof(u32));
+    if (pb->rank==NULL)
+      return -1;
+    count=0;
+    for (j=0; j<nsuper; j++) {
+      pb->rank[j]=count;
+      for (k=j*SUPERWORDS; k<nword && k<(j+1)*SUPERWORDS; k++)
+        count+=Popcount(pb->bits[k]);
+    };
+    pb->rank[nsuper]=count;
+    pb->nhit=count;
+    // Sample k is the superblock that contains hit k*SELECTSTEP. Last sample
+    // is the last superblock and limits the search from above.
+    pb->sample=(u32 *)malloc((count/SELECTSTEP+2)*sizeof(u32));
+    if (pb->sample==NULL)
+      return -1;
+    for (j=0,k=0; k*SELECTSTEP<count; k++) {
+      while (pb->rank[j+1]<=k*SELECTSTEP) j++;
+      pb->sample[k]=j; };
+    pb->sample[k]=(nsuper>0?nsuper-1:0);
+    pb->first=total;
+    total+=count;
+  };
+  ps->nhit=total;
+  ps->ranked=1;
+  return 0;
+};
+
+// Returns number of hits with addresses below addr. If addr itself is a hit,
+// this is its 0-based index in the snapshot. Requires rank directory.
+u32 Snaprank(const t_snapshot *ps,u32 addr) {
+  int lo=0,hi=ps->nblock-1,mid;
+  u32 i,w,r;
+  t_hitblock *pb;
+  // Find last block that starts at or below addr.
+  while (lo<=hi) {
+    mid=(lo+hi)/2;
+    if (ps->block[mid].base<=addr) lo=mid+1; else hi=mid-1; };
+  if (hi<0)
+    return 0;                          // Below the first block
+  pb=ps->block+hi;
+  if (addr>=pb->base+pb->size)
+    return pb->first+pb->nhit;         // In the gap after the block
+  i=addr-pb->base;
+  r=pb->rank[i/SUPERBITS];
+  for (w=(i/SUPERBITS)*SUPERWORDS; w<(i>>5); w++)
+    r+=Popcount(pb->bits[w]);
+  if (i & 31)
+    r+=Popcount(pb->bits[i>>5] & ((1u<<(i & 31))-1));
+  return pb->first+r;
+};
+
+// Finds address of hit with given 0-based index. Returns 0 on success and -1
+// if index is out of range. Requires rank directory. Cost is binary search
+// over blocks, binary search over the few superblocks between two select
+// samples and at most SUPERWORDS popcounts.
+int Snapselect(const t_snapshot *ps,u32 index,u32 *addr) {
+  int lo,hi,mid;
+  u32 slo,shi,smid,w,c;
+  t_hitblock *pb;
+  if (index>=ps->nhit)
+    return -1;
+  lo=0; hi=ps->nblock-1;
+  while (lo<hi) {
+    mid=(lo+hi+1)/2;
+    if (ps->block[mid].first<=index) lo=mid; else hi=mid-1; };
+  pb=ps->block+lo;
+  index-=pb->first;
+  slo=pb->sample[index/SELECTSTEP];
+  shi=pb->sample[index/SELECTSTEP+1];
+  while (slo<shi) {
+    smid=(slo+shi+1)/2;
+    if (pb->rank[smid]<=index) slo=smid; else shi=smid-1; };
+  index-=pb->rank[slo];
+  for (w=slo*SUPERWORDS; ; w++) {
+    c=Popcount(pb->bits[w]);
+    if (index<c) break;
+    index-=c; };
+  *addr=pb->base+w*32+Selectinword(pb->bits[w],index);
+  return 0;
+};
+
+// Clears in dst bits that are set in src. Both bit strings start at bit
+// offsets doff and soff and have length n.
+static void Clearbits(u32 *dst,u32 doff,const u32 *src,u32 soff,u32 n) {
+  u32 i;
+  if ((doff & 31)==0 && (soff & 31)==0) {
+    // Fast path: memory blocks are page-aligned, so this is the usual case.
+    dst+=doff>>5; src+=soff>>5;
+    for (i=0; i+32<=n; i+=32)
+      *dst++&=~*src++;
+    if (i<n)
+      *dst&=~(*src & ((1u<<(n-i))-1));
+    return; };
+  for (i=0; i<n; i++) {
+    if ((src[(soff+i)>>5]>>((soff+i) & 31)) & 1)
+      dst[(doff+i)>>5]&=~(1u<<((doff+i) & 31));
+  };
+};
+
+// Calculates dest=a AND NOT b, i.e. addresses hit in a but not in b. Blocks of
+// the result are those of a. Previous contents of dest is discarded, dest must
+// be different from a and b. Builds rank directory of the result. Returns 0
+// on success and -1 on error.
+int Snapandnot(t_snapshot *dest,const t_snapshot *a,const t_snapshot *b) {
+  int i,j;
+  u32 lo,hi;
+  t_hitblock *pa,*pb,*pd;
+  Snapfree(dest);
+  j=0;
+  for (i=0; i<a->nblock; i++) {
+    pa=a->block+i;
+    pd=Snapaddblock(dest,pa->base,pa->size);
+    if (pd==NULL) {
+      Snapfree(dest);
+      return -1; };
+    memcpy(pd->bits,pa->bits,Nwords(pa->size)*sizeof(u32));
+    // Blocks of both snapshots are sorted, so single merge walk suffices.
+    while (j<b->nblock && b->block[j].base+b->block[j].size<=pa->base) j++;
+    while (j<b->nblock && b->block[j].base<pa->base+pa->size) {
+      pb=b->block+j;
+      lo=(pb->base>pa->base?pb->base:pa->base);
+      hi=(pb->base+pb->size<pa->base+pa->size?
+        pb->base+pb->size:pa->base+pa->size);
+      Clearbits(pd->bits,lo-pa->base,pb->bits,lo-pb->base,hi-lo);
+      if (pb->base+pb->size>pa->base+pa->size)
+        break;                         // Block of b continues in next block of a
+      j++;
+    };
+  };
+  return Snapbuildrank(dest);
+};
+
+// Copies src to dest leaving out runs of empty words, so that memory taken by
+// the result is proportional to the number of hits and not to the size of
+// blocks. Runs separated by at most COMPACTGAP empty words share the block,
+// as each block costs its descriptor. Dest must be different from src.
+// Builds rank directory of the result. Returns 0 on success and -1 on error.
+int Snapcompact(t_snapshot *dest,const t_snapshot *src) {
+  int i;
+  u32 w,nw,first,last,size;
+  const t_hitblock *pb;
+  t_hitblock *pd;
+  Snapfree(dest);
+  for (i=0; i<src->nblock; i++) {
+    pb=src->block+i;
+    nw=Nwords(pb->size);
+    for (w=0; w<nw; w++) {
+      if (pb->bits[w]==0) continue;
+      first=last=w;
+      for (w++; w<nw && w-last<=COMPACTGAP; w++) {
+        if (pb->bits[w]!=0) last=w; };
+      size=((last+1)*32<pb->size?(last+1)*32:pb->size)-first*32;
+      pd=Snapaddblock(dest,pb->base+first*32,size);
+      if (pd==NULL) {
+        Snapfree(dest);
+        return -1; };
+      memcpy(pd->bits,pb->bits+first,(last-first+1)*sizeof(u32));
+      w=last;
+    };
+  };
+  return Snapbuildrank(dest);
+};
+
+// Prepares walk over hits with addresses in the range first..last inclusive.
+// Iterator keeps pointer to the snapshot, which must not change during the
+// walk.
+void Snapiterinit(t_snapiter *pi,const t_snapshot *ps,u32 first,u32 last) {
+  int lo=0,hi=ps->nblock-1,mid;
+  t_hitblock *pb;
+  pi->ps=ps;
+  pi->last=last;
+  pi->word=0;
+  pi->bits=0;
+  // Find first block that ends above first.
+  while (lo<=hi) {
+    mid=(lo+hi)/2;
+    pb=ps->block+mid;
+    if (pb->base+pb->size<=first) lo=mid+1; else hi=mid-1; };
+  pi->block=lo;
+  if (lo>=ps->nblock || first>last)
+    pi->block=ps->nblock;
+  else {
+    pb=ps->block+lo;
+    if (pb->size!=0) {
+      if (first<=pb->base)
+        pi->bits=pb->bits[0];
+      else {
+        pi->word=(first-pb->base)>>5;
+        pi->bits=pb->bits[pi->word] & (0xFFFFFFFF<<((first-pb->base) & 31));
+      };
+    };
+  };
+};
+
+// Gets address of the next hit in ascending order. Returns 1 on success and 0
+// if there are no more hits in the range. Empty words are skipped whole, so
+// walk costs one test per 32 bytes of memory plus one step per hit.
+int Snapiternext(t_snapiter *pi,u32 *addr) {
+  u32 a;
+  const t_hitblock *pb;
+  while (pi->block<pi->ps->nblock) {
+    pb=pi->ps->block+pi->block;
+    if (pi->bits!=0) {
+      a=pb->base+pi->word*32+Selectinword(pi->bits,0);
+      pi->bits&=pi->bits-1;
+      if (a>pi->last)
+        break;
+      *addr=a;
+      return 1; };
+    pi->word++;
+    if (pi->word<Nwords(pb->size)) {
+      pi->bits=pb->bits[pi->word];
+      continue; };
+    pi->block++;
+    pi->word=0;
+    if (pi->block>=pi->ps->nblock)
+      break;
+    pb++;
+    if (pb->base>pi->last)
+      break;
+    pi->bits=(pb->size>0?pb->bits[0]:0);
+  };
+  pi->block=pi->ps->nblock;
+  return 0;
+};
+
+// Compares ranges by their first address, for qsort().
+static int Rangecmp(const void *a,const void *b) {
+  u32 ra=((const u32 *)a)[0],rb=((const u32 *)b)[0];
+  return (ra<rb?-1:(ra>rb?1:0));
+};
+
+// Creates in dest empty blocks that cover all blocks of nsrc snapshots.
+// Ranges are extended to multiples of 32 bytes and merged if they overlap or
+// touch, so that every word of dest covers 32 aligned addresses and can be
+// calculated from the words returned by Snapgetwords(). Previous contents of
+// dest is discarded. Returns 0 on success and -1 on error.
+int Snaplayout(t_snapshot *dest,const t_snapshot *const *src,int nsrc) {
+  int i,j,n;
+  u32 *range,lo,last;
+  Snapfree(dest);
+  for (i=n=0; i<nsrc; i++)
+    n+=src[i]->nblock;
+  if (n==0)
+    return Snapbuildrank(dest);
+  range=(u32 *)malloc(n*2*sizeof(u32));
+  if (range==NULL)
+    return -1;
+  for (i=n=0; i<nsrc; i++) {
+    for (j=0; j<src[i]->nblock; j++,n++) {
+      range[n*2]=src[i]->block[j].base & 0xFFFFFFE0;
+      range[n*2+1]=(src[i]->block[j].base+src[i]->block[j].size-1) | 31;
+    };
+  };
+  qsort(range,n,2*sizeof(u32),Rangecmp);
+  for (i=0; i<n; i=j) {
+    lo=range[i*2]; last=range[i*2+1];
+    for (j=i+1; j<n && range[j*2]<=last+1 && last!=0xFFFFFFFF; j++) {
+      if (range[j*2+1]>last) last=range[j*2+1]; };
+    if (last-lo+1==0 || Snapaddblock(dest,lo,last-lo+1)==NULL) {
+      free(range);
+      Snapfree(dest);
+      return -1;
+    };
+  };
+  free(range);
+  return Snapbuildrank(dest);
+};
+
+// Returns n (1..32) bits that start at bit offset off.
+static u32 Getbits(const u32 *bits,u32 off,u32 n) {
+  u32 u,shift;
+  shift=off & 31;
+  bits+=off>>5;
+  u=bits[0]>>shift;
+  if (shift!=0 && n>32-shift)
+    u|=bits[1]<<(32-shift);
+  if (n<32)
+    u&=(1u<<n)-1;
+  return u;
+};
+
+// Positions cursor on the first block of the snapshot that ends above addr.
+void Snapcursorinit(t_snapcursor *pc,const t_snapshot *ps,u32 addr) {
+  int lo=0,hi=ps->nblock-1,mid;
+  while (lo<=hi) {
+    mid=(lo+hi)/2;
+    if (ps->block[mid].base+ps->block[mid].size<=addr) lo=mid+1; else hi=mid-1; };
+  pc->ps=ps;
+  pc->block=lo;
+};
+
+// ORs n bits that start at bit offset soff of src into dst at bit offset
+// doff. If both offsets are aligned, this is a plain loop over words.
+static void Orbits(u32 *dst,u32 doff,const u32 *src,u32 soff,u32 n) {
+  u32 k;
+  if ((doff & 31)==0 && (soff & 31)==0) {
+    dst+=doff>>5; src+=soff>>5;
+    for (; n>=32; n-=32)
+      *dst++|=*src++;
+    if (n>0)
+      *dst|=*src & ((1u<<n)-1);
+    return; };
+  while (n>0) {
+    k=32-(doff & 31);
+    if (k>n) k=n;
+    dst[doff>>5]|=Getbits(src,soff,k)<<(doff & 31);
+    doff+=k; soff+=k; n-=k;
+  };
+};
+
+// Reads n words of the snapshot for addresses that start at addr, which must
+// be a multiple of 32: bit i of word k corresponds to address addr+k*32+i,
+// addresses outside of blocks read as 0. Addresses must grow from call to
+// call, so that the cursor moves over the blocks only forward. Reading in
+// runs allows caller to process words in tight loops.
+void Snapgetwords(t_snapcursor *pc,u32 addr,u32 *buf,u32 n) {
+  u32 lo,end,last;
+  const t_hitblock *pb;
+  memset(buf,0,n*sizeof(u32));
+  if (n==0)
+    return;
+  last=addr+(n*32-1);
+  while (pc->block<pc->ps->nblock) {
+    pb=pc->ps->block+pc->block;
+    end=pb->base+pb->size;
+    if (end<=addr) {
+      pc->block++;                     // Block is below the range
+      continue; };
+    if (pb->base>last)
+      break;                           // Block is above the range
+    lo=(pb->base>addr?pb->base:addr);
+    Orbits(buf,lo-addr,pb->bits,lo-pb->base,(end-1<last?end-1:last)-lo+1);
+    if (end-1>last)
+      break;                           // Block continues after the range
+    pc->block++;
+  };
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////// CORPUS MINIMIZATION ///////////////////////////////
+
+// Minimization selects small subset of snapshots (inputs of fuzzer, test
+// runs) that together hit all addresses hit by the whole set. Exact solution
+// is NP-hard, greedy algorithm takes each time snapshot that adds most new
+// hits. Gain of snapshot can only decrease as coverage grows, so stale gains
+// in the priority queue are upper bounds, and only the top of the queue must
+// be re-evaluated (lazy greedy). Usually few snapshots are re-evaluated per
+// selection, instead of all of them.
+
+typedef struct t_covercand {           // Candidate in priority queue
+  u32            gain;                 // Upper bound of new hits
+  int            index;                // Index of snapshot
+  int            round;                // Selections when gain was exact
+} t_covercand;
+
+// Returns 1 if candidate a must be taken before b: larger gain first, on tie
+// lower index.
+static int Candbefore(const t_covercand *a,const t_covercand *b) {
+  return (a->gain>b->gain || (a->gain==b->gain && a->index<b->index));
+};
+
+// Restores heap order going down from position i.
+static void Heapdown(t_covercand *heap,int n,int i) {
+  int child;
+  t_covercand t;
+  while ((child=i*2+1)<n) {
+    if (child+1<n && Candbefore(heap+child+1,heap+child)) child++;
+    if (!Candbefore(heap+child,heap+i)) break;
+    t=heap[i]; heap[i]=heap[child]; heap[child]=t;
+    i=child;
+  };
+};
+
+// Calculates number of hits of ps that are not yet covered, or, if add is
+// not 0, adds them to covered and returns their number. Covered is laid out
+// by Snaplayout() over all candidates. Blocks of ps may share aligned words,
+// such words are processed once.
+static u32 Covergain(const t_snapshot *ps,t_snapshot *covered,u32 *buf,int add) {
+  int i;
+  u32 addr,end,next,n,k,w,gain;
+  u32 *cov;
+  const t_hitblock *pb;
+  t_hitblock *pc;
+  t_snapcursor cur;
+  gain=0;
+  next=0;
+  Snapcursorinit(&cur,ps,0);
+  for (i=0; i<ps->nblock; i++) {
+    pb=ps->block+i;
+    addr=pb->base & 0xFFFFFFE0;
+    if (i>0 && addr<next) addr=next;
+    end=((pb->base+pb->size-1) | 31)+1;
+    if (addr>=end && i>0) continue;
+    pc=Snapfindblock(covered,addr);
+    if (pc==NULL) continue;            // Impossible if layout is correct
+    cov=pc->bits+((addr-pc->base)>>5);
+    for (n=(end-addr)>>5; n>0; n-=k,cov+=k,addr+=k*32) {
+      k=(n<SELECTSTEP?n:SELECTSTEP);
+      Snapgetwords(&cur,addr,buf,k);
+      for (w=0; w<k; w++) {
+        gain+=Popcount(buf[w] & ~cov[w]);
+        if (add) cov[w]|=buf[w];
+      };
+    };
+    next=end;
+  };
+  return gain;
+};
+
+// Selects greedy set cover of nsrc ranked snapshots. On success, returns
+// number of selected snapshots n, indices of selected snapshots in the order
+// of selection in order[0..n-1] and number of hits added by each of them in
+// gain[0..n-1]. Arrays must have space for nsrc items. If covered is not
+// NULL, it receives union of all snapshots. Returns -1 on error.
+int Snapmincover(const t_snapshot *const *src,int nsrc,
+  int *order,u32 *gain,t_snapshot *covered) {
+  int i,n,nheap;
+  u32 g,*buf;
+  t_covercand *heap;
+  t_snapshot own;
+  Snapinit(&own);
+  if (covered==NULL)
+    covered=&own;
+  for (i=0; i<nsrc; i++) {
+    if (src[i]->ranked==0) return -1; };
+  if (Snaplayout(covered,src,nsrc)!=0)
+    return -1;
+  heap=(t_covercand *)malloc((nsrc>0?nsrc:1)*sizeof(t_covercand));
+  buf=(u32 *)malloc(SELECTSTEP*sizeof(u32));
+  if (heap==NULL || buf==NULL) {
+    if (heap!=NULL) free(heap);
+    if (buf!=NULL) free(buf);
+    Snapfree(covered);
+    return -1; };
+  // Initially, gain of snapshot is the number of its hits.
+  for (i=nheap=0; i<nsrc; i++) {
+    if (src[i]->nhit==0) continue;
+    heap[nheap].gain=src[i]->nhit;
+    heap[nheap].index=i;
+    heap[nheap].round=0;
+    nheap++; };
+  for (i=nheap/2-1; i>=0; i--)
+    Heapdown(heap,nheap,i);
+  n=0;
+  while (nheap>0) {
+    if (heap[0].round!=n) {
+      // Stale bound, re-evaluate and look at the new top. Snapshot that
+      // adds nothing is dropped.
+      g=Covergain(src[heap[0].index],covered,buf,0);
+      heap[0].gain=g;
+      heap[0].round=n;
+      if (g==0) heap[0]=heap[--nheap];
+      Heapdown(heap,nheap,0);
+      continue; };
+    // Actual gain is not less than bounds of all others, take it.
+    order[n]=heap[0].index;
+    gain[n]=Covergain(src[heap[0].index],covered,buf,1);
+    n++;
+    heap[0]=heap[--nheap];
+    Heapdown(heap,nheap,0);
+  };
+  free(buf);
+  free(heap);
+  if (Snapbuildrank(covered)!=0)
+    n=-1;
+  Snapfree(&own);
+  return n;
+};
+
+// Calculates union of nsrc snapshots, laid out as by Snaplayout(). Only words
+// covered by blocks of each source are visited, so union of many small deltas
+// costs as much as their size. Returns 0 on success and -1 on error.
+int Snapunion(t_snapshot *dest,const t_snapshot *const *src,int nsrc) {
+  int i;
+  u32 *buf;
+  if (Snaplayout(dest,src,nsrc)!=0)
+    return -1;
+  buf=(u32 *)malloc(SELECTSTEP*sizeof(u32));
+  if (buf==NULL) {
+    Snapfree(dest);
+    return -1; };
+  for (i=0; i<nsrc; i++)
+    Covergain(src[i],dest,buf,1);
+  free(buf);
+  return Snapbuildrank(dest);
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// STRING POOL ////////////////////////////////////
+
+// Initializes empty string pool.
+void Poolinit(t_strpool *pp) {
+  Arenainit(&pp->text,65536);
+  pp->offset=NULL;
+  pp->nstr=0;
+  pp->maxstr=0;
+  pp->hash=NULL;
+  pp->nhash=0;
+};
+
+// Removes all strings but keeps memory for reuse.
+void Poolreset(t_strpool *pp) {
+  Arenareset(&pp->text);
+  pp->nstr=0;
+  if (pp->hash!=NULL)
+    memset(pp->hash,0,pp->nhash*sizeof(u32));
+};
+
+// Frees memory occupied by pool. Pool remains valid and empty.
+void Poolfree(t_strpool *pp) {
+  Arenadestroy(&pp->text);
+  if (pp->offset!=NULL) free(pp->offset);
+  if (pp->hash!=NULL) free(pp->hash);
+  Poolinit(pp);
+};
+
+static u32 Hashstring(const u16 *s,u32 len) {
+  u32 h=2166136261u;
+  while (len--) {
+    h=(h^*s++)*16777619u; };
+  return h;
+};
+
+// Checks whether string with given id equals s.
+static int Poolequal(const t_strpool *pp,u32 id,const u16 *s,u32 len) {
+  const u32 *p;
+  p=(const u32 *)Arenaptr(&pp->text,pp->offset[id]);
+  return (p[0]==len && memcmp(p+1,s,len*sizeof(u16))==0);
+};
+
+// Doubles hash table and reinserts all strings.
+static int Poolrehash(t_strpool *pp) {
+  u32 i,h,n,len,*newhash;
+  const u16 *s;
+  n=(pp->nhash==0?1024:pp->nhash*2);
+  newhash=(u32 *)calloc(n,sizeof(u32));
+  if (newhash==NULL)
+    return -1;
+  for (i=0; i<pp->nstr; i++) {
+    s=Poolstring(pp,i,&len);
+    h=Hashstring(s,len) & (n-1);
+    while (newhash[h]!=0) h=(h+1) & (n-1);
+    newhash[h]=i+1; };
+  if (pp->hash!=NULL) free(pp->hash);
+  pp->hash=newhash;
+  pp->nhash=n;
+  return 0;
+};
+
+// Returns id of the string, adding it to the pool if necessary, or POOL_NULL
+// if memory is low.
+u32 Poolintern(t_strpool *pp,const u16 *s,u32 len) {
+  u32 h,id,offset,*p,*newoffset;
+  if ((pp->nstr+1)*2>pp->nhash && Poolrehash(pp)!=0)
+    return POOL_NULL;                  // Keep load factor below 1/2
+  h=Hashstring(s,len) & (pp->nhash-1);
+  while (pp->hash[h]!=0) {
+    id=pp->hash[h]-1;
+    if (Poolequal(pp,id,s,len))
+      return id;
+    h=(h+1) & (pp->nhash-1); };
+  if (pp->nstr>=pp->maxstr) {
+    newoffset=(u32 *)realloc(pp->offset,(pp->maxstr*2+256)*sizeof(u32));
+    if (newoffset==NULL)
+      return POOL_NULL;
+    pp->offset=newoffset;
+    pp->maxstr=pp->maxstr*2+256; };
+  offset=Arenaalloc(&pp->text,sizeof(u32)+len*sizeof(u16));
+  if (offset==ARENA_NULL)
+    return POOL_NULL;
+  p=(u32 *)Arenaptr(&pp->text,offset);
+  p[0]=len;
+  memcpy(p+1,s,len*sizeof(u16));
+  id=pp->nstr++;
+  pp->offset[id]=offset;
+  pp->hash[h]=id+1;
+  return id;
+};
+
+// Returns pointer to the characters of the string (not null-terminated) and
+// its length. Pointer is valid till the next call to Poolintern().
+const u16 *Poolstring(const t_strpool *pp,u32 id,u32 *len) {
+  const u32 *p;
+  p=(const u32 *)Arenaptr(&pp->text,pp->offset[id]);
+  *len=p[0];
+  return (const u16 *)(p+1);
+};
+
+static int Poolcompare(const t_strpool *pp,u32 id1,u32 id2) {
+  u32 i,n1,n2;
+  const u16 *s1,*s2;
+  s1=Poolstring(pp,id1,&n1);
+  s2=Poolstring(pp,id2,&n2);
+  for (i=0; i<n1 && i<n2; i++) {
+    if (s1[i]!=s2[i]) return (s1[i]<s2[i]?-1:1); };
+  return (n1<n2?-1:(n1>n2?1:0));
+};
+
+// Returns newly allocated array that for each id contains its position in the
+// alphabetical order of strings, or NULL if memory is low. Caller must free()
+// it. After this call, strings can be ordered by comparing integers. Ids are
+// sorted by bottom-up merge sort, which needs no global comparison context.
+u32 *Poolsortorder(const t_strpool *pp) {
+  u32 i,j,k,lo,mid,hi,width,*a,*b,*t,*order;
+  order=(u32 *)malloc((pp->nstr+1)*sizeof(u32));
+  a=(u32 *)malloc((pp->nstr+1)*sizeof(u32));
+  b=(u32 *)malloc((pp->nstr+1)*sizeof(u32));
+  if (order==NULL || a==NULL || b==NULL) {
+    if (order!=NULL) free(order);
+    if (a!=NULL) free(a);
+    if (b!=NULL) free(b);
+    return NULL; };
+  for (i=0; i<pp->nstr; i++) a[i]=i;
+  for (width=1; width<pp->nstr; width*=2) {
+    for (lo=0; lo<pp->nstr; lo+=2*width) {
+      mid=(lo+width<pp->nstr?lo+width:pp->nstr);
+      hi=(lo+2*width<pp->nstr?lo+2*width:pp->nstr);
+      for (i=lo,j=mid,k=lo; k<hi; k++) {
+        if (i<mid && (j>=hi || Poolcompare(pp,a[i],a[j])<=0))
+          b[k]=a[i++];
+        else
+          b[k]=a[j++];
+      };
+    };
+    t=a; a=b; b=t; };
+  for (i=0; i<pp->nstr; i++) order[a[i]]=i;
+  free(a);
+  free(b);
+  return order;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// ADDRESS MAP ////////////////////////////////////
+
+// Initializes empty address map.
+void Mapinit(t_addrmap *pm) {
+  pm->key=NULL;
+  pm->value=NULL;
+  pm->nkey=0;
+  pm->nslot=0;
+};
+
+// Removes all entries but keeps memory for reuse.
+void Mapreset(t_addrmap *pm) {
+  if (pm->key!=NULL)
+    memset(pm->key,0xFF,pm->nslot*sizeof(u32));
+  pm->nkey=0;
+};
+
+// Frees memory occupied by map. Map remains valid and empty.
+void Mapfree(t_addrmap *pm) {
+  if (pm->key!=NULL) free(pm->key);
+  if (pm->value!=NULL) free(pm->value);
+  Mapinit(pm);
+};
+
+// Fibonacci hashing: multiplication spreads consecutive addresses, typical for
+// code, over the whole table, and top bits of the product are the best ones.
+static u32 Hashaddr(u32 addr,u32 nslot) {
+  u32 shift;
+  for (shift=32; nslot>1; nslot>>=1) shift--;
+  return (u32)(addr*2654435769u)>>shift;
+};
+
+// Doubles number of slots and reinserts all entries.
+static int Maprehash(t_addrmap *pm) {
+  u32 i,h,n,*newkey,*newvalue;
+  n=(pm->nslot==0?4096:pm->nslot*2);
+  newkey=(u32 *)malloc(n*sizeof(u32));
+  newvalue=(u32 *)malloc(n*sizeof(u32));
+  if (newkey==NULL || newvalue==NULL) {
+    if (newkey!=NULL) free(newkey);
+    if (newvalue!=NULL) free(newvalue);
+    return -1; };
+  memset(newkey,0xFF,n*sizeof(u32));
+  for (i=0; i<pm->nslot; i++) {
+    if (pm->key[i]==ADDR_EMPTY) continue;
+    h=Hashaddr(pm->key[i],n);
+    while (newkey[h]!=ADDR_EMPTY) h=(h+1) & (n-1);
+    newkey[h]=pm->key[i];
+    newvalue[h]=pm->value[i]; };
+  if (pm->key!=NULL) free(pm->key);
+  if (pm->value!=NULL) free(pm->value);
+  pm->key=newkey;
+  pm->value=newvalue;
+  pm->nslot=n;
+  return 0;
+};
+
+// Returns pointer to the value associated with address, adding new entry with
+// value 0 if necessary, or NULL if memory is low or address is ADDR_EMPTY. If
+// isnew is not NULL, reports whether entry was added. Pointer is valid till
+// the next call to Mapinsert().
+u32 *Mapinsert(t_addrmap *pm,u32 addr,int *isnew) {
+  u32 h;
+  if (addr==ADDR_EMPTY)
+    return NULL;
+  if ((pm->nkey+1)*2>pm->nslot && Maprehash(pm)!=0)
+    return NULL;                       // Keep load factor below 1/2
+  h=Hashaddr(addr,pm->nslot);
+  while (pm->key[h]!=addr) {
+    if (pm->key[h]==ADDR_EMPTY) {
+      pm->key[h]=addr;
+      pm->value[h]=0;
+      pm->nkey++;
+      if (isnew!=NULL) *isnew=1;
+      return pm->value+h; };
+    h=(h+1) & (pm->nslot-1); };
+  if (isnew!=NULL) *isnew=0;
+  return pm->value+h;
+};
+
+// Returns pointer to the value associated with address or NULL if address is
+// not in the map.
+u32 *Mapfind(const t_addrmap *pm,u32 addr) {
+  u32 h;
+  if (pm->nslot==0 || addr==ADDR_EMPTY)
+    return NULL;
+  h=Hashaddr(addr,pm->nslot);
+  while (pm->key[h]!=ADDR_EMPTY) {
+    if (pm->key[h]==addr)
+      return pm->value+h;
+    h=(h+1) & (pm->nslot-1); };
+  return NULL;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// CONTENT HASH ///////////////////////////////////
+
+#define PRIME1         2654435761u
+#define PRIME2         2246822519u
+#define PRIME3         3266489917u
+#define PRIME4         668265263u
+#define PRIME5         374761393u
+
+#define Rotl(u,n)      (((u)<<(n))|((u)>>(32-(n))))
+#define Read32(p)      ((u32)(p)[0]|((u32)(p)[1]<<8)|((u32)(p)[2]<<16)|((u32)(p)[3]<<24))
+
+// Calculates 32-bit hash of size bytes of data (xxHash32). Long data is
+// processed as four independent lanes of 32-bit words, so that the loop has
+// no dependencies between neighbouring words. Hash of the data split into
+// chunks can be obtained by passing hash of the previous chunk as seed.
+u32 Hashbytes(const u8 *data,u32 size,u32 seed) {
+  u32 h,v1,v2,v3,v4;
+  const u8 *p,*end;
+  p=data;
+  end=data+size;
+  if (size>=16) {
+    v1=seed+PRIME1+PRIME2;
+    v2=seed+PRIME2;
+    v3=seed;
+    v4=seed-PRIME1;
+    do {
+      v1=Rotl(v1+Read32(p)*PRIME2,13)*PRIME1;
+      v2=Rotl(v2+Read32(p+4)*PRIME2,13)*PRIME1;
+      v3=Rotl(v3+Read32(p+8)*PRIME2,13)*PRIME1;
+      v4=Rotl(v4+Read32(p+12)*PRIME2,13)*PRIME1;
+      p+=16;
+    } while (end-p>=16);
+    h=Rotl(v1,1)+Rotl(v2,7)+Rotl(v3,12)+Rotl(v4,18); }
+  else
+    h=seed+PRIME5;
+  h+=size;
+  for ( ; end-p>=4; p+=4)
+    h=Rotl(h+Read32(p)*PRIME3,17)*PRIME4;
+  for ( ; p<end; p++)
+    h=Rotl(h+(*p)*PRIME5,11)*PRIME1;
+  h^=h>>15; h*=PRIME2;
+  h^=h>>13; h*=PRIME3;
+  h^=h>>16;
+  return h;
+};
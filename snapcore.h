@@ -0,0 +1,196 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                     DiffSnake PORTABLE CORE HEADER FILE                    //
+//                                                                            //
+// Data structures that do not depend on OllyDbg or Windows. Everything here  //
+// must compile with plain C89 compilers (MSVC 2005 included), so: no         //
+// <stdint.h>, no inline, declarations at the beginning of the block.         //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SNAPCORE_H
+#define __SNAPCORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned char  u8;             // 8-bit unsigned
+typedef unsigned short u16;            // 16-bit unsigned
+typedef unsigned int   u32;            // 32-bit unsigned
+typedef unsigned long long u64;        // 64-bit unsigned
+
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////// BUMP ARENA ////////////////////////////////////
+
+// Arena is a single contiguous buffer that is filled from the bottom and
+// released as a whole. Allocations return offsets rather than pointers, because
+// buffer may move when it grows; use Arenaptr() to convert offset to pointer
+// and don't keep pointers across calls to Arenaalloc(). Arenareset() keeps
+// allocated memory, so repeated diffs cause neither reallocation nor
+// fragmentation once arena has reached its working size.
+
+#define ARENA_NULL     0xFFFFFFFF      // Returned by Arenaalloc() on error
+#define ARENA_ALIGN    4               // Granularity of allocations, bytes
+
+typedef struct t_arena {               // Bump allocator
+  u8             *data;                // Buffer or NULL if nothing allocated
+  u32            used;                 // Number of used bytes
+  u32            size;                 // Size of allocated buffer, bytes
+  u32            initsize;             // Size of buffer on first allocation
+} t_arena;
+
+void   Arenainit(t_arena *pa,u32 initsize);
+u32    Arenaalloc(t_arena *pa,u32 size);
+void   Arenareset(t_arena *pa);
+void   Arenadestroy(t_arena *pa);
+
+#define Arenaptr(pa,offset) ((void *)((pa)->data+(offset)))
+#define Arenacount(pa,itemsize) ((pa)->used/(itemsize))
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////// HIT SNAPSHOTS ///////////////////////////////////
+
+// Snapshot is a set of hit addresses, stored as one bit per byte of each
+// memory block. Blocks are kept sorted by address and never overlap. Along
+// with the bits, each block has a rank directory: number of set bits that
+// precede every superblock of SUPERBITS bits. Together with the number of hits
+// in preceding blocks this allows to convert address to the index of the hit
+// (rank) and back (select) without counting the whole bitmap. Select is
+// further accelerated by samples: superblock that contains every SELECTSTEP-th
+// hit, so that binary search over superblocks is limited to a short range.
+// Directory is rebuilt by Snapbuildrank() and becomes invalid on any change to
+// the bits.
+
+#define SUPERBITS      512             // Bits per rank superblock
+#define SUPERWORDS     (SUPERBITS/32)  // 32-bit words per rank superblock
+#define SELECTSTEP     4096            // Hits per select sample
+#define COMPACTGAP     8               // Empty words that don't split block
+
+typedef struct t_hitblock {            // Hit bits of one memory block
+  u32            base;                 // Address of the first byte
+  u32            size;                 // Size of the block, bytes (=bits)
+  u32            nhit;                 // Number of hits in the block
+  u32            first;                // Number of hits in preceding blocks
+  u32            *bits;                // Bit i is set if base+i was hit
+  u32            *rank;                // Hits before each superblock or NULL
+  u32            *sample;              // Superblock of each SELECTSTEP-th hit
+} t_hitblock;
+
+typedef struct t_snapshot {            // Set of hit addresses
+  int            nblock;               // Number of memory blocks
+  int            maxblock;             // Number of allocated descriptors
+  t_hitblock     *block;               // Blocks sorted by address
+  u32            nhit;                 // Total number of hits, valid if ranked
+  int            ranked;               // Rank directory is up to date
+  int            mapped;               // Bits belong to caller, read-only
+} t_snapshot;
+
+typedef struct t_snapiter {            // Walk over hits in address range
+  const t_snapshot *ps;                // Snapshot being walked
+  int            block;                // Current block
+  u32            word;                 // Current word of the block
+  u32            bits;                 // Not yet returned bits of the word
+  u32            last;                 // Last address in the range
+} t_snapiter;
+
+typedef struct t_snapcursor {          // Sequential reader of aligned words
+  const t_snapshot *ps;                // Snapshot being read
+  int            block;                // First block not below last address
+} t_snapcursor;
+
+#define Nwords(size)   (((size)+31)/32)
+#define Setbit(pb,i)   ((pb)->bits[(i)>>5]|=(1u<<((i)&31)))
+#define Testbit(pb,i)  (((pb)->bits[(i)>>5]>>((i)&31))&1)
+
+u32    Popcount(u32 u);
+void   Snapinit(t_snapshot *ps);
+void   Snapfree(t_snapshot *ps);
+t_hitblock *Snapaddblock(t_snapshot *ps,u32 base,u32 size);
+t_hitblock *Snapattachblock(t_snapshot *ps,u32 base,u32 size,u32 *bits);
+t_hitblock *Snapfindblock(const t_snapshot *ps,u32 addr);
+int    Snaptest(const t_snapshot *ps,u32 addr);
+int    Snapbuildrank(t_snapshot *ps);
+u32    Snaprank(const t_snapshot *ps,u32 addr);
+int    Snapselect(const t_snapshot *ps,u32 index,u32 *addr);
+int    Snapandnot(t_snapshot *dest,const t_snapshot *a,const t_snapshot *b);
+int    Snapcompact(t_snapshot *dest,const t_snapshot *src);
+void   Snapiterinit(t_snapiter *pi,const t_snapshot *ps,u32 first,u32 last);
+int    Snapiternext(t_snapiter *pi,u32 *addr);
+int    Snaplayout(t_snapshot *dest,const t_snapshot *const *src,int nsrc);
+void   Snapcursorinit(t_snapcursor *pc,const t_snapshot *ps,u32 addr);
+void   Snapgetwords(t_snapcursor *pc,u32 addr,u32 *buf,u32 n);
+int    Snapmincover(const t_snapshot *const *src,int nsrc,
+         int *order,u32 *gain,t_snapshot *covered);
+int    Snapunion(t_snapshot *dest,const t_snapshot *const *src,int nsrc);
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// STRING POOL ////////////////////////////////////
+
+// String pool keeps each distinct UTF-16 string once and identifies it by
+// 32-bit id, assigned in the order of first appearance. Strings are stored
+// with their actual length in the arena, lookup is done by FNV-1a hash in the
+// open-addressing table. Users keep ids instead of strings, so equality test
+// becomes comparison of integers, and after Poolsortorder() also ordering.
+
+#define POOL_NULL      0xFFFFFFFF      // Invalid string id
+
+typedef struct t_strpool {             // Pool of interned strings
+  t_arena        text;                 // u32 length followed by characters
+  u32            *offset;              // Offset of each string in text
+  u32            nstr;                 // Number of distinct strings
+  u32            maxstr;               // Allocated entries in offset
+  u32            *hash;                // Hash table: string id+1 or 0
+  u32            nhash;                // Size of hash table, power of 2
+} t_strpool;
+
+void   Poolinit(t_strpool *pp);
+void   Poolreset(t_strpool *pp);
+void   Poolfree(t_strpool *pp);
+u32    Poolintern(t_strpool *pp,const u16 *s,u32 len);
+const u16 *Poolstring(const t_strpool *pp,u32 id,u32 *len);
+u32    *Poolsortorder(const t_strpool *pp);
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// ADDRESS MAP ////////////////////////////////////
+
+// Address map associates 32-bit value with 32-bit address. Keys and values are
+// kept in two parallel open-addressing arrays with linear probing, 8 bytes per
+// slot and at most one half of slots used, so maps with millions of entries
+// stay compact and lookups touch one or two cache lines. Address ADDR_EMPTY
+// marks free slot and cannot be stored.
+
+#define ADDR_EMPTY     0xFFFFFFFF      // Key of the free slot
+
+typedef struct t_addrmap {             // Map address -> 32-bit value
+  u32            *key;                 // Addresses or ADDR_EMPTY
+  u32            *value;               // Values associated with addresses
+  u32            nkey;                 // Number of used slots
+  u32            nslot;                // Number of slots, power of 2
+} t_addrmap;
+
+void   Mapinit(t_addrmap *pm);
+void   Mapreset(t_addrmap *pm);
+void   Mapfree(t_addrmap *pm);
+u32    *Mapinsert(t_addrmap *pm,u32 addr,int *isnew);
+u32    *Mapfind(const t_addrmap *pm,u32 addr);
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////// CONTENT HASH ///////////////////////////////////
+
+// Hash of memory contents, used to recognize code that was moved or replaced.
+// It is not cryptographic: it is cheap enough to hash executable memory on
+// every snapshot, and collisions only make changed code look unchanged.
+
+u32    Hashbytes(const u8 *data,u32 size,u32 seed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif                                 // __SNAPCORE_H